@@ -0,0 +1,94 @@
+#pragma once
+
+#include "./assist.h"
+#include <vector>
+#include <stdint.h>
+#include <v8.h>
+
+namespace leveldb {
+
+// Bounds the jobs (and the bytes they copied) a database has queued but not completed yet.
+// Lives on the event loop only. Writes over the limits are refused instead of piling up,
+// and `drain` listeners are called once the backlog falls to half the limits.
+class Admission
+{
+public:
+	// rough cost of a job besides its keys and values: the job, its uv_work_t and callback.
+	static const size_t job_overhead = 128;
+
+	uint64_t max_jobs, max_bytes;		// 0 means no limit.
+	uint64_t jobs, bytes;
+	uint64_t peak_jobs, peak_bytes;
+	uint64_t rejected;
+	uint64_t shed;		// jobs skipped for being still queued past their deadline.
+
+private:
+	// keeps the js object of the database alive while its jobs are in flight.
+	v8::Persistent<v8::Object> holder;
+
+	std::vector< v8::Persistent<v8::Function> > drains;
+
+public:
+	Admission():
+		max_jobs(0), max_bytes(0), jobs(0), bytes(0), peak_jobs(0), peak_bytes(0), rejected(0), shed(0)
+	{}
+
+	CS_FORCE_INLINE bool admit(size_t charge) const
+	{
+		return (!max_jobs || jobs < max_jobs) && (!max_bytes || bytes + charge + job_overhead <= max_bytes);
+	}
+
+	CS_FORCE_INLINE bool drained() const
+	{
+		return (!max_jobs || jobs <= max_jobs / 2) && (!max_bytes || bytes <= max_bytes / 2);
+	}
+
+	void acquire(size_t charge, v8::Handle<v8::Object> owner)
+	{
+		if (jobs++ == 0)
+		{
+			holder = v8::Persistent<v8::Object>::New(owner);
+		}
+		bytes += charge;
+		// the copies of keys and values the job holds, which V8 can't see.
+		v8::V8::AdjustAmountOfExternalAllocatedMemory(charge);
+		peak_jobs = jobs > peak_jobs ? jobs : peak_jobs;
+		peak_bytes = bytes > peak_bytes ? bytes : peak_bytes;
+	}
+
+	void release(size_t charge)
+	{
+		bytes -= charge;
+		v8::V8::AdjustAmountOfExternalAllocatedMemory(-static_cast<int64_t>(charge));
+		--jobs;
+		if (!drains.empty() && drained())
+		{
+			notify_drained();
+		}
+		// listeners may have queued again.
+		if (jobs == 0)
+		{
+			holder.Dispose();
+			holder.Clear();
+		}
+	}
+
+	void on_drain(v8::Handle<v8::Function> callback)
+	{
+		drains.push_back(v8::Persistent<v8::Function>::New(callback));
+	}
+
+	void notify_drained()
+	{
+		v8::HandleScope scope;
+		std::vector< v8::Persistent<v8::Function> > callbacks;
+		callbacks.swap(drains);
+		for (size_t i = 0; i < callbacks.size(); ++i)
+		{
+			callbacks[i]->Call(v8::Context::GetCurrent()->Global(), 0, NULL);
+			callbacks[i].Dispose();
+		}
+	}
+};
+
+}
@@ -0,0 +1,300 @@
+#pragma once
+
+#include "./assist.h"
+#include <cstring>
+#include <limits>
+#include <stdint.h>
+#ifdef __SSE2__
+#	include <emmintrin.h>
+#endif
+#ifdef __SSE4_1__
+#	include <smmintrin.h>
+#endif
+
+namespace leveldb {
+
+enum AggregateOp {AggregateCount, AggregateBytes, AggregateSum, AggregateMin, AggregateMax};
+
+enum AggregateValueType {AggregateF64, AggregateI64, AggregateU32};
+
+// Reduces fixed-width little-endian values. Values are gathered into blocks
+// while scanning, and each full block is reduced by a vectorized kernel, but for the i64 sum,
+// which checks every add for overflow.
+namespace aggregate {
+
+static const size_t block_size = 256;
+
+template<typename T>
+CS_FORCE_INLINE static T decode_le(const char* data)
+{
+	T value;
+	std::memcpy(&value, data, sizeof(T));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+	if (sizeof(T) == 8)
+	{
+		uint64_t raw;
+		std::memcpy(&raw, &value, 8);
+		raw = __builtin_bswap64(raw);
+		std::memcpy(&value, &raw, 8);
+	}
+	else if (sizeof(T) == 4)
+	{
+		uint32_t raw;
+		std::memcpy(&raw, &value, 4);
+		raw = __builtin_bswap32(raw);
+		std::memcpy(&value, &raw, 4);
+	}
+#endif
+	return value;
+}
+
+// scalar kernels, also used for the tails the vector kernels leave.
+template<typename T, typename Acc>
+CS_FORCE_INLINE static Acc sum_scalar(const T* values, size_t n, Acc acc)
+{
+	for (size_t i = 0; i < n; ++i)
+	{
+		acc += values[i];
+	}
+	return acc;
+}
+
+template<typename T>
+CS_FORCE_INLINE static T min_scalar(const T* values, size_t n, T acc)
+{
+	for (size_t i = 0; i < n; ++i)
+	{
+		acc = values[i] < acc ? values[i] : acc;
+	}
+	return acc;
+}
+
+template<typename T>
+CS_FORCE_INLINE static T max_scalar(const T* values, size_t n, T acc)
+{
+	for (size_t i = 0; i < n; ++i)
+	{
+		acc = values[i] > acc ? values[i] : acc;
+	}
+	return acc;
+}
+
+static double sum(const double* values, size_t n, double acc)
+{
+	size_t i = 0;
+#ifdef __SSE2__
+	__m128d acc0 = _mm_setzero_pd(), acc1 = _mm_setzero_pd();
+	for (; i + 4 <= n; i += 4)
+	{
+		acc0 = _mm_add_pd(acc0, _mm_loadu_pd(values + i));
+		acc1 = _mm_add_pd(acc1, _mm_loadu_pd(values + i + 2));
+	}
+	double lanes[2];
+	_mm_storeu_pd(lanes, _mm_add_pd(acc0, acc1));
+	acc += lanes[0] + lanes[1];
+#endif
+	return sum_scalar(values + i, n - i, acc);
+}
+
+static double min(const double* values, size_t n, double acc)
+{
+	size_t i = 0;
+#ifdef __SSE2__
+	if (n >= 2)
+	{
+		__m128d lo = _mm_set1_pd(acc);
+		for (; i + 2 <= n; i += 2)
+		{
+			lo = _mm_min_pd(lo, _mm_loadu_pd(values + i));
+		}
+		double lanes[2];
+		_mm_storeu_pd(lanes, lo);
+		acc = lanes[0] < lanes[1] ? lanes[0] : lanes[1];
+	}
+#endif
+	return min_scalar(values + i, n - i, acc);
+}
+
+static double max(const double* values, size_t n, double acc)
+{
+	size_t i = 0;
+#ifdef __SSE2__
+	if (n >= 2)
+	{
+		__m128d hi = _mm_set1_pd(acc);
+		for (; i + 2 <= n; i += 2)
+		{
+			hi = _mm_max_pd(hi, _mm_loadu_pd(values + i));
+		}
+		double lanes[2];
+		_mm_storeu_pd(lanes, hi);
+		acc = lanes[0] > lanes[1] ? lanes[0] : lanes[1];
+	}
+#endif
+	return max_scalar(values + i, n - i, acc);
+}
+
+// the sums of doubles and of u32 can't overflow their accumulator, `spilled` is for the i64 one.
+static double sum(const double* values, size_t n, double acc, double* spilled)
+{
+	return sum(values, n, acc);
+}
+
+// scalar, every add is checked: a sum that would leave the range of int64 moves what it holds
+// to `spilled` and starts again, so the total (`*spilled + acc`) only loses precision past 2^63.
+static int64_t sum(const int64_t* values, size_t n, int64_t acc, double* spilled)
+{
+	for (size_t i = 0; i < n; ++i)
+	{
+		uint64_t res = static_cast<uint64_t>(acc) + static_cast<uint64_t>(values[i]);
+		if (CS_UNLIKELY(((static_cast<uint64_t>(acc) ^ res) & (static_cast<uint64_t>(values[i]) ^ res)) >> 63))
+		{
+			*spilled += static_cast<double>(acc);
+			acc = values[i];
+		}
+		else
+		{
+			acc = static_cast<int64_t>(res);
+		}
+	}
+	return acc;
+}
+
+// there is no 64-bit integer min/max before AVX-512, leave them to the compiler.
+static int64_t min(const int64_t* values, size_t n, int64_t acc)
+{
+	return min_scalar(values, n, acc);
+}
+
+static int64_t max(const int64_t* values, size_t n, int64_t acc)
+{
+	return max_scalar(values, n, acc);
+}
+
+// u32 values are summed in 64-bit lanes so they do not wrap.
+static uint64_t sum(const uint32_t* values, size_t n, uint64_t acc)
+{
+	size_t i = 0;
+#ifdef __SSE2__
+	const __m128i zero = _mm_setzero_si128();
+	__m128i acc0 = _mm_setzero_si128(), acc1 = _mm_setzero_si128();
+	for (; i + 4 <= n; i += 4)
+	{
+		__m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(values + i));
+		acc0 = _mm_add_epi64(acc0, _mm_unpacklo_epi32(v, zero));
+		acc1 = _mm_add_epi64(acc1, _mm_unpackhi_epi32(v, zero));
+	}
+	uint64_t lanes[2];
+	_mm_storeu_si128(reinterpret_cast<__m128i*>(lanes), _mm_add_epi64(acc0, acc1));
+	acc += lanes[0] + lanes[1];
+#endif
+	return sum_scalar(values + i, n - i, acc);
+}
+
+static uint64_t sum(const uint32_t* values, size_t n, uint64_t acc, double* spilled)
+{
+	return sum(values, n, acc);
+}
+
+static uint32_t min(const uint32_t* values, size_t n, uint32_t acc)
+{
+	size_t i = 0;
+#ifdef __SSE4_1__
+	__m128i lo = _mm_set1_epi32(static_cast<int>(acc));
+	for (; i + 4 <= n; i += 4)
+	{
+		lo = _mm_min_epu32(lo, _mm_loadu_si128(reinterpret_cast<const __m128i*>(values + i)));
+	}
+	uint32_t lanes[4];
+	_mm_storeu_si128(reinterpret_cast<__m128i*>(lanes), lo);
+	acc = min_scalar(lanes, 4, acc);
+#endif
+	return min_scalar(values + i, n - i, acc);
+}
+
+static uint32_t max(const uint32_t* values, size_t n, uint32_t acc)
+{
+	size_t i = 0;
+#ifdef __SSE4_1__
+	__m128i hi = _mm_set1_epi32(static_cast<int>(acc));
+	for (; i + 4 <= n; i += 4)
+	{
+		hi = _mm_max_epu32(hi, _mm_loadu_si128(reinterpret_cast<const __m128i*>(values + i)));
+	}
+	uint32_t lanes[4];
+	_mm_storeu_si128(reinterpret_cast<__m128i*>(lanes), hi);
+	acc = max_scalar(lanes, 4, acc);
+#endif
+	return max_scalar(values + i, n - i, acc);
+}
+
+// T: the decoded type, Acc: what sums accumulate into.
+template<typename T, typename Acc>
+class Reducer
+{
+private:
+	T block[block_size];
+	size_t filled;
+
+	void flush()
+	{
+		switch (op)
+		{
+		case AggregateSum:
+			total = aggregate::sum(block, filled, total, &spilled);
+			break;
+		case AggregateMin:
+			lowest = aggregate::min(block, filled, lowest);
+			break;
+		case AggregateMax:
+			highest = aggregate::max(block, filled, highest);
+			break;
+		default:
+			break;
+		}
+		filled = 0;
+	}
+
+public:
+	const AggregateOp op;
+	Acc total;
+	double spilled;		// what `total` could not hold.
+	T lowest, highest;
+
+	// doubles start from the infinities, so that a range of only infinite values reduces to them.
+	explicit Reducer(AggregateOp op_):
+		filled(0), op(op_), total(0), spilled(0),
+		lowest(std::numeric_limits<T>::has_infinity ? std::numeric_limits<T>::infinity() : std::numeric_limits<T>::max()),
+		highest(std::numeric_limits<T>::has_infinity ? -std::numeric_limits<T>::infinity() :
+				(std::numeric_limits<T>::is_integer ? std::numeric_limits<T>::min() : -std::numeric_limits<T>::max()))
+	{}
+
+	CS_FORCE_INLINE void add(const char* data)
+	{
+		block[filled++] = decode_le<T>(data);
+		if (CS_UNLIKELY(filled == block_size))
+		{
+			flush();
+		}
+	}
+
+	double finish()
+	{
+		flush();
+		switch (op)
+		{
+		case AggregateSum:
+			return spilled + static_cast<double>(total);
+		case AggregateMin:
+			return static_cast<double>(lowest);
+		case AggregateMax:
+			return static_cast<double>(highest);
+		default:
+			return 0;
+		}
+	}
+};
+
+}
+
+}
@@ -2,13 +2,15 @@
 #pragma once
 
 #include <string>
+#include <cstring>
+#include <stdint.h>
 #include <v8.h>
 #include <status.h>
 //#include "/data/fsuggest/staging/ccpp/meta.hpp"
 
 #ifndef CS_FORCE_INLINE
 #   ifdef __GNUC__
-#       define CS_FORCE_INLINE __attribute__((always_inline))
+#       define CS_FORCE_INLINE inline __attribute__((always_inline))
 #   else
 #       define CS_FORCE_INLINE inline
 #   endif
@@ -85,4 +87,42 @@ CS_FORCE_INLINE static std::string jsascii2str(const v8::String::AsciiValue& dat
 	return std::string(*data, data.length());
 }
 
+// MurmurHash64A, used to spread keys over shards and stripes.
+CS_FORCE_INLINE static uint64_t hash_bytes(const char* data, size_t size)
+{
+	const uint64_t m = 0xc6a4a7935bd1e995ULL;
+	const int r = 47;
+	uint64_t h = 0x5bd1e9955bd1e995ULL ^ (size * m);
+
+	const char* end = data + (size & ~static_cast<size_t>(7));
+	for (; data != end; data += 8)
+	{
+		uint64_t k;
+		std::memcpy(&k, data, sizeof(k));
+		k *= m;
+		k ^= k >> r;
+		k *= m;
+		h ^= k;
+		h *= m;
+	}
+
+	const unsigned char* tail = reinterpret_cast<const unsigned char*>(data);
+	switch (size & 7)
+	{
+	case 7: h ^= uint64_t(tail[6]) << 48;		// intentionally go ahead.
+	case 6: h ^= uint64_t(tail[5]) << 40;
+	case 5: h ^= uint64_t(tail[4]) << 32;
+	case 4: h ^= uint64_t(tail[3]) << 24;
+	case 3: h ^= uint64_t(tail[2]) << 16;
+	case 2: h ^= uint64_t(tail[1]) << 8;
+	case 1: h ^= uint64_t(tail[0]);
+		h *= m;
+	}
+
+	h ^= h >> r;
+	h *= m;
+	h ^= h >> r;
+	return h;
+}
+
 }
@@ -0,0 +1,434 @@
+// YCSB-style workloads against the binding, reporting throughput and latency percentiles per operation as JSON.
+//
+//   node bench.js --workload=a --records=100000 --ops=100000 --concurrency=16 --out=a.json
+//
+// Options (defaults in brackets):
+//   --workload        a: 50% read 50% update, b: 95/5 read/update, c: read only,
+//                     d: 95/5 read/insert of the latest keys, e: 95/5 scan/insert, f: 50/50 read/read-modify-write [a]
+//   --records         keys loaded before the run [100000]
+//   --ops             operations of the run [100000]
+//   --concurrency     operations in flight [16]
+//   --distribution    zipfian, uniform or latest, the workload's own by default
+//   --value-size      bytes of each value, or min-max for uniformly distributed sizes [100]
+//   --scan-length     scans of workload e read up to this many keys, uniformly [100]
+//   --dir             where the database is created, emptied first [/tmp/hyperleveldb-bench]
+//   --open            JSON of the options the database is opened with ['{"cacheSize": 8388608}']
+//   --seed            of the generators, runs with the same seed issue the same operations [1]
+//   --db-bench        path to leveldb's db_bench, run on the same record count, value size and cache size as a raw baseline,
+//                     `readOverheadUs` compares the reads with it when --concurrency=1
+//   --out             file the report is written to, stdout otherwise
+
+var fs = require("fs");
+var path = require("path");
+var child_process = require("child_process");
+
+var binding = require("./build/Release/hyperleveldb");
+var HyperLevelDB = binding.HyperLevelDB;
+
+var workloads = {
+    a: {read: 0.5, update: 0.5, distribution: "zipfian"},
+    b: {read: 0.95, update: 0.05, distribution: "zipfian"},
+    c: {read: 1, distribution: "zipfian"},
+    d: {read: 0.95, insert: 0.05, distribution: "latest"},
+    e: {scan: 0.95, insert: 0.05, distribution: "zipfian"},
+    f: {read: 0.5, rmw: 0.5, distribution: "zipfian"}
+};
+
+var parseArgs = function(argv) {
+    var args = {
+        workload: "a", records: 100000, ops: 100000, concurrency: 16, distribution: null,
+        "value-size": "100", "scan-length": 100, dir: "/tmp/hyperleveldb-bench",
+        open: '{"cacheSize": 8388608}', seed: 1, "db-bench": null, out: null
+    };
+    argv.forEach(function(arg) {
+        var match = /^--([^=]+)=(.*)$/.exec(arg);
+        if (!match || !(match[1] in args)) {
+            throw new Error("unknown argument " + arg);
+        }
+        args[match[1]] = typeof args[match[1]] == "number" ? Number(match[2]) : match[2];
+    });
+    if (!workloads[args.workload]) {
+        throw new Error("--workload must be one of a, b, c, d, e and f");
+    }
+    var sizes = String(args["value-size"]).split("-");
+    args.valueMin = Number(sizes[0]);
+    args.valueMax = Number(sizes[sizes.length - 1]);
+    args.distribution = args.distribution || workloads[args.workload].distribution;
+    return args;
+};
+
+// xorshift128 on 32-bit words, which stays exact in js numbers.
+var Random = function(seed) {
+    this.s = [seed | 0 || 1, 0x9e3779b9, 0x7f4a7c15, 0x85ebca6b];
+    for (var i = 0; i < 8; ++i) {
+        this.next();
+    }
+};
+
+Random.prototype.next = function() {
+    var s = this.s;
+    var t = s[3];
+    t ^= t << 11;
+    t ^= t >>> 8;
+    s[3] = s[2];
+    s[2] = s[1];
+    s[1] = s[0];
+    t ^= s[0];
+    t ^= s[0] >>> 19;
+    s[0] = t;
+    return (t >>> 0) / 4294967296;
+};
+
+Random.prototype.below = function(n) {
+    return Math.floor(this.next() * n);
+};
+
+// YCSB's ZipfianGenerator (Gray et al.), theta 0.99, over [0, items).
+var Zipfian = function(items, random) {
+    this.random = random;
+    this.theta = 0.99;
+    this.alpha = 1 / (1 - this.theta);
+    this.items = 0;
+    this.zetan = 0;
+    this.zeta2 = this.zeta(0, 2, 0);
+    this.grow(items);
+};
+
+Zipfian.prototype.zeta = function(from, to, sum) {
+    for (var i = from; i < to; ++i) {
+        sum += 1 / Math.pow(i + 1, this.theta);
+    }
+    return sum;
+};
+
+// inserts make the key space grow, zeta is extended rather than computed again.
+Zipfian.prototype.grow = function(items) {
+    if (items <= this.items) {
+        return;
+    }
+    this.zetan = this.zeta(this.items, items, this.zetan);
+    this.items = items;
+    this.eta = (1 - Math.pow(2 / items, 1 - this.theta)) / (1 - this.zeta2 / this.zetan);
+};
+
+Zipfian.prototype.next = function() {
+    var u = this.random.next();
+    var uz = u * this.zetan;
+    if (uz < 1) {
+        return 0;
+    }
+    if (uz < 1 + Math.pow(0.5, this.theta)) {
+        return 1;
+    }
+    return Math.floor(this.items * Math.pow(this.eta * u - this.eta + 1, this.alpha));
+};
+
+// FNV-1a of the index, so that the popular keys of a zipfian draw are spread over the key space.
+var scramble = function(i) {
+    var hash = 0x811c9dc5;
+    for (var b = 0; b < 4; ++b) {
+        hash ^= (i >>> (b * 8)) & 0xff;
+        hash = (hash * 0x01000193) >>> 0;
+    }
+    return hash;
+};
+
+var keyOf = function(i) {
+    var hashed = String(scramble(i));
+    return "user" + "0000000000".slice(hashed.length) + hashed + "-" + i;
+};
+
+var KeyChooser = function(distribution, records, random) {
+    this.distribution = distribution;
+    this.random = random;
+    this.count = records;
+    this.zipfian = distribution == "uniform" ? null : new Zipfian(records, random);
+};
+
+KeyChooser.prototype.inserted = function() {
+    return this.count++;
+};
+
+KeyChooser.prototype.next = function() {
+    if (this.distribution == "uniform") {
+        return this.random.below(this.count);
+    }
+    this.zipfian.grow(this.count);
+    var rank = Math.min(this.zipfian.next(), this.count - 1);
+    if (this.distribution == "latest") {
+        return this.count - 1 - rank;
+    }
+    return scramble(rank) % this.count;
+};
+
+var valueOf = function(args, random) {
+    var size = args.valueMin + random.below(args.valueMax - args.valueMin + 1);
+    var value = new Buffer(size);
+    for (var i = 0; i < size; ++i) {
+        value[i] = 97 + random.below(26);
+    }
+    return value;
+};
+
+// latencies of one kind of operation, in microseconds.
+var Recorder = function() {
+    this.samples = [];
+    this.errors = 0;
+};
+
+Recorder.prototype.add = function(started) {
+    var elapsed = process.hrtime(started);
+    this.samples.push(elapsed[0] * 1e6 + elapsed[1] / 1e3);
+};
+
+Recorder.prototype.report = function(seconds) {
+    var sorted = this.samples.slice().sort(function(a, b) { return a - b; });
+    var percentile = function(p) {
+        return sorted.length ? sorted[Math.min(sorted.length - 1, Math.floor(sorted.length * p))] : 0;
+    };
+    var sum = 0;
+    sorted.forEach(function(v) { sum += v; });
+    var round = function(v) { return Math.round(v * 10) / 10; };
+    return {
+        count: sorted.length,
+        errors: this.errors,
+        opsPerSecond: round(sorted.length / seconds),
+        meanUs: round(sorted.length ? sum / sorted.length : 0),
+        p50Us: round(percentile(0.5)),
+        p99Us: round(percentile(0.99)),
+        p999Us: round(percentile(0.999)),
+        maxUs: round(sorted.length ? sorted[sorted.length - 1] : 0)
+    };
+};
+
+var emptyDir = function(dir) {
+    if (!fs.existsSync(dir)) {
+        return;
+    }
+    fs.readdirSync(dir).forEach(function(name) {
+        var file = path.join(dir, name);
+        if (fs.statSync(file).isDirectory()) {
+            emptyDir(file);
+            fs.rmdirSync(file);
+        } else {
+            fs.unlinkSync(file);
+        }
+    });
+};
+
+var elapsedSeconds = function(started) {
+    var elapsed = process.hrtime(started);
+    return elapsed[0] + elapsed[1] / 1e9;
+};
+
+// runs `total` calls of `step(i, done)`, `concurrency` of them at once.
+var drive = function(total, concurrency, step, callback) {
+    var issued = 0, completed = 0;
+    var next = function() {
+        if (issued >= total) {
+            if (completed == total) {
+                callback();
+            }
+            return;
+        }
+        step(issued++, function() {
+            ++completed;
+            next();
+        });
+    };
+    if (total == 0) {
+        return callback();
+    }
+    for (var i = 0; i < Math.min(concurrency, total); ++i) {
+        next();
+    }
+};
+
+var load = function(db, args, random, callback) {
+    var recorder = new Recorder();
+    var chunk = 100;
+    var started = process.hrtime();
+    drive(Math.ceil(args.records / chunk), args.concurrency, function(c, done) {
+        var ops = [];
+        for (var i = c * chunk; i < Math.min(args.records, (c + 1) * chunk); ++i) {
+            ops.push({type: "put", key: keyOf(i), value: valueOf(args, random)});
+        }
+        var opStarted = process.hrtime();
+        db.batch(ops, function(err) {
+            if (err) {
+                ++recorder.errors;
+            } else {
+                recorder.add(opStarted);
+            }
+            done();
+        });
+    }, function() {
+        var seconds = elapsedSeconds(started);
+        var report = recorder.report(seconds);
+        report.records = args.records;
+        report.recordsPerSecond = Math.round(args.records / seconds);
+        report.seconds = seconds;
+        callback(report);
+    });
+};
+
+var scan = function(db, start, length, callback) {
+    var it = db.iterator({start: start, limit: length});
+    var read = 0;
+    // the iterator calls back right away, so a scan would otherwise nest as deep as it is long,
+    // and the scans of a run into one another.
+    var next = function() {
+        it.next(function(err, key, value) {
+            if (err || key === undefined) {
+                it.end();
+                return setImmediate(function() {
+                    callback(err);
+                });
+            }
+            if (++read % 64 == 0) {
+                setImmediate(next);
+            } else {
+                next();
+            }
+        });
+    };
+    next();
+};
+
+var run = function(db, args, random, callback) {
+    var mix = workloads[args.workload];
+    var keys = new KeyChooser(args.distribution, args.records, random);
+    var recorders = {};
+    var names = Object.keys(mix).filter(function(name) { return name != "distribution"; });
+    names.forEach(function(name) { recorders[name] = new Recorder(); });
+
+    var pick = function() {
+        var u = random.next(), total = 0;
+        for (var i = 0; i < names.length; ++i) {
+            total += mix[names[i]];
+            if (u < total) {
+                return names[i];
+            }
+        }
+        return names[names.length - 1];
+    };
+
+    var started = process.hrtime();
+    drive(args.ops, args.concurrency, function(i, done) {
+        var op = pick(), recorder = recorders[op];
+        // the key and the value are made before the clock starts, only the database is timed.
+        var key = keyOf(op == "insert" ? keys.inserted() : keys.next());
+        var value = op == "update" || op == "insert" || op == "rmw" ? valueOf(args, random) : null;
+        var length = op == "scan" ? 1 + random.below(args["scan-length"]) : 0;
+        var opStarted;
+        var finish = function(err) {
+            if (err && !(err.isNotFound && err.isNotFound())) {
+                ++recorder.errors;
+            } else {
+                recorder.add(opStarted);
+            }
+            done();
+        };
+        opStarted = process.hrtime();
+        if (op == "read") {
+            db.get(key, finish);
+        } else if (op == "update" || op == "insert") {
+            db.put(key, value, finish);
+        } else if (op == "scan") {
+            scan(db, key, length, finish);
+        } else {
+            db.get(key, function(err) {
+                if (err && !err.isNotFound()) {
+                    return finish(err);
+                }
+                db.put(key, value, finish);
+            });
+        }
+    }, function() {
+        var seconds = elapsedSeconds(started);
+        var ops = {};
+        names.forEach(function(name) { ops[name] = recorders[name].report(seconds); });
+        callback({seconds: seconds, opsPerSecond: Math.round(args.ops / seconds), ops: ops});
+    });
+};
+
+// leveldb's own benchmark on the same record count and value size, without the binding in between.
+// Lines of its output read `readrandom   :       4.123 micros/op; ...`.
+var dbBench = function(args, callback) {
+    if (!args["db-bench"]) {
+        return callback(null);
+    }
+    var dir = args.dir + "-db_bench";
+    var valueSize = Math.round((args.valueMin + args.valueMax) / 2);
+    var argv = [
+        "--db=" + dir, "--num=" + args.records, "--reads=" + args.ops, "--value_size=" + valueSize,
+        "--threads=1", "--benchmarks=fillrandom,overwrite,readrandom,readseq"
+    ];
+    // the same block cache as the binding, db_bench's own default is leveldb's 8MB.
+    var cacheSize = JSON.parse(args.open).cacheSize;
+    if (cacheSize > 0) {
+        argv.push("--cache_size=" + cacheSize);
+    }
+    child_process.execFile(args["db-bench"], argv, {maxBuffer: 16 << 20}, function(err, stdout, stderr) {
+        if (err) {
+            return callback({error: String(err), stderr: String(stderr)});
+        }
+        var baseline = {command: [args["db-bench"]].concat(argv).join(" ")};
+        String(stdout).split("\n").forEach(function(line) {
+            var match = /^(\w+)\s*:\s*([\d.]+) micros\/op/.exec(line);
+            if (match) {
+                baseline[match[1]] = {meanUs: Number(match[2])};
+            }
+        });
+        callback(baseline);
+    });
+};
+
+var main = function() {
+    var args = parseArgs(process.argv.slice(2));
+    var random = new Random(args.seed);
+    var report = {
+        workload: args.workload,
+        config: {
+            records: args.records, ops: args.ops, concurrency: args.concurrency, distribution: args.distribution,
+            valueSize: [args.valueMin, args.valueMax], scanLength: args["scan-length"], seed: args.seed,
+            open: JSON.parse(args.open), node: process.version
+        }
+    };
+
+    emptyDir(args.dir);
+    var db = new HyperLevelDB(args.dir);
+    db.open(report.config.open, function(err) {
+        if (err) {
+            throw err;
+        }
+        load(db, args, random, function(loaded) {
+            report.load = loaded;
+            run(db, args, random, function(ran) {
+                report.run = ran;
+                report.cacheUsage = db.cacheUsage();
+                report.scheduler = binding.scheduler();
+                db.close(function() {
+                    dbBench(args, function(baseline) {
+                        report.baseline = baseline;
+                        // what the binding adds over leveldb for a point read, when both were measured.
+                        // db_bench reads from one thread, the reads of the run are comparable with one in flight only.
+                        if (baseline && baseline.readrandom && report.run.ops.read && args.concurrency == 1) {
+                            report.readOverheadUs = Math.round((report.run.ops.read.meanUs - baseline.readrandom.meanUs) * 10) / 10;
+                        }
+                        var json = JSON.stringify(report, null, 2);
+                        if (args.out) {
+                            fs.writeFileSync(args.out, json + "\n");
+                        } else {
+                            console.log(json);
+                        }
+                    });
+                });
+            });
+        });
+    });
+};
+
+if (require.main == module) {
+    main();
+}
@@ -5,7 +5,8 @@
             "target_name": "hyperleveldb",
             "sources": [
                 "hyperleveldb.cc", 
-                "db.cc"
+                "db.cc",
+                "sharded_db.cc"
             ],
             "include_dirs": [
                 "/usr/include/node",
@@ -24,7 +25,7 @@
                     {
                         "link_settings": {
                             "ldflags": ["-Wl,-O3"],
-                            "libraries": ["-lhyperleveldb"]
+                            "libraries": ["-lhyperleveldb", "-lzstd"]
                         }
                     }
                 ]
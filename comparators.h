@@ -0,0 +1,202 @@
+#pragma once
+
+#include "./assist.h"
+#include <string>
+#include <cstring>
+#include <stdint.h>
+#include <comparator.h>
+#include <slice.h>
+
+namespace leveldb {
+
+// Built-in comparators, selected by the `comparator` open option.
+// Each order is a policy with a static `compare`, so `NativeComparator<Order>` gets it inlined
+// instead of going through another virtual call per comparison.
+namespace comparators {
+
+CS_FORCE_INLINE static uint64_t load_be64(const char* data)
+{
+	uint64_t word;
+	std::memcpy(&word, data, sizeof(word));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+	word = __builtin_bswap64(word);
+#endif
+	return word;
+}
+
+// bytewise comparison, 8 bytes a word. Keys are short, so this beats calling memcmp.
+CS_FORCE_INLINE static int compare_bytes(const char* a, size_t a_size, const char* b, size_t b_size)
+{
+	const size_t size = a_size < b_size ? a_size : b_size;
+	size_t i = 0;
+	for (; i + 8 <= size; i += 8)
+	{
+		uint64_t x = load_be64(a + i), y = load_be64(b + i);
+		if (x != y)
+		{
+			return x < y ? -1 : 1;
+		}
+	}
+	for (; i < size; ++i)
+	{
+		if (a[i] != b[i])
+		{
+			return static_cast<unsigned char>(a[i]) < static_cast<unsigned char>(b[i]) ? -1 : 1;
+		}
+	}
+	return a_size == b_size ? 0 : (a_size < b_size ? -1 : 1);
+}
+
+// decodes a varint32 at `*p`, false if it runs past `limit`.
+CS_FORCE_INLINE static bool read_varint32(const char*& p, const char* limit, uint32_t& value)
+{
+	value = 0;
+	for (uint32_t shift = 0; shift <= 28 && p < limit; shift += 7)
+	{
+		uint32_t byte = static_cast<unsigned char>(*p++);
+		value |= (byte & 0x7f) << shift;
+		if (!(byte & 0x80))
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+class ReverseBytewise
+{
+public:
+	static const char* name()
+	{
+		return "hyperleveldown.ReverseBytewise";
+	}
+
+	CS_FORCE_INLINE static int compare(const Slice& a, const Slice& b)
+	{
+		return -compare_bytes(a.data(), a.size(), b.data(), b.size());
+	}
+};
+
+// a big-endian u64 (e.g. a timestamp) followed by a suffix: newest first, then the suffix bytewise.
+// keys shorter than 8 bytes sort before all the others, bytewise among themselves.
+class U64Descending
+{
+public:
+	static const char* name()
+	{
+		return "hyperleveldown.U64Descending";
+	}
+
+	CS_FORCE_INLINE static int compare(const Slice& a, const Slice& b)
+	{
+		if (CS_BUNLIKELY(a.size() < 8 || b.size() < 8))
+		{
+			if (a.size() >= 8)
+			{
+				return 1;
+			}
+			if (b.size() >= 8)
+			{
+				return -1;
+			}
+			return compare_bytes(a.data(), a.size(), b.data(), b.size());
+		}
+		uint64_t x = load_be64(a.data()), y = load_be64(b.data());
+		if (x != y)
+		{
+			return x > y ? -1 : 1;
+		}
+		return compare_bytes(a.data() + 8, a.size() - 8, b.data() + 8, b.size() - 8);
+	}
+};
+
+// keys made of elements, each a varint32 length then its bytes. Compared element by element,
+// a key that is a prefix of the other sorts first. A malformed remainder is compared bytewise.
+class LengthPrefixedTuple
+{
+public:
+	static const char* name()
+	{
+		return "hyperleveldown.LengthPrefixedTuple";
+	}
+
+	static int compare(const Slice& a, const Slice& b)
+	{
+		const char *p = a.data(), *p_limit = a.data() + a.size();
+		const char *q = b.data(), *q_limit = b.data() + b.size();
+		while (p < p_limit && q < q_limit)
+		{
+			const char *p_start = p, *q_start = q;
+			uint32_t p_size, q_size;
+			if (CS_BUNLIKELY(!read_varint32(p, p_limit, p_size) || !read_varint32(q, q_limit, q_size) ||
+					p_size > static_cast<size_t>(p_limit - p) || q_size > static_cast<size_t>(q_limit - q)))
+			{
+				return compare_bytes(p_start, p_limit - p_start, q_start, q_limit - q_start);
+			}
+			int res = compare_bytes(p, p_size, q, q_size);
+			if (res)
+			{
+				return res;
+			}
+			p += p_size;
+			q += q_size;
+		}
+		return (p < p_limit) - (q < q_limit);
+	}
+};
+
+}
+
+// Keys are left as they are by the separator hooks, which is always correct, only the index blocks get no shorter.
+template<typename Order>
+class NativeComparator: public leveldb::Comparator
+{
+public:
+	NativeComparator() {}
+
+	virtual int Compare(const Slice& a, const Slice& b) const
+	{
+		return Order::compare(a, b);
+	}
+
+	virtual const char* Name() const
+	{
+		return Order::name();
+	}
+
+	virtual void FindShortestSeparator(std::string* start, const Slice& limit) const
+	{}
+
+	virtual void FindShortSuccessor(std::string* key) const
+	{}
+
+	static const leveldb::Comparator* instance()
+	{
+		static const NativeComparator<Order> comparator;
+		return &comparator;
+	}
+};
+
+// NULL for an unknown name.
+static inline const leveldb::Comparator* comparator_by_name(const std::string& name)
+{
+	if (name == "bytewise")
+	{
+		return leveldb::BytewiseComparator();
+	}
+	if (name == "reverseBytewise")
+	{
+		return NativeComparator<comparators::ReverseBytewise>::instance();
+	}
+	if (name == "u64Descending")
+	{
+		return NativeComparator<comparators::U64Descending>::instance();
+	}
+	if (name == "tuple")
+	{
+		return NativeComparator<comparators::LengthPrefixedTuple>::instance();
+	}
+	return NULL;
+}
+
+}
@@ -14,6 +14,7 @@
 #include "./jobs.h"
 #include "./jstatus.h"
 #include "./jiterator.h"
+#include "./jparallel_iterator.h"
 
 namespace leveldb {
 
@@ -30,9 +31,30 @@ void HyperLevelDB::init(v8::Handle<v8::Object> exports)
 	attach_func(prototype, "get", js_get);
 	attach_func(prototype, "del", js_del);
 	attach_func(prototype, "batch", js_batch);
+	attach_func(prototype, "update", js_update);
+	attach_func(prototype, "updateBatch", js_update_batch);
+	attach_func(prototype, "putSync", js_put_sync);
+	attach_func(prototype, "getSync", js_get_sync);
+	attach_func(prototype, "delSync", js_del_sync);
+	attach_func(prototype, "batchSync", js_batch_sync);
 	attach_func(prototype, "approximateSize", js_approximate_size);
+	attach_func(prototype, "aggregate", js_aggregate);
 	attach_func(prototype, "getProperty", js_get_property);
 	attach_func(prototype, "iterator", js_iterator);
+	attach_func(prototype, "hotCacheStats", js_hot_cache_stats);
+	attach_func(prototype, "missCacheStats", js_miss_cache_stats);
+	attach_func(prototype, "drain", js_drain);
+	attach_func(prototype, "pendingStats", js_pending_stats);
+	attach_func(prototype, "cacheUsage", js_cache_usage);
+	attach_func(prototype, "memoryUsage", js_memory_usage);
+	attach_func(prototype, "trainValueDictionary", js_train_value_dictionary);
+	attach_func(prototype, "codecStats", js_codec_stats);
+	attach_func(prototype, "collectValueLog", js_collect_value_log);
+	attach_func(prototype, "valueLogStats", js_value_log_stats);
+	attach_func(prototype, "setCompactionRateLimit", js_set_compaction_rate_limit);
+	attach_func(prototype, "compactionRateLimit", js_compaction_rate_limit);
+	attach_func(prototype, "ioStats", js_io_stats);
+	attach_func(prototype, "warmup", js_warmup);
 
 	attach_func(prototype, "destory", js_destroy);
 	attach_func(prototype, "repair", js_repair);
@@ -41,6 +63,10 @@ void HyperLevelDB::init(v8::Handle<v8::Object> exports)
 	exports->Set(v8::String::NewSymbol("HyperLevelDB"), ctor);
 }
 
+HyperLevelDB::HyperLevelDB(const std::string& directory_)
+	: directory(directory_), db(NULL), cache(NULL), codec(NULL), env(NULL), not_found_as_undefined(false), record_hot_keys(false), opening(false), adopted(false), locks(NULL), sync_cache_hits(false)
+{}
+
 v8::Handle<v8::Value> HyperLevelDB::js_new(const v8::Arguments& args)
 {
 	v8::HandleScope scope;
@@ -62,8 +88,21 @@ v8::Handle<v8::Value> HyperLevelDB::js_open(const v8::Arguments& args)
 	v8::HandleScope scope;
 
 	HyperLevelDB* self = node::ObjectWrap::Unwrap<HyperLevelDB>(args.This());
+	if (CS_BUNLIKELY(self->opening))
+	{
+		raise_err("the database is being opened.");
+		return scope.Close(v8::Undefined());
+	}
+	// before anything of the handle is touched, its options and caches are the open database's.
+	if (CS_BUNLIKELY(self->db != NULL))
+	{
+		raise_err("the database is already open, close it first.");
+		return scope.Close(v8::Undefined());
+	}
 
 	self->init_default_open_options(self->open_options);
+	delete self->env;
+	self->env = NULL;
 
 	if (CS_BUNLIKELY(args.Length() < 1))
 	{
@@ -76,7 +115,16 @@ v8::Handle<v8::Value> HyperLevelDB::js_open(const v8::Arguments& args)
 		if (args[0]->IsObject())
 		{
 			v8::Local<v8::Object> opts_from = args[0]->ToObject();
-			self->fill_open_options(opts_from, self->open_options);
+			if (CS_BUNLIKELY(!self->fill_open_options(opts_from, self->open_options, self->memory) ||
+					!self->fill_env_options(opts_from, self->open_options) ||
+					!self->fill_binding_options(opts_from)))
+			{
+				delete self->open_options.block_cache;
+				self->open_options.block_cache = NULL;
+				return scope.Close(v8::Undefined());
+			}
+			self->cache = self->open_options.block_cache;
+			self->account_memory(true);
 			callback = v8::Persistent<v8::Function>::New(v8::Local<v8::Function>::Cast(args[1]));
 		}
 		else if (args[0]->IsFunction())
@@ -90,14 +138,73 @@ v8::Handle<v8::Value> HyperLevelDB::js_open(const v8::Arguments& args)
 	}
 
 	OpenJob* job = new OpenJob(self->db, self->open_options, self->directory, &self->db, callback);
-	uv_queue_work(uv_default_loop(), &job->uv_work, job->execute, on_open);
+	job->opening = &self->opening;
+	self->opening = true;
+	job->holder = v8::Persistent<v8::Object>::New(args.This());
+	self->start_open(job);
 
 	return args.This();
 }
 
+// a directory another handle has open is shared, leveldb would refuse to open it again.
+void HyperLevelDB::start_open(OpenJob* job)
+{
+	DbRegistry::Shared* shared = NULL;
+	switch (DbRegistry::instance().claim(directory, shared, resume_open, job))
+	{
+	case DbRegistry::Waits:
+		return;
+	case DbRegistry::Shares:
+		if (CS_BUNLIKELY(!compatible(*shared, job->status)))
+		{
+			// gives back the reference `claim` took, the handle that has it open keeps it.
+			DbRegistry::instance().release(shared->db);
+			drop_open_state();
+		}
+		else
+		{
+			adopt(*shared);
+		}
+		ReadyQueue::instance().push(&job->uv_work, on_open);
+		return;
+	case DbRegistry::Opens:
+		break;
+	}
+
+	if (!env)
+	{
+		install_env(open_options, 0, 0);
+	}
+	locks = new KeyLocks;
+
+	job->options = open_options;
+	job->codec = codec;
+	job->shared = shared;
+	shared->options = open_options;
+	shared->cache = cache;
+	shared->codec = codec;
+	shared->env = env;
+	shared->caches = caches;
+	shared->locks = locks;
+	Dispatcher::instance().queue(&job->uv_work, job->execute, on_open, Dispatcher::Normal, NULL);
+}
+
+void HyperLevelDB::resume_open(void* arg)
+{
+	OpenJob* job = static_cast<OpenJob*>(arg);
+	node::ObjectWrap::Unwrap<HyperLevelDB>(job->holder)->start_open(job);
+}
+
 void HyperLevelDB::on_open(uv_work_t* uv_work, int uv_status)
 {
 	OpenJob* job = reinterpret_cast<OpenJob*>(uv_work->data);
+	*job->opening = false;
+	if (job->shared)
+	{
+		job->shared->db = job->status.ok() ? *job->db_ptr : NULL;
+		DbRegistry::instance().opened(job->shared, job->status.ok());
+		job->shared = NULL;
+	}
 	if (CS_BLIKELY(job->status.ok()))
 	{
 		job->callback->Call(v8::Context::GetCurrent()->Global(), 0, NULL);
@@ -120,12 +227,43 @@ v8::Handle<v8::Value> HyperLevelDB::js_close(const v8::Arguments& args)
 	{
 		raise_typeerr("the first argument (callback) must be a Function");
 	}
-	v8::Persistent<v8::Function> callback = v8::Persistent<v8::Function>::New(v8::Local<v8::Function>::Cast(args[0]));
 
 	HyperLevelDB* self = node::ObjectWrap::Unwrap<HyperLevelDB>(args.This());
+	if (CS_BUNLIKELY(self->opening))
+	{
+		raise_err("the database is being opened, close it once `open` calls back.");
+		return scope.Close(v8::Undefined());
+	}
+	v8::Persistent<v8::Function> callback = v8::Persistent<v8::Function>::New(v8::Local<v8::Function>::Cast(args[0]));
 
-	CloseJob* job = new CloseJob(self->db, self->cache, callback);
-	uv_queue_work(uv_default_loop(), &job->uv_work, job->execute, on_close);
+	// the last handle sharing the database closes it, the others let go of it.
+	// Either way once the jobs queued for the database are done.
+	const leveldb::DB* db = self->db;
+	CloseJob* job;
+	if (DbRegistry::instance().release(self->db))
+	{
+		job = new CloseJob(self->db, self->cache, self->caches, callback);
+		job->codec = self->codec;
+		job->env = self->env;
+		job->locks = self->locks;
+		if (self->record_hot_keys)
+		{
+			job->hot_keys_directory = self->directory;
+		}
+	}
+	else
+	{
+		job = new CloseJob(NULL, NULL, ReadCaches(), callback);
+	}
+	self->db = NULL;
+	self->locks = NULL;
+	self->caches = ReadCaches();
+	self->cache = NULL;
+	self->codec = NULL;
+	self->env = NULL;
+	self->adopted = false;
+	self->memory.report(0);
+	Dispatcher::instance().queue_barrier(&job->uv_work, job->execute, on_close, db);
 
 	return scope.Close(v8::Undefined());
 }
@@ -140,7 +278,6 @@ void HyperLevelDB::on_close(uv_work_t* uv_work, int uv_status)
 	else
 	{
 		const uint32_t argc = 1;
-		std::string err(std::string("failed on closing database: ") + job->status.ToString());
 		v8::Local<v8::Value> argv[argc] = { Jstatus::convert(job->status) };
 		job->callback->Call(v8::Context::GetCurrent()->Global(), argc, argv);
 	}
@@ -152,10 +289,16 @@ v8::Handle<v8::Value> HyperLevelDB::js_put(const v8::Arguments& args)
 	v8::HandleScope scope;
 
 	HyperLevelDB* self = node::ObjectWrap::Unwrap<HyperLevelDB>(args.This());
+	if (CS_BUNLIKELY(!self->check_open()))
+	{
+		return scope.Close(v8::Undefined());
+	}
 
 	v8::Local<v8::Value> key, value;
 	v8::Persistent<v8::Function> callback;
 	leveldb::WriteOptions options;
+	uint64_t deadline = 0;
+	Dispatcher::Priority priority = Dispatcher::Normal;
 
 	switch (args.Length())
 	{
@@ -176,13 +319,29 @@ v8::Handle<v8::Value> HyperLevelDB::js_put(const v8::Arguments& args)
 		key = args[0];
 		value = args[1];
 		self->fill_write_options(args[2]->ToObject(), options);
-		callback = v8::Persistent<v8::Function>::New(v8::Local<v8::Function>::Cast(args[2]));
+		deadline = self->fill_deadline(args[2]->ToObject());
+		priority = self->fill_priority(args[2]->ToObject(), priority);
+		callback = v8::Persistent<v8::Function>::New(v8::Local<v8::Function>::Cast(args[3]));
 		break;
 	}
 
-	v8::String::AsciiValue key_data(key->ToString()), value_data(value->ToString());
-	PutJob* job = new PutJob(self->db, options, v8::String::AsciiValue(key->ToString()), v8::String::AsciiValue(value->ToString()), callback);
-	uv_queue_work(uv_default_loop(), &job->uv_work, job->execute, on_put);
+	JsBytes key_data(key), value_data(value);
+	if (CS_BUNLIKELY(!key_data.ok() || !value_data.ok()))
+	{
+		return scope.Close(v8::Undefined());
+	}
+	size_t charge = key_data.size() + value_data.size();
+	if (CS_BUNLIKELY(!self->admission.admit(charge)))
+	{
+		return scope.Close(self->refuse(callback));
+	}
+	self->caches.invalidate(key_data.slice());
+	PutJob* job = new PutJob(self->db, options, key_data.str(), value_data.str(), self->caches, callback);
+	job->deadline = deadline;
+	job->codec = self->codec;
+	job->locks = self->locks;
+	self->admit(job, charge);
+	Dispatcher::instance().queue(&job->uv_work, job->execute, on_put, priority, job->db);
 
 	return args.This();
 }
@@ -202,7 +361,6 @@ void HyperLevelDB::on_put(uv_work_t* uv_work, int uv_status)
 		if (CS_BLIKELY(job->callback->IsFunction()))
 		{
 			const uint32_t argc = 1;
-			std::string err = job->status.ToString();
 			v8::Local<v8::Value> argv[argc] = { Jstatus::convert(job->status) };
 			job->callback->Call(v8::Context::GetCurrent()->Global(), argc, argv);
 		}
@@ -216,11 +374,18 @@ v8::Handle<v8::Value> HyperLevelDB::js_get(const v8::Arguments& args)
 	v8::HandleScope scope;
 
 	HyperLevelDB* self = node::ObjectWrap::Unwrap<HyperLevelDB>(args.This());
+	if (CS_BUNLIKELY(!self->check_open()))
+	{
+		return scope.Close(v8::Undefined());
+	}
 
 	v8::Local<v8::Value> key;
 	v8::Persistent<v8::Function> callback;
 	leveldb::ReadOptions options;
 	bool as_buffer = true;
+	Projection projection;
+	uint64_t deadline = 0;
+	Dispatcher::Priority priority = Dispatcher::Normal;
 
 	switch (args.Length())
 	{
@@ -237,16 +402,72 @@ v8::Handle<v8::Value> HyperLevelDB::js_get(const v8::Arguments& args)
 	default:
 		key = args[0];
 		as_buffer = self->fill_read_options(args[1]->ToObject(), options);
+		self->fill_projection(args[1]->ToObject(), read_option_offset, read_option_length, projection);
+		deadline = self->fill_deadline(args[1]->ToObject());
+		priority = self->fill_priority(args[1]->ToObject(), priority);
 		callback = v8::Persistent<v8::Function>::New(v8::Local<v8::Function>::Cast(args[2]));
 		break;
 	}
 
-	GetJob* job = new GetJob(self->db, options, as_buffer, v8::String::AsciiValue(key->ToString()), callback);
-	uv_queue_work(uv_default_loop(), &job->uv_work, job->execute, on_get);
+	JsBytes key_data(key);
+	if (CS_BUNLIKELY(!key_data.ok()))
+	{
+		return scope.Close(v8::Undefined());
+	}
+	// `fillCache: false` and `verifyChecksums` reads go to the database, like `ReadCaches::read`.
+	const bool cached = ReadCaches::answers(options);
+	if (cached && self->caches.miss && self->caches.miss->lookup(key_data.slice()))
+	{
+		GetJob* job = new GetJob(self->db, options, as_buffer, key_data.str(), self->caches, callback);
+		job->not_found_as_undefined = self->not_found_as_undefined;
+		job->status = Job::status_not_found;
+		self->complete_inline(&job->uv_work, on_get);
+		return args.This();
+	}
+	if (cached && self->caches.hot)
+	{
+		std::string value;
+		if (self->caches.hot->lookup(key_data.slice(), value))
+		{
+			GetJob* job = new GetJob(self->db, options, as_buffer, key_data.str(), self->caches, callback);
+			job->not_found_as_undefined = self->not_found_as_undefined;
+			projection.trim(value);
+			job->result.swap(value);
+			self->complete_inline(&job->uv_work, on_get);
+			return args.This();
+		}
+	}
+
+	GetJob* job = new GetJob(self->db, options, as_buffer, key_data.str(), self->caches, callback);
+	job->not_found_as_undefined = self->not_found_as_undefined;
+	job->codec = self->codec;
+	job->projection = projection;
+	job->comparator = self->open_options.comparator;
+	job->deadline = deadline;
+	self->admit(job, key_data.size());
+	Dispatcher::instance().queue(&job->uv_work, job->execute, on_get, priority, job->db);
 
 	return args.This();
 }
 
+static void free_string(char* data, void* hint)
+{
+	delete static_cast<std::string*>(hint);
+}
+
+// hands the bytes of `value` over to a Buffer instead of copying them, `value` is left empty.
+static v8::Local<v8::Value> adopt_buffer(std::string& value)
+{
+	if (value.empty())
+	{
+		return v8::Local<v8::Value>::New(node::Buffer::New(0)->handle_);
+	}
+	std::string* owned = new std::string;
+	owned->swap(value);
+	// the non-const `operator[]` unshares a copy-on-write string, the Buffer is writable.
+	return v8::Local<v8::Value>::New(node::Buffer::New(&(*owned)[0], owned->size(), free_string, owned)->handle_);
+}
+
 void HyperLevelDB::on_get(uv_work_t* uv_work, int uv_status)
 {
 	GetJob* job = reinterpret_cast<GetJob*>(uv_work->data);
@@ -259,7 +480,7 @@ void HyperLevelDB::on_get(uv_work_t* uv_work, int uv_status)
 			argv[0] = v8::Local<v8::Value>::New(v8::Null());
 			if (job->as_buffer)
 			{
-				argv[1] = v8::Local<v8::Value>::New(node::Buffer::New(job->result.data(), job->result.size())->handle_);
+				argv[1] = adopt_buffer(job->result);
 			}
 			else
 			{
@@ -268,12 +489,18 @@ void HyperLevelDB::on_get(uv_work_t* uv_work, int uv_status)
 			job->callback->Call(v8::Context::GetCurrent()->Global(), argc, argv);
 		}
 	}
+	else if (job->status.IsNotFound() && job->not_found_as_undefined)
+	{
+		if (CS_BLIKELY(job->callback->IsFunction()))
+		{
+			job->callback->Call(v8::Context::GetCurrent()->Global(), 0, NULL);
+		}
+	}
 	else
 	{
 		if (CS_BLIKELY(job->callback->IsFunction()))
 		{
 			const uint32_t argc = 1;
-			std::string err = job->status.ToString();
 			v8::Local<v8::Value> argv[argc] = { Jstatus::convert(job->status) };
 			job->callback->Call(v8::Context::GetCurrent()->Global(), argc, argv);
 		}
@@ -287,10 +514,16 @@ v8::Handle<v8::Value> HyperLevelDB::js_del(const v8::Arguments& args)
 	v8::HandleScope scope;
 
 	HyperLevelDB* self = node::ObjectWrap::Unwrap<HyperLevelDB>(args.This());
+	if (CS_BUNLIKELY(!self->check_open()))
+	{
+		return scope.Close(v8::Undefined());
+	}
 
 	v8::Local<v8::Value> key;
 	v8::Persistent<v8::Function> callback;
 	leveldb::WriteOptions options;
+	uint64_t deadline = 0;
+	Dispatcher::Priority priority = Dispatcher::Normal;
 
 	switch (args.Length())
 	{
@@ -307,12 +540,28 @@ v8::Handle<v8::Value> HyperLevelDB::js_del(const v8::Arguments& args)
 	default:
 		key = args[0];
 		self->fill_write_options(args[1]->ToObject(), options);
+		deadline = self->fill_deadline(args[1]->ToObject());
+		priority = self->fill_priority(args[1]->ToObject(), priority);
 		callback = v8::Persistent<v8::Function>::New(v8::Local<v8::Function>::Cast(args[2]));
 		break;
 	}
 
-	DelJob* job = new DelJob(self->db, options, v8::String::AsciiValue(key->ToString()), callback);
-	uv_queue_work(uv_default_loop(), &job->uv_work, job->execute, on_del);
+	JsBytes key_data(key);
+	if (CS_BUNLIKELY(!key_data.ok()))
+	{
+		return scope.Close(v8::Undefined());
+	}
+	if (CS_BUNLIKELY(!self->admission.admit(key_data.size())))
+	{
+		return scope.Close(self->refuse(callback));
+	}
+	self->caches.invalidate(key_data.slice());
+	DelJob* job = new DelJob(self->db, options, key_data.str(), self->caches, callback);
+	job->codec = self->codec;
+	job->locks = self->locks;
+	job->deadline = deadline;
+	self->admit(job, key_data.size());
+	Dispatcher::instance().queue(&job->uv_work, job->execute, on_del, priority, job->db);
 
 	return args.This();
 }
@@ -332,7 +581,6 @@ void HyperLevelDB::on_del(uv_work_t* uv_work, int uv_status)
 		if (CS_BLIKELY(job->callback->IsFunction()))
 		{
 			const uint32_t argc = 1;
-			std::string err = job->status.ToString();
 			v8::Local<v8::Value> argv[argc] = { Jstatus::convert(job->status) };
 			job->callback->Call(v8::Context::GetCurrent()->Global(), argc, argv);
 		}
@@ -346,9 +594,15 @@ v8::Handle<v8::Value> HyperLevelDB::js_batch(const v8::Arguments& args)
 	v8::HandleScope scope;
 
 	HyperLevelDB* self = node::ObjectWrap::Unwrap<HyperLevelDB>(args.This());
+	if (CS_BUNLIKELY(!self->check_open()))
+	{
+		return scope.Close(v8::Undefined());
+	}
 
 	v8::Persistent<v8::Function> callback;
 	leveldb::WriteOptions options;
+	uint64_t deadline = 0;
+	Dispatcher::Priority priority = Dispatcher::Normal;
 
 	switch (args.Length())
 	{
@@ -362,6 +616,8 @@ v8::Handle<v8::Value> HyperLevelDB::js_batch(const v8::Arguments& args)
 		break;
 	default:
 		self->fill_write_options(args[1]->ToObject(), options);
+		deadline = self->fill_deadline(args[1]->ToObject());
+		priority = self->fill_priority(args[1]->ToObject(), priority);
 		callback = v8::Persistent<v8::Function>::New(v8::Local<v8::Function>::Cast(args[2]));
 		break;
 	}
@@ -370,12 +626,16 @@ v8::Handle<v8::Value> HyperLevelDB::js_batch(const v8::Arguments& args)
 		raise_typeerr("the first argument `operations` must be an Array");
 	}
 
-	BatchJob* job = new BatchJob(self->db, options, callback);
+	BatchJob* job = new BatchJob(self->db, options, self->caches, callback);
+	job->codec = self->codec;
+	job->locks = self->locks;
+	job->deadline = deadline;
 
 	v8::Local<v8::Array> operations = v8::Local<v8::Array>::Cast(args[0]);
 	v8::Local<v8::Object> op;
 	v8::Local<v8::Value> op_type;
 	v8::Local<v8::Value> key;
+	size_t charge = 0;
 	for (uint32_t i = 0; i < operations->Length(); ++i)
 	{
 		op = operations->Get(v8::Uint32::New(i))->ToObject();
@@ -389,15 +649,77 @@ v8::Handle<v8::Value> HyperLevelDB::js_batch(const v8::Arguments& args)
 				{
 					raise_typeerr("`value` is required for `put` operation.");
 				}
-				job->append_put(v8::String::AsciiValue(key->ToString()), v8::String::AsciiValue(op->Get(batch_operation_value)->ToString()));
+				JsBytes key_data(key), value_data(op->Get(batch_operation_value));
+				if (CS_BUNLIKELY(!key_data.ok() || !value_data.ok()))
+				{
+					delete job;
+					return scope.Close(v8::Undefined());
+				}
+				charge += key_data.size() + value_data.size();
+				job->append_put(key_data.str(), value_data.str());
 			}
 			else if (op_type->Equals(batch_operation_del))
 			{
-				job->append_del(v8::String::AsciiValue(key->ToString()));
+				JsBytes key_data(key);
+				if (CS_BUNLIKELY(!key_data.ok()))
+				{
+					delete job;
+					return scope.Close(v8::Undefined());
+				}
+				charge += key_data.size();
+				job->append_del(key_data.str());
+			}
+			else if (op_type->Equals(batch_operation_check))
+			{
+				JsBytes key_data(key);
+				if (CS_BUNLIKELY(!key_data.ok()))
+				{
+					delete job;
+					return scope.Close(v8::Undefined());
+				}
+				if (op->Has(batch_operation_value))
+				{
+					JsBytes value_data(op->Get(batch_operation_value));
+					if (CS_BUNLIKELY(!value_data.ok()))
+					{
+						delete job;
+						return scope.Close(v8::Undefined());
+					}
+					charge += value_data.size();
+					job->append_check(key_data.str(), BatchJob::CheckEquals, value_data.str(), i);
+				}
+				else if (op->Has(batch_operation_version))
+				{
+					std::string version;
+					update::encode_le(static_cast<int64_t>(op->Get(batch_operation_version)->IntegerValue()), version);
+					job->append_check(key_data.str(), BatchJob::CheckVersion, version, i);
+				}
+				else if (op->Get(batch_operation_absent)->IsTrue())
+				{
+					job->append_check(key_data.str(), BatchJob::CheckAbsent, std::string(), i);
+				}
+				else
+				{
+					raise_typeerr("a `check` needs one of `value`, `version` and `absent: true`.");
+					delete job;
+					return scope.Close(v8::Undefined());
+				}
+				charge += key_data.size();
+			}
+			else if (op_type->Equals(batch_operation_update))
+			{
+				Update update;
+				if (CS_BUNLIKELY(!self->fill_update(key, op->Get(update_option_op), op->Get(update_option_operand), update)))
+				{
+					delete job;
+					return scope.Close(v8::Undefined());
+				}
+				charge += update.key.size() + update.operand.size();
+				job->append_modify(update);
 			}
 			else
 			{
-				raise_typeerr("batch operation supports only `put` and `del`.");
+				raise_typeerr("batch operation supports only `put`, `del`, `check` and `update`.");
 			}
 		}
 		else
@@ -406,19 +728,42 @@ v8::Handle<v8::Value> HyperLevelDB::js_batch(const v8::Arguments& args)
 		}
 	}
 
-	uv_queue_work(uv_default_loop(), &job->uv_work, job->execute, on_batch);
+	if (CS_BUNLIKELY(!self->admission.admit(charge)))
+	{
+		callback = job->callback;
+		job->callback.Clear();
+		delete job;
+		return scope.Close(self->refuse(callback));
+	}
+	job->invalidate_caches();
+	self->admit(job, charge);
+	Dispatcher::instance().queue(&job->uv_work, job->execute, on_batch, priority, job->db);
 
 	return args.This();
 }
 
+// a conditional batch calls back `(null, committed[, failedIndex])`, a plain one as before.
 void HyperLevelDB::on_batch(uv_work_t* uv_work, int uv_status)
 {
-	GetJob* job = reinterpret_cast<GetJob*>(uv_work->data);
+	BatchJob* job = reinterpret_cast<BatchJob*>(uv_work->data);
 	if (CS_BLIKELY(job->status.ok()))
 	{
 		if (CS_BLIKELY(job->callback->IsFunction()))
 		{
-			job->callback->Call(v8::Context::GetCurrent()->Global(), 0, NULL);
+			if (job->conditional)
+			{
+				const uint32_t argc = 3;
+				v8::Local<v8::Value> argv[argc] = {
+					v8::Local<v8::Value>::New(v8::Null()),
+					v8::Local<v8::Value>::New(v8::Boolean::New(job->committed)),
+					job->committed ? v8::Local<v8::Value>::New(v8::Undefined()) : v8::Local<v8::Value>(v8::Number::New(job->failed_index))
+				};
+				job->callback->Call(v8::Context::GetCurrent()->Global(), job->committed ? 2 : argc, argv);
+			}
+			else
+			{
+				job->callback->Call(v8::Context::GetCurrent()->Global(), 0, NULL);
+			}
 		}
 	}
 	else
@@ -426,7 +771,6 @@ void HyperLevelDB::on_batch(uv_work_t* uv_work, int uv_status)
 		if (CS_BLIKELY(job->callback->IsFunction()))
 		{
 			const uint32_t argc = 1;
-			std::string err = job->status.ToString();
 			v8::Local<v8::Value> argv[argc] = { Jstatus::convert(job->status) };
 			job->callback->Call(v8::Context::GetCurrent()->Global(), argc, argv);
 		}
@@ -434,219 +778,1409 @@ void HyperLevelDB::on_batch(uv_work_t* uv_work, int uv_status)
 	delete job;
 }
 
-v8::Handle<v8::Value> HyperLevelDB::js_approximate_size(const v8::Arguments& args)
+v8::Handle<v8::Value> HyperLevelDB::js_update(const v8::Arguments& args)
 {
 	v8::HandleScope scope;
 
-	if (args.Length() < 3)
+	if (CS_BUNLIKELY(args.Length() < 4 || !args[args.Length() - 1]->IsFunction()))
 	{
-		raise_typeerr("at least 3 arguments (key_start, key_end, callback) are required.");
+		raise_typeerr("4 arguments (key, op, operand, callback) are required.");
+		return scope.Close(v8::Undefined());
 	}
 
 	HyperLevelDB* self = node::ObjectWrap::Unwrap<HyperLevelDB>(args.This());
+	if (CS_BUNLIKELY(!self->check_open()))
+	{
+		return scope.Close(v8::Undefined());
+	}
 
-	v8::Persistent<v8::Function> callback = v8::Persistent<v8::Function>::New(v8::Local<v8::Function>::Cast(args[2]));
-	ApproximateSizeJob* job = new ApproximateSizeJob(self->db, v8::String::AsciiValue(args[0]->ToString()), v8::String::AsciiValue(args[1]->ToString()), callback);
-	uv_queue_work(uv_default_loop(), &job->uv_work, job->execute, on_approximate_size);
-
-	return args.This();
-}
+	leveldb::WriteOptions options;
+	uint64_t deadline = 0;
+	Dispatcher::Priority priority = Dispatcher::Normal;
+	if (args.Length() > 4 && args[3]->IsObject())
+	{
+		self->fill_write_options(args[3]->ToObject(), options);
+		deadline = self->fill_deadline(args[3]->ToObject());
+		priority = self->fill_priority(args[3]->ToObject(), priority);
+	}
 
-void HyperLevelDB::on_approximate_size(uv_work_t* uv_work, int uv_status)
-{
-	ApproximateSizeJob* job = reinterpret_cast<ApproximateSizeJob*>(uv_work->data);
-	if (CS_BLIKELY(job->status.ok()))
+	Update update;
+	if (CS_BUNLIKELY(!self->fill_update(args[0], args[1], args[2], update)))
 	{
-		if (CS_BLIKELY(job->callback->IsFunction()))
-		{
-			const uint32_t argc = 1;
-			v8::Local<v8::Value> argv[argc] = { v8::Uint32::New(job->size) };
-			job->callback->Call(v8::Context::GetCurrent()->Global(), argc, argv);
-		}
+		return scope.Close(v8::Undefined());
 	}
-	else
+
+	v8::Persistent<v8::Function> callback = v8::Persistent<v8::Function>::New(v8::Local<v8::Function>::Cast(args[args.Length() - 1]));
+	size_t charge = update.key.size() + update.operand.size();
+	if (CS_BUNLIKELY(!self->admission.admit(charge)))
 	{
-		if (CS_BLIKELY(job->callback->IsFunction()))
-		{
-			const uint32_t argc = 1;
-			std::string err = job->status.ToString();
-			v8::Local<v8::Value> argv[argc] = { Jstatus::convert(job->status) };
-			job->callback->Call(v8::Context::GetCurrent()->Global(), argc, argv);
-		}
+		return scope.Close(self->refuse(callback));
 	}
-	delete job;
+	UpdateJob* job = new UpdateJob(self->db, options, self->caches, self->locks, callback);
+	job->codec = self->codec;
+	job->single = true;
+	job->deadline = deadline;
+	job->updates.push_back(update);
+	job->invalidate_caches();
+	self->admit(job, charge);
+	Dispatcher::instance().queue(&job->uv_work, job->execute, on_update, priority, job->db);
+
+	return args.This();
 }
 
-v8::Handle<v8::Value> HyperLevelDB::js_get_property(const v8::Arguments& args)
+v8::Handle<v8::Value> HyperLevelDB::js_update_batch(const v8::Arguments& args)
 {
 	v8::HandleScope scope;
 
-	if (args.Length() < 1 || !args[0]->IsString())
+	if (CS_BUNLIKELY(args.Length() < 2 || !args[0]->IsArray() || !args[args.Length() - 1]->IsFunction()))
 	{
-		raise_typeerr("the first argument (property_name) must be a string.");
+		raise_typeerr("2 arguments (updates, callback) are required, `updates` must be an Array.");
+		return scope.Close(v8::Undefined());
 	}
 
 	HyperLevelDB* self = node::ObjectWrap::Unwrap<HyperLevelDB>(args.This());
-
-	v8::String::AsciiValue name(args[0]);
-	std::string value;
-	if (self->db->GetProperty(leveldb::Slice(*name, name.length()), &value))
+	if (CS_BUNLIKELY(!self->check_open()))
 	{
-		return scope.Close(v8::String::New(value.data(), value.size()));
+		return scope.Close(v8::Undefined());
 	}
-	else
+
+	leveldb::WriteOptions options;
+	uint64_t deadline = 0;
+	Dispatcher::Priority priority = Dispatcher::Normal;
+	if (args.Length() > 2 && args[1]->IsObject())
 	{
-		return scope.Close(v8::Undefined());
+		self->fill_write_options(args[1]->ToObject(), options);
+		deadline = self->fill_deadline(args[1]->ToObject());
+		priority = self->fill_priority(args[1]->ToObject(), priority);
 	}
-}
 
-v8::Handle<v8::Value> HyperLevelDB::js_iterator(const v8::Arguments& args)
-{
-	v8::HandleScope scope;
-	HyperLevelDB* self = node::ObjectWrap::Unwrap<HyperLevelDB>(args.This());
-	leveldb::ReadOptions read_options;
-	IterOptions iter_options;
-	if (args.Length() > 0)
+	v8::Local<v8::Array> updates = v8::Local<v8::Array>::Cast(args[0]);
+	UpdateJob::UpdateList list(updates->Length());
+	size_t charge = 0;
+	for (uint32_t i = 0; i < updates->Length(); ++i)
 	{
-		self->fill_iter_settings(args[0]->ToObject(), read_options, iter_options);
+		v8::Local<v8::Value> item = updates->Get(i);
+		if (CS_BUNLIKELY(!item->IsObject()))
+		{
+			raise_typeerr("each update must be an Object of `key`, `op` and `operand`.");
+			return scope.Close(v8::Undefined());
+		}
+		v8::Local<v8::Object> u = item->ToObject();
+		if (CS_BUNLIKELY(!self->fill_update(u->Get(batch_operation_key), u->Get(update_option_op), u->Get(update_option_operand), list[i])))
+		{
+			return scope.Close(v8::Undefined());
+		}
+		charge += list[i].key.size() + list[i].operand.size();
 	}
-	else
+
+	v8::Persistent<v8::Function> callback = v8::Persistent<v8::Function>::New(v8::Local<v8::Function>::Cast(args[args.Length() - 1]));
+	if (CS_BUNLIKELY(!self->admission.admit(charge)))
 	{
-		read_options.fill_cache = false;	// defaults not to fill cache.
+		return scope.Close(self->refuse(callback));
 	}
-	return scope.Close(Jiterator::create(self->db->NewIterator(read_options), iter_options));
+	UpdateJob* job = new UpdateJob(self->db, options, self->caches, self->locks, callback);
+	job->codec = self->codec;
+	job->deadline = deadline;
+	job->updates.swap(list);
+	job->invalidate_caches();
+	self->admit(job, charge);
+	Dispatcher::instance().queue(&job->uv_work, job->execute, on_update, priority, job->db);
+
+	return args.This();
 }
 
-v8::Handle<v8::Value> HyperLevelDB::js_repair(const v8::Arguments& args)
+// numbers come back as Numbers (i64 beyond 2^53 lose precision), bytes as Buffers.
+static v8::Local<v8::Value> update_result(const Update& update, const std::string& value)
 {
-	v8::HandleScope scope;
-
-	HyperLevelDB* self = node::ObjectWrap::Unwrap<HyperLevelDB>(args.This());
-
-	leveldb::Options options;
-	self->init_default_open_options(options);
-
-	if (CS_BUNLIKELY(args.Length() < 2))
+	if (!update.numeric())
 	{
-		raise_typeerr("at least 2 arguments (location, callback) are required.");
+		return v8::Local<v8::Value>::New(node::Buffer::New(value.data(), value.size())->handle_);
 	}
-	else if (args.Length() > 2)
+	if (update.op == UpdateAddFloat)
 	{
-		v8::Local<v8::Object> opts_from = args[2]->ToObject();
-		self->fill_open_options(opts_from, options);
+		return v8::Number::New(aggregate::decode_le<double>(value.data()));
 	}
-
-	v8::Persistent<v8::Function> callback = v8::Persistent<v8::Function>::New(v8::Local<v8::Function>::Cast(args[2]));
-	RepairJob* job = new RepairJob(self->db, v8::String::AsciiValue(args[0]->ToString()), options, callback);
-	uv_queue_work(uv_default_loop(), &job->uv_work, job->execute, on_approximate_size);
-
-	return args.This();
+	return v8::Number::New(static_cast<double>(aggregate::decode_le<int64_t>(value.data())));
 }
 
-void HyperLevelDB::on_repair(uv_work_t* uv_work, int uv_status)
+void HyperLevelDB::on_update(uv_work_t* uv_work, int uv_status)
 {
-	RepairJob* job = reinterpret_cast<RepairJob*>(uv_work->data);
+	UpdateJob* job = reinterpret_cast<UpdateJob*>(uv_work->data);
 	if (CS_BLIKELY(job->status.ok()))
 	{
-		if (CS_BLIKELY(job->callback->IsFunction()))
+		v8::Local<v8::Value> res;
+		if (job->single)
 		{
-			job->callback->Call(v8::Context::GetCurrent()->Global(), 0, NULL);
+			res = update_result(job->updates[0], job->results[0]);
+		}
+		else
+		{
+			v8::Local<v8::Array> values = v8::Array::New(job->results.size());
+			for (uint32_t i = 0; i < job->results.size(); ++i)
+			{
+				values->Set(i, update_result(job->updates[i], job->results[i]));
+			}
+			res = values;
 		}
+		const uint32_t argc = 2;
+		v8::Local<v8::Value> argv[argc] = { v8::Local<v8::Value>::New(v8::Null()), res };
+		job->callback->Call(v8::Context::GetCurrent()->Global(), argc, argv);
 	}
 	else
 	{
-		if (CS_BLIKELY(job->callback->IsFunction()))
-		{
-			const uint32_t argc = 1;
-			std::string err = job->status.ToString();
-			v8::Local<v8::Value> argv[argc] = { Jstatus::convert(job->status) };
-			job->callback->Call(v8::Context::GetCurrent()->Global(), argc, argv);
-		}
+		const uint32_t argc = 1;
+		v8::Local<v8::Value> argv[argc] = { Jstatus::convert(job->status) };
+		job->callback->Call(v8::Context::GetCurrent()->Global(), argc, argv);
 	}
 	delete job;
 }
 
-v8::Handle<v8::Value> HyperLevelDB::js_destroy(const v8::Arguments& args)
+v8::Handle<v8::Value> HyperLevelDB::js_put_sync(const v8::Arguments& args)
 {
 	v8::HandleScope scope;
 
 	HyperLevelDB* self = node::ObjectWrap::Unwrap<HyperLevelDB>(args.This());
-
-	leveldb::Options options;
-	self->init_default_open_options(options);
-
 	if (CS_BUNLIKELY(args.Length() < 2))
 	{
-		raise_typeerr("at least 2 arguments (location, callback) are required.");
+		raise_typeerr("at least 2 arguments (key, value) are required.");
+		return scope.Close(v8::Undefined());
 	}
-	else if (args.Length() > 2)
+	if (CS_BUNLIKELY(!self->check_open()))
 	{
-		v8::Local<v8::Object> opts_from = args[2]->ToObject();
-		self->fill_open_options(opts_from, options);
+		return scope.Close(v8::Undefined());
 	}
 
-	v8::Persistent<v8::Function> callback = v8::Persistent<v8::Function>::New(v8::Local<v8::Function>::Cast(args[2]));
-	DestroyJob* job = new DestroyJob(self->db, v8::String::AsciiValue(args[0]->ToString()), options, callback);
-	uv_queue_work(uv_default_loop(), &job->uv_work, job->execute, on_approximate_size);
-
-	return scope.Close(v8::Undefined());
-}
+	leveldb::WriteOptions options;
+	if (args.Length() > 2 && args[2]->IsObject())
+	{
+		self->fill_write_options(args[2]->ToObject(), options);
+	}
 
-void HyperLevelDB::on_destroy(uv_work_t* uv_work, int uv_status)
-{
-	DestroyJob* job = reinterpret_cast<DestroyJob*>(uv_work->data);
-	if (CS_BLIKELY(job->status.ok()))
+	JsBytes key(args[0]), value(args[1]);
+	if (CS_BUNLIKELY(!key.ok() || !value.ok()))
 	{
-		if (CS_BLIKELY(job->callback->IsFunction()))
-		{
-			job->callback->Call(v8::Context::GetCurrent()->Global(), 0, NULL);
-		}
+		return scope.Close(v8::Undefined());
 	}
-	else
+	leveldb::Status status = self->put(options, key.slice(), value.slice());
+	if (CS_BUNLIKELY(!status.ok()))
 	{
-		if (CS_BLIKELY(job->callback->IsFunction()))
-		{
-			const uint32_t argc = 1;
-			std::string err = job->status.ToString();
-			v8::Local<v8::Value> argv[argc] = { Jstatus::convert(job->status) };
-			job->callback->Call(v8::Context::GetCurrent()->Global(), argc, argv);
-		}
+		v8::ThrowException(Jstatus::convert(status));
 	}
-	delete job;
+	return scope.Close(v8::Undefined());
 }
 
-inline leveldb::Status HyperLevelDB::put(const leveldb::WriteOptions& options, const v8::Handle<v8::Value>& key_, const v8::Handle<v8::Value>& value_)
+v8::Handle<v8::Value> HyperLevelDB::js_get_sync(const v8::Arguments& args)
 {
-	v8::String::AsciiValue key_data(key_->ToString()), value_data(value_->ToString());
-	leveldb::Slice key(*key_data, key_data.length()), value(*value_data, value_data.length());
-	return db->Put(options, key, value);
-}
+	v8::HandleScope scope;
+
+	HyperLevelDB* self = node::ObjectWrap::Unwrap<HyperLevelDB>(args.This());
+	if (CS_BUNLIKELY(args.Length() < 1))
+	{
+		raise_typeerr("at least 1 argument (key) are required.");
+		return scope.Close(v8::Undefined());
+	}
+	if (CS_BUNLIKELY(!self->check_open()))
+	{
+		return scope.Close(v8::Undefined());
+	}
+
+	leveldb::ReadOptions options;
+	bool as_buffer = true;
+	Projection projection;
+	if (args.Length() > 1 && args[1]->IsObject())
+	{
+		as_buffer = self->fill_read_options(args[1]->ToObject(), options);
+		self->fill_projection(args[1]->ToObject(), read_option_offset, read_option_length, projection);
+	}
+
+	JsBytes key(args[0]);
+	if (CS_BUNLIKELY(!key.ok()))
+	{
+		return scope.Close(v8::Undefined());
+	}
+	std::string value;
+	leveldb::Status status = self->get(options, key.slice(), value);
+	if (CS_BLIKELY(status.ok()))
+	{
+		projection.trim(value);
+		if (as_buffer)
+		{
+			return scope.Close(adopt_buffer(value));
+		}
+		return scope.Close(v8::String::New(value.data(), value.size()));
+	}
+	if (CS_BUNLIKELY(!status.IsNotFound()))
+	{
+		v8::ThrowException(Jstatus::convert(status));
+	}
+	return scope.Close(v8::Undefined());
+}
+
+v8::Handle<v8::Value> HyperLevelDB::js_del_sync(const v8::Arguments& args)
+{
+	v8::HandleScope scope;
+
+	HyperLevelDB* self = node::ObjectWrap::Unwrap<HyperLevelDB>(args.This());
+	if (CS_BUNLIKELY(args.Length() < 1))
+	{
+		raise_typeerr("at least 1 argument (key) are required.");
+		return scope.Close(v8::Undefined());
+	}
+	if (CS_BUNLIKELY(!self->check_open()))
+	{
+		return scope.Close(v8::Undefined());
+	}
+
+	leveldb::WriteOptions options;
+	if (args.Length() > 1 && args[1]->IsObject())
+	{
+		self->fill_write_options(args[1]->ToObject(), options);
+	}
+
+	JsBytes key(args[0]);
+	if (CS_BUNLIKELY(!key.ok()))
+	{
+		return scope.Close(v8::Undefined());
+	}
+	leveldb::Status status = self->del(options, key.slice());
+	if (CS_BUNLIKELY(!status.ok()))
+	{
+		v8::ThrowException(Jstatus::convert(status));
+	}
+	return scope.Close(v8::Undefined());
+}
+
+v8::Handle<v8::Value> HyperLevelDB::js_batch_sync(const v8::Arguments& args)
+{
+	v8::HandleScope scope;
+
+	HyperLevelDB* self = node::ObjectWrap::Unwrap<HyperLevelDB>(args.This());
+	if (CS_BUNLIKELY(args.Length() < 1 || !args[0]->IsArray()))
+	{
+		raise_typeerr("the first argument `operations` must be an Array");
+		return scope.Close(v8::Undefined());
+	}
+	if (CS_BUNLIKELY(!self->check_open()))
+	{
+		return scope.Close(v8::Undefined());
+	}
+
+	leveldb::WriteOptions options;
+	if (args.Length() > 1 && args[1]->IsObject())
+	{
+		self->fill_write_options(args[1]->ToObject(), options);
+	}
+
+	v8::Local<v8::Array> operations = v8::Local<v8::Array>::Cast(args[0]);
+	// the keys are locked before the value log, in the order the locked jobs take them.
+	KeyLocks::WriteGuard key_guard(self->locks);
+	if (key_guard.locking())
+	{
+		std::vector<std::string> locked_keys;
+		for (uint32_t i = 0; i < operations->Length(); ++i)
+		{
+			JsBytes key(operations->Get(v8::Uint32::New(i))->ToObject()->Get(batch_operation_key));
+			if (CS_BUNLIKELY(!key.ok()))
+			{
+				return scope.Close(v8::Undefined());
+			}
+			locked_keys.push_back(key.str());
+		}
+		key_guard.lock(locked_keys);
+	}
+	ValueCodec::WriteScope write_scope(self->codec);
+	leveldb::WriteBatch batch;
+	// only needed to invalidate the read caches.
+	const bool track_keys = self->caches.hot || self->caches.miss;
+	std::vector<std::string> keys;
+	for (uint32_t i = 0; i < operations->Length(); ++i)
+	{
+		v8::Local<v8::Object> op = operations->Get(v8::Uint32::New(i))->ToObject();
+		if (CS_BUNLIKELY(!op->Has(batch_operation_type) || !op->Has(batch_operation_key)))
+		{
+			raise_typeerr("at least `type` and `key` are required for batch operation.");
+			return scope.Close(v8::Undefined());
+		}
+		v8::Local<v8::Value> op_type = op->Get(batch_operation_type);
+		JsBytes key(op->Get(batch_operation_key));
+		if (CS_BUNLIKELY(!key.ok()))
+		{
+			return scope.Close(v8::Undefined());
+		}
+		if (op_type->Equals(batch_operation_put))
+		{
+			if (CS_BUNLIKELY(!op->Has(batch_operation_value)))
+			{
+				raise_typeerr("`value` is required for `put` operation.");
+				return scope.Close(v8::Undefined());
+			}
+			JsBytes value(op->Get(batch_operation_value));
+			if (CS_BUNLIKELY(!value.ok()))
+			{
+				return scope.Close(v8::Undefined());
+			}
+			if (self->codec)
+			{
+				std::string encoded;
+				self->codec->encode(value.slice(), encoded);
+				batch.Put(key.slice(), leveldb::Slice(encoded));
+			}
+			else
+			{
+				batch.Put(key.slice(), value.slice());
+			}
+		}
+		else if (op_type->Equals(batch_operation_del))
+		{
+			batch.Delete(key.slice());
+		}
+		else
+		{
+			raise_typeerr("batch operation supports only `put` and `del`.");
+			return scope.Close(v8::Undefined());
+		}
+		if (track_keys)
+		{
+			keys.push_back(std::string(key.data(), key.size()));
+		}
+	}
+
+	leveldb::Status status = self->write(options, batch, keys, write_scope);
+	if (CS_BUNLIKELY(!status.ok()))
+	{
+		v8::ThrowException(Jstatus::convert(status));
+	}
+	return scope.Close(v8::Undefined());
+}
+
+v8::Handle<v8::Value> HyperLevelDB::js_approximate_size(const v8::Arguments& args)
+{
+	v8::HandleScope scope;
+
+	if (args.Length() < 3)
+	{
+		raise_typeerr("at least 3 arguments (key_start, key_end, callback) are required.");
+	}
+
+	HyperLevelDB* self = node::ObjectWrap::Unwrap<HyperLevelDB>(args.This());
+	if (CS_BUNLIKELY(!self->check_open()))
+	{
+		return scope.Close(v8::Undefined());
+	}
+
+	v8::Persistent<v8::Function> callback = v8::Persistent<v8::Function>::New(v8::Local<v8::Function>::Cast(args[2]));
+	ApproximateSizeJob* job = new ApproximateSizeJob(self->db, v8::String::AsciiValue(args[0]->ToString()), v8::String::AsciiValue(args[1]->ToString()), callback);
+	Dispatcher::instance().queue(&job->uv_work, job->execute, on_approximate_size, Dispatcher::Normal, job->db);
+
+	return args.This();
+}
+
+void HyperLevelDB::on_approximate_size(uv_work_t* uv_work, int uv_status)
+{
+	ApproximateSizeJob* job = reinterpret_cast<ApproximateSizeJob*>(uv_work->data);
+	if (CS_BLIKELY(job->status.ok()))
+	{
+		if (CS_BLIKELY(job->callback->IsFunction()))
+		{
+			const uint32_t argc = 1;
+			v8::Local<v8::Value> argv[argc] = { v8::Uint32::New(job->size) };
+			job->callback->Call(v8::Context::GetCurrent()->Global(), argc, argv);
+		}
+	}
+	else
+	{
+		if (CS_BLIKELY(job->callback->IsFunction()))
+		{
+			const uint32_t argc = 1;
+			v8::Local<v8::Value> argv[argc] = { Jstatus::convert(job->status) };
+			job->callback->Call(v8::Context::GetCurrent()->Global(), argc, argv);
+		}
+	}
+	delete job;
+}
+
+v8::Handle<v8::Value> HyperLevelDB::js_aggregate(const v8::Arguments& args)
+{
+	v8::HandleScope scope;
+
+	if (CS_BUNLIKELY(args.Length() < 4 || !args[2]->IsObject() || !args[3]->IsFunction()))
+	{
+		raise_typeerr("4 arguments (key_start, key_end, options, callback) are required.");
+		return scope.Close(v8::Undefined());
+	}
+
+	HyperLevelDB* self = node::ObjectWrap::Unwrap<HyperLevelDB>(args.This());
+	if (CS_BUNLIKELY(!self->check_open()))
+	{
+		return scope.Close(v8::Undefined());
+	}
+
+	v8::Local<v8::Object> opts_from = args[2]->ToObject();
+	leveldb::ReadOptions options;
+	self->fill_read_options(opts_from, options, false);
+	Dispatcher::Priority priority = self->fill_priority(opts_from, Dispatcher::Normal);
+
+	AggregateOp op;
+	std::string op_name = opts_from->Has(aggregate_option_op) ? jstr2str(opts_from->Get(aggregate_option_op)) : std::string();
+	if (op_name == "count")
+	{
+		op = AggregateCount;
+	}
+	else if (op_name == "bytes")
+	{
+		op = AggregateBytes;
+	}
+	else if (op_name == "sum")
+	{
+		op = AggregateSum;
+	}
+	else if (op_name == "min")
+	{
+		op = AggregateMin;
+	}
+	else if (op_name == "max")
+	{
+		op = AggregateMax;
+	}
+	else
+	{
+		raise_typeerr("`op` must be one of `count`, `sum`, `min`, `max` and `bytes`.");
+		return scope.Close(v8::Undefined());
+	}
+
+	AggregateValueType value_type = AggregateF64;
+	if (opts_from->Has(aggregate_option_value_type))
+	{
+		std::string type_name = jstr2str(opts_from->Get(aggregate_option_value_type));
+		if (type_name == "i64")
+		{
+			value_type = AggregateI64;
+		}
+		else if (type_name == "u32")
+		{
+			value_type = AggregateU32;
+		}
+		else if (CS_BUNLIKELY(type_name != "f64"))
+		{
+			raise_typeerr("`valueType` must be one of `f64`, `i64` and `u32`.");
+			return scope.Close(v8::Undefined());
+		}
+	}
+
+	// Buffers and tuple keys as `put` takes them.
+	JsBytes start_data(args[0]), end_data(args[1]);
+	if (CS_BUNLIKELY(!start_data.ok() || !end_data.ok()))
+	{
+		return scope.Close(v8::Undefined());
+	}
+
+	v8::Persistent<v8::Function> callback = v8::Persistent<v8::Function>::New(v8::Local<v8::Function>::Cast(args[3]));
+	AggregateJob* job = new AggregateJob(self->db, options, start_data.slice(), end_data.slice(),
+			op, value_type, self->open_options.comparator, callback);
+	job->codec = self->codec;
+	Dispatcher::instance().queue(&job->uv_work, job->execute, on_aggregate, priority, job->db);
+
+	return args.This();
+}
+
+void HyperLevelDB::on_aggregate(uv_work_t* uv_work, int uv_status)
+{
+	AggregateJob* job = reinterpret_cast<AggregateJob*>(uv_work->data);
+	if (CS_BLIKELY(job->status.ok()))
+	{
+		const uint32_t argc = 2;
+		v8::Local<v8::Object> res = v8::Object::New();
+		res->Set(v8::String::NewSymbol("count"), v8::Number::New(job->count));
+		res->Set(v8::String::NewSymbol("bytes"), v8::Number::New(job->bytes));
+		res->Set(v8::String::NewSymbol("skipped"), v8::Number::New(job->skipped));
+		if ((job->op == AggregateMin || job->op == AggregateMax) && job->reduced == 0)
+		{
+			res->Set(v8::String::NewSymbol("value"), v8::Null());
+		}
+		else
+		{
+			res->Set(v8::String::NewSymbol("value"), v8::Number::New(job->result));
+		}
+		v8::Local<v8::Value> argv[argc] = { v8::Local<v8::Value>::New(v8::Null()), res };
+		job->callback->Call(v8::Context::GetCurrent()->Global(), argc, argv);
+	}
+	else
+	{
+		const uint32_t argc = 1;
+		v8::Local<v8::Value> argv[argc] = { Jstatus::convert(job->status) };
+		job->callback->Call(v8::Context::GetCurrent()->Global(), argc, argv);
+	}
+	delete job;
+}
+
+v8::Handle<v8::Value> HyperLevelDB::js_get_property(const v8::Arguments& args)
+{
+	v8::HandleScope scope;
+
+	if (args.Length() < 1 || !args[0]->IsString())
+	{
+		raise_typeerr("the first argument (property_name) must be a string.");
+	}
+
+	HyperLevelDB* self = node::ObjectWrap::Unwrap<HyperLevelDB>(args.This());
+	if (CS_BUNLIKELY(!self->check_open()))
+	{
+		return scope.Close(v8::Undefined());
+	}
+
+	v8::String::AsciiValue name(args[0]);
+	std::string value;
+	if (self->db->GetProperty(leveldb::Slice(*name, name.length()), &value))
+	{
+		return scope.Close(v8::String::New(value.data(), value.size()));
+	}
+	else
+	{
+		return scope.Close(v8::Undefined());
+	}
+}
+
+v8::Handle<v8::Value> HyperLevelDB::js_iterator(const v8::Arguments& args)
+{
+	v8::HandleScope scope;
+	HyperLevelDB* self = node::ObjectWrap::Unwrap<HyperLevelDB>(args.This());
+	if (CS_BUNLIKELY(!self->check_open()))
+	{
+		return scope.Close(v8::Undefined());
+	}
+	leveldb::ReadOptions read_options;
+	IterOptions iter_options;
+	if (args.Length() > 0)
+	{
+		if (CS_BUNLIKELY(!self->fill_iter_settings(args[0]->ToObject(), read_options, iter_options)))
+		{
+			return scope.Close(v8::Undefined());
+		}
+	}
+	else
+	{
+		read_options.fill_cache = false;	// defaults not to fill cache.
+	}
+	if (iter_options.parallelism > 1)
+	{
+		if (CS_BUNLIKELY(iter_options.reverse || iter_options.limit != IterOptions::no_limit))
+		{
+			raise_typeerr("`reverse` and `limit` are not supported by parallel iterators.");
+			return scope.Close(v8::Undefined());
+		}
+		// ranges are split on the bytes of the keys.
+		if (CS_BUNLIKELY(self->open_options.comparator != leveldb::BytewiseComparator()))
+		{
+			raise_typeerr("parallel iterators require the `bytewise` comparator.");
+			return scope.Close(v8::Undefined());
+		}
+		return scope.Close(JparallelIterator::create(self->db, read_options, iter_options, self->codec));
+	}
+	// plain iterators seek and step on the loop, so values are decoded there too: a value log pointer costs a pread
+	// of its record (and a decompression with a `valueCodec`) per `next`. Parallel ones do both on the workers.
+	return scope.Close(Jiterator::create(DecodingIterator::wrap(
+			envs::ReadaheadIterator::wrap(self->db->NewIterator(read_options), iter_options.readahead), self->codec), iter_options,
+			self->open_options.comparator));
+}
+
+v8::Handle<v8::Value> HyperLevelDB::js_hot_cache_stats(const v8::Arguments& args)
+{
+	v8::HandleScope scope;
+
+	HyperLevelDB* self = node::ObjectWrap::Unwrap<HyperLevelDB>(args.This());
+	if (!self->caches.hot)
+	{
+		return scope.Close(v8::Undefined());
+	}
+
+	HotCache::Stats stats;
+	self->caches.hot->stats(stats);
+	uint64_t lookups = stats.hits + stats.misses;
+
+	v8::Local<v8::Object> res = v8::Object::New();
+	res->Set(v8::String::NewSymbol("hits"), v8::Number::New(stats.hits));
+	res->Set(v8::String::NewSymbol("misses"), v8::Number::New(stats.misses));
+	res->Set(v8::String::NewSymbol("hitRate"), v8::Number::New(lookups ? double(stats.hits) / lookups : 0));
+	res->Set(v8::String::NewSymbol("inserts"), v8::Number::New(stats.inserts));
+	res->Set(v8::String::NewSymbol("evictions"), v8::Number::New(stats.evictions));
+	res->Set(v8::String::NewSymbol("invalidations"), v8::Number::New(stats.invalidations));
+	res->Set(v8::String::NewSymbol("entries"), v8::Number::New(stats.entries));
+	res->Set(v8::String::NewSymbol("usage"), v8::Number::New(stats.usage));
+	res->Set(v8::String::NewSymbol("capacity"), v8::Number::New(stats.capacity));
+	return scope.Close(res);
+}
+
+v8::Handle<v8::Value> HyperLevelDB::js_miss_cache_stats(const v8::Arguments& args)
+{
+	v8::HandleScope scope;
+
+	HyperLevelDB* self = node::ObjectWrap::Unwrap<HyperLevelDB>(args.This());
+	if (!self->caches.miss)
+	{
+		return scope.Close(v8::Undefined());
+	}
+
+	MissCache::Stats stats;
+	self->caches.miss->stats(stats);
+	uint64_t lookups = stats.hits + stats.misses;
+
+	v8::Local<v8::Object> res = v8::Object::New();
+	res->Set(v8::String::NewSymbol("hits"), v8::Number::New(stats.hits));
+	res->Set(v8::String::NewSymbol("misses"), v8::Number::New(stats.misses));
+	res->Set(v8::String::NewSymbol("hitRate"), v8::Number::New(lookups ? double(stats.hits) / lookups : 0));
+	res->Set(v8::String::NewSymbol("inserts"), v8::Number::New(stats.inserts));
+	res->Set(v8::String::NewSymbol("evictions"), v8::Number::New(stats.evictions));
+	res->Set(v8::String::NewSymbol("invalidations"), v8::Number::New(stats.invalidations));
+	res->Set(v8::String::NewSymbol("entries"), v8::Number::New(stats.entries));
+	res->Set(v8::String::NewSymbol("capacity"), v8::Number::New(stats.capacity));
+	return scope.Close(res);
+}
+
+v8::Handle<v8::Value> HyperLevelDB::js_drain(const v8::Arguments& args)
+{
+	v8::HandleScope scope;
+
+	if (CS_BUNLIKELY(args.Length() < 1 || !args[0]->IsFunction()))
+	{
+		raise_typeerr("the first argument (callback) must be a Function");
+		return scope.Close(v8::Undefined());
+	}
+
+	HyperLevelDB* self = node::ObjectWrap::Unwrap<HyperLevelDB>(args.This());
+	if (self->admission.drained())
+	{
+		v8::Persistent<v8::Function> callback = v8::Persistent<v8::Function>::New(v8::Local<v8::Function>::Cast(args[0]));
+		ImmediateJob* job = new ImmediateJob(callback);
+		ReadyQueue::instance().push(&job->uv_work, on_immediate);
+	}
+	else
+	{
+		self->admission.on_drain(v8::Local<v8::Function>::Cast(args[0]));
+	}
+
+	return args.This();
+}
+
+v8::Handle<v8::Value> HyperLevelDB::js_pending_stats(const v8::Arguments& args)
+{
+	v8::HandleScope scope;
+
+	HyperLevelDB* self = node::ObjectWrap::Unwrap<HyperLevelDB>(args.This());
+	const Admission& admission = self->admission;
+
+	v8::Local<v8::Object> res = v8::Object::New();
+	res->Set(v8::String::NewSymbol("jobs"), v8::Number::New(admission.jobs));
+	res->Set(v8::String::NewSymbol("bytes"), v8::Number::New(admission.bytes));
+	res->Set(v8::String::NewSymbol("peakJobs"), v8::Number::New(admission.peak_jobs));
+	res->Set(v8::String::NewSymbol("peakBytes"), v8::Number::New(admission.peak_bytes));
+	res->Set(v8::String::NewSymbol("rejected"), v8::Number::New(admission.rejected));
+	res->Set(v8::String::NewSymbol("shed"), v8::Number::New(admission.shed));
+	res->Set(v8::String::NewSymbol("maxJobs"), v8::Number::New(admission.max_jobs));
+	res->Set(v8::String::NewSymbol("maxBytes"), v8::Number::New(admission.max_bytes));
+	return scope.Close(res);
+}
+
+v8::Handle<v8::Value> HyperLevelDB::js_cache_usage(const v8::Arguments& args)
+{
+	v8::HandleScope scope;
+
+	HyperLevelDB* self = node::ObjectWrap::Unwrap<HyperLevelDB>(args.This());
+	if (!self->cache)
+	{
+		return scope.Close(v8::Null());
+	}
+
+	const AccountingCache* cache = static_cast<const AccountingCache*>(self->cache);
+	v8::Local<v8::Object> res = v8::Object::New();
+	res->Set(v8::String::NewSymbol("bytes"), v8::Number::New(cache->bytes()));
+	res->Set(v8::String::NewSymbol("inserts"), v8::Number::New(cache->inserts()));
+	res->Set(v8::String::NewSymbol("capacity"), v8::Number::New(cache->resources()->capacity));
+	res->Set(v8::String::NewSymbol("sharedBy"), v8::Number::New(cache->resources()->databases));
+	return scope.Close(res);
+}
+
+v8::Handle<v8::Value> HyperLevelDB::js_memory_usage(const v8::Arguments& args)
+{
+	v8::HandleScope scope;
+
+	HyperLevelDB* self = node::ObjectWrap::Unwrap<HyperLevelDB>(args.This());
+	self->account_memory(true);
+	const MemoryBudget& memory = self->memory;
+	const AccountingCache* cache = static_cast<const AccountingCache*>(self->cache);
+	uint64_t cache_bytes = cache ? cache->bytes() : 0, hot_bytes = self->hot_cache_bytes();
+
+	v8::Local<v8::Object> res = v8::Object::New();
+	res->Set(v8::String::NewSymbol("budget"), v8::Number::New(memory.limit));
+	res->Set(v8::String::NewSymbol("total"),
+			v8::Number::New(cache_bytes + hot_bytes + self->write_buffer_bytes() + self->admission.bytes));
+	res->Set(v8::String::NewSymbol("writeBuffers"), v8::Number::New(self->write_buffer_bytes()));
+	res->Set(v8::String::NewSymbol("cache"), v8::Number::New(cache_bytes));
+	res->Set(v8::String::NewSymbol("cacheLimit"), v8::Number::New(cache ? cache->limit() : 0));
+	res->Set(v8::String::NewSymbol("hotCache"), v8::Number::New(hot_bytes));
+	res->Set(v8::String::NewSymbol("inFlight"), v8::Number::New(self->admission.bytes));
+	res->Set(v8::String::NewSymbol("inFlightLimit"), v8::Number::New(self->admission.max_bytes));
+	res->Set(v8::String::NewSymbol("shrinks"), v8::Number::New(memory.shrinks));
+	return scope.Close(res);
+}
+
+v8::Handle<v8::Value> HyperLevelDB::js_train_value_dictionary(const v8::Arguments& args)
+{
+	v8::HandleScope scope;
+
+	if (CS_BUNLIKELY(args.Length() < 1 || !args[args.Length() - 1]->IsFunction()))
+	{
+		raise_typeerr("the last argument (callback) must be a Function");
+		return scope.Close(v8::Undefined());
+	}
+
+	HyperLevelDB* self = node::ObjectWrap::Unwrap<HyperLevelDB>(args.This());
+	if (CS_BUNLIKELY(!self->check_open()))
+	{
+		return scope.Close(v8::Undefined());
+	}
+	if (CS_BUNLIKELY(!self->codec))
+	{
+		raise_err("the database is not opened with a `valueCodec`.");
+		return scope.Close(v8::Undefined());
+	}
+
+	size_t max_samples = 10000, dict_size = 64 << 10;
+	Dispatcher::Priority priority = Dispatcher::Bulk;
+	if (args.Length() > 1 && args[0]->IsObject())
+	{
+		v8::Local<v8::Object> opts_from = args[0]->ToObject();
+		v8::Local<v8::String> samples_key = v8::String::NewSymbol("samples"), size_key = v8::String::NewSymbol("dictionarySize");
+		priority = self->fill_priority(opts_from, priority);
+		if (opts_from->Has(samples_key) && opts_from->Get(samples_key)->IntegerValue() > 0)
+		{
+			max_samples = opts_from->Get(samples_key)->IntegerValue();
+		}
+		if (opts_from->Has(size_key) && opts_from->Get(size_key)->IntegerValue() > 0)
+		{
+			dict_size = opts_from->Get(size_key)->IntegerValue();
+		}
+	}
+
+	v8::Persistent<v8::Function> callback = v8::Persistent<v8::Function>::New(v8::Local<v8::Function>::Cast(args[args.Length() - 1]));
+	TrainDictionaryJob* job = new TrainDictionaryJob(self->db, self->codec,
+			self->open_options.env ? self->open_options.env : leveldb::Env::Default(), self->directory,
+			max_samples, dict_size, callback);
+	Dispatcher::instance().queue(&job->uv_work, job->execute, on_train_value_dictionary, priority, job->db);
+
+	return args.This();
+}
+
+void HyperLevelDB::on_train_value_dictionary(uv_work_t* uv_work, int uv_status)
+{
+	TrainDictionaryJob* job = reinterpret_cast<TrainDictionaryJob*>(uv_work->data);
+	if (CS_BLIKELY(job->status.ok()))
+	{
+		const uint32_t argc = 2;
+		v8::Local<v8::Object> res = v8::Object::New();
+		res->Set(v8::String::NewSymbol("id"), v8::Number::New(job->id));
+		res->Set(v8::String::NewSymbol("samples"), v8::Number::New(job->samples));
+		v8::Local<v8::Value> argv[argc] = { v8::Local<v8::Value>::New(v8::Null()), res };
+		job->callback->Call(v8::Context::GetCurrent()->Global(), argc, argv);
+	}
+	else
+	{
+		const uint32_t argc = 1;
+		v8::Local<v8::Value> argv[argc] = { Jstatus::convert(job->status) };
+		job->callback->Call(v8::Context::GetCurrent()->Global(), argc, argv);
+	}
+	delete job;
+}
+
+v8::Handle<v8::Value> HyperLevelDB::js_codec_stats(const v8::Arguments& args)
+{
+	v8::HandleScope scope;
+
+	HyperLevelDB* self = node::ObjectWrap::Unwrap<HyperLevelDB>(args.This());
+	if (!self->codec)
+	{
+		return scope.Close(v8::Undefined());
+	}
+
+	const ValueCodec::Stats stats = self->codec->stats();
+	v8::Local<v8::Object> res = v8::Object::New();
+	res->Set(v8::String::NewSymbol("encoded"), v8::Number::New(stats.encoded));
+	res->Set(v8::String::NewSymbol("storedRaw"), v8::Number::New(stats.stored_raw));
+	res->Set(v8::String::NewSymbol("rawBytes"), v8::Number::New(stats.raw_bytes));
+	res->Set(v8::String::NewSymbol("storedBytes"), v8::Number::New(stats.stored_bytes));
+	res->Set(v8::String::NewSymbol("ratio"), v8::Number::New(stats.stored_bytes ? static_cast<double>(stats.raw_bytes) / stats.stored_bytes : 0));
+	res->Set(v8::String::NewSymbol("encodeNs"), v8::Number::New(stats.encode_ns));
+	res->Set(v8::String::NewSymbol("decoded"), v8::Number::New(stats.decoded));
+	res->Set(v8::String::NewSymbol("decodeNs"), v8::Number::New(stats.decode_ns));
+	res->Set(v8::String::NewSymbol("dictionaryId"), v8::Number::New(self->codec->dictionary_id()));
+	res->Set(v8::String::NewSymbol("logged"), v8::Number::New(stats.logged));
+	return scope.Close(res);
+}
+
+// `db.collectValueLog({minGarbageRatio}, cb)`, reclaims the value log files with at least that share of dead records.
+v8::Handle<v8::Value> HyperLevelDB::js_collect_value_log(const v8::Arguments& args)
+{
+	v8::HandleScope scope;
+
+	if (CS_BUNLIKELY(args.Length() < 1 || !args[args.Length() - 1]->IsFunction()))
+	{
+		raise_typeerr("the last argument (callback) must be a Function");
+		return scope.Close(v8::Undefined());
+	}
+
+	HyperLevelDB* self = node::ObjectWrap::Unwrap<HyperLevelDB>(args.This());
+	if (CS_BUNLIKELY(!self->check_open()))
+	{
+		return scope.Close(v8::Undefined());
+	}
+	if (CS_BUNLIKELY(!self->codec || !self->codec->log()))
+	{
+		raise_err("the database is not opened with a `valueLog`.");
+		return scope.Close(v8::Undefined());
+	}
+
+	double min_garbage = 0.5;
+	Dispatcher::Priority priority = Dispatcher::Bulk;
+	if (args.Length() > 1 && args[0]->IsObject())
+	{
+		priority = self->fill_priority(args[0]->ToObject(), priority);
+		v8::Local<v8::Value> ratio = args[0]->ToObject()->Get(v8::String::NewSymbol("minGarbageRatio"));
+		if (ratio->IsNumber())
+		{
+			min_garbage = ratio->NumberValue();
+		}
+	}
+
+	v8::Persistent<v8::Function> callback = v8::Persistent<v8::Function>::New(v8::Local<v8::Function>::Cast(args[args.Length() - 1]));
+	CollectValueLogJob* job = new CollectValueLogJob(self->db, self->codec->log(), min_garbage, callback);
+	Dispatcher::instance().queue(&job->uv_work, job->execute, on_collect_value_log, priority, job->db);
+
+	return args.This();
+}
+
+void HyperLevelDB::on_collect_value_log(uv_work_t* uv_work, int uv_status)
+{
+	CollectValueLogJob* job = reinterpret_cast<CollectValueLogJob*>(uv_work->data);
+	if (CS_BLIKELY(job->status.ok()))
+	{
+		const uint32_t argc = 2;
+		v8::Local<v8::Object> res = v8::Object::New();
+		res->Set(v8::String::NewSymbol("files"), v8::Number::New(job->files));
+		res->Set(v8::String::NewSymbol("reclaimedBytes"), v8::Number::New(job->reclaimed));
+		res->Set(v8::String::NewSymbol("relocated"), v8::Number::New(job->relocated));
+		v8::Local<v8::Value> argv[argc] = { v8::Local<v8::Value>::New(v8::Null()), res };
+		job->callback->Call(v8::Context::GetCurrent()->Global(), argc, argv);
+	}
+	else
+	{
+		const uint32_t argc = 1;
+		v8::Local<v8::Value> argv[argc] = { Jstatus::convert(job->status) };
+		job->callback->Call(v8::Context::GetCurrent()->Global(), argc, argv);
+	}
+	delete job;
+}
+
+v8::Handle<v8::Value> HyperLevelDB::js_value_log_stats(const v8::Arguments& args)
+{
+	v8::HandleScope scope;
 
-inline leveldb::Status HyperLevelDB::get(const leveldb::ReadOptions& options, const v8::Handle<v8::Value>& key_, std::string& res)
+	HyperLevelDB* self = node::ObjectWrap::Unwrap<HyperLevelDB>(args.This());
+	if (!self->codec || !self->codec->log())
+	{
+		return scope.Close(v8::Undefined());
+	}
+
+	const ValueLog::Stats stats = self->codec->log()->stats();
+	v8::Local<v8::Object> res = v8::Object::New();
+	res->Set(v8::String::NewSymbol("files"), v8::Number::New(stats.files));
+	res->Set(v8::String::NewSymbol("bytes"), v8::Number::New(stats.bytes));
+	res->Set(v8::String::NewSymbol("appended"), v8::Number::New(stats.appended));
+	res->Set(v8::String::NewSymbol("appendedBytes"), v8::Number::New(stats.appended_bytes));
+	res->Set(v8::String::NewSymbol("collectedFiles"), v8::Number::New(stats.collected_files));
+	res->Set(v8::String::NewSymbol("reclaimedBytes"), v8::Number::New(stats.reclaimed_bytes));
+	res->Set(v8::String::NewSymbol("relocated"), v8::Number::New(stats.relocated));
+	return scope.Close(res);
+}
+
+v8::Handle<v8::Value> HyperLevelDB::js_set_compaction_rate_limit(const v8::Arguments& args)
+{
+	v8::HandleScope scope;
+
+	if (CS_BUNLIKELY(args.Length() < 1 || !args[0]->IsNumber() || args[0]->IntegerValue() < 0))
+	{
+		raise_typeerr("the first argument (bytes per second) must be a Number, 0 for no limit.");
+		return scope.Close(v8::Undefined());
+	}
+
+	HyperLevelDB* self = node::ObjectWrap::Unwrap<HyperLevelDB>(args.This());
+	if (CS_BUNLIKELY(!self->check_open()))
+	{
+		return scope.Close(v8::Undefined());
+	}
+	uint64_t latency_target_us = args.Length() > 1 && args[1]->NumberValue() > 0 ? static_cast<uint64_t>(args[1]->NumberValue() * 1000) : 0;
+	self->env->set_rate(args[0]->IntegerValue(), latency_target_us);
+	return args.This();
+}
+
+v8::Handle<v8::Value> HyperLevelDB::js_compaction_rate_limit(const v8::Arguments& args)
+{
+	v8::HandleScope scope;
+
+	HyperLevelDB* self = node::ObjectWrap::Unwrap<HyperLevelDB>(args.This());
+	if (!self->env)
+	{
+		return scope.Close(v8::Undefined());
+	}
+
+	const ThrottledEnv* env = self->env;
+	v8::Local<v8::Object> res = v8::Object::New();
+	res->Set(v8::String::NewSymbol("rate"), v8::Number::New(env->rate()));
+	res->Set(v8::String::NewSymbol("configuredRate"), v8::Number::New(env->configured_rate()));
+	res->Set(v8::String::NewSymbol("latencyTarget"), v8::Number::New(env->latency_target_us / 1000.0));
+	res->Set(v8::String::NewSymbol("readLatency"), v8::Number::New(env->read_latency_us() / 1000.0));
+	res->Set(v8::String::NewSymbol("throttledBytes"), v8::Number::New(env->stats().throttled_bytes));
+	res->Set(v8::String::NewSymbol("throttledMs"), v8::Number::New(env->stats().throttled_us / 1000.0));
+	return scope.Close(res);
+}
+
+static v8::Local<v8::Object> io_counters(const AccountingEnv::Counters& counters)
+{
+	v8::Local<v8::Object> res = v8::Object::New();
+	res->Set(v8::String::NewSymbol("readOps"), v8::Number::New(counters.read_ops));
+	res->Set(v8::String::NewSymbol("readBytes"), v8::Number::New(counters.read_bytes));
+	res->Set(v8::String::NewSymbol("readMs"), v8::Number::New(counters.read_ns / 1e6));
+	res->Set(v8::String::NewSymbol("writeOps"), v8::Number::New(counters.write_ops));
+	res->Set(v8::String::NewSymbol("writeBytes"), v8::Number::New(counters.write_bytes));
+	res->Set(v8::String::NewSymbol("writeMs"), v8::Number::New(counters.write_ns / 1e6));
+	res->Set(v8::String::NewSymbol("syncs"), v8::Number::New(counters.syncs));
+	res->Set(v8::String::NewSymbol("syncMs"), v8::Number::New(counters.sync_ns / 1e6));
+	return res;
+}
+
+// `{log, table, manifest, other}`, each split into `foreground` and `background`,
+// `writeAmplification`: all the bytes written per byte written to the log, and `mappedBytes` of tables.
+v8::Handle<v8::Value> HyperLevelDB::js_io_stats(const v8::Arguments& args)
+{
+	v8::HandleScope scope;
+
+	HyperLevelDB* self = node::ObjectWrap::Unwrap<HyperLevelDB>(args.This());
+	if (!self->env)
+	{
+		return scope.Close(v8::Undefined());
+	}
+
+	static const char* const class_names[AccountingEnv::FileClassCount] = {"log", "table", "manifest", "blob", "other"};
+	const AccountingEnv& io = self->env->io();
+	uint64_t written = 0, logged = 0;
+	v8::Local<v8::Object> res = v8::Object::New();
+	for (int i = 0; i < AccountingEnv::FileClassCount; ++i)
+	{
+		AccountingEnv::FileClass file_class = static_cast<AccountingEnv::FileClass>(i);
+		const AccountingEnv::Counters& foreground = io.stats(file_class, AccountingEnv::RoleForeground);
+		const AccountingEnv::Counters& background = io.stats(file_class, AccountingEnv::RoleBackground);
+		v8::Local<v8::Object> by_role = v8::Object::New();
+		by_role->Set(v8::String::NewSymbol("foreground"), io_counters(foreground));
+		by_role->Set(v8::String::NewSymbol("background"), io_counters(background));
+		res->Set(v8::String::NewSymbol(class_names[i]), by_role);
+		written += foreground.write_bytes + background.write_bytes;
+		if (file_class == AccountingEnv::FileLog)
+		{
+			logged = foreground.write_bytes + background.write_bytes;
+		}
+	}
+	res->Set(v8::String::NewSymbol("writeAmplification"), v8::Number::New(logged ? static_cast<double>(written) / logged : 0));
+	res->Set(v8::String::NewSymbol("mappedBytes"), v8::Number::New(self->env->mapped_bytes()));
+	return scope.Close(res);
+}
+
+// `db.warmup({ranges: [{start, end}], indexOnly, hotKeys, budgetBytes, chunkBytes, bytesPerSecond, progress}, cb)`.
+// Without `ranges` the whole database is scanned, unless `indexOnly`. A range ends before `end`.
+v8::Handle<v8::Value> HyperLevelDB::js_warmup(const v8::Arguments& args)
+{
+	v8::HandleScope scope;
+
+	if (CS_BUNLIKELY(args.Length() < 1 || !args[args.Length() - 1]->IsFunction()))
+	{
+		raise_typeerr("the last argument (callback) must be a Function");
+		return scope.Close(v8::Undefined());
+	}
+
+	HyperLevelDB* self = node::ObjectWrap::Unwrap<HyperLevelDB>(args.This());
+	if (CS_BUNLIKELY(!self->check_open()))
+	{
+		return scope.Close(v8::Undefined());
+	}
+
+	v8::Persistent<v8::Function> callback = v8::Persistent<v8::Function>::New(v8::Local<v8::Function>::Cast(args[args.Length() - 1]));
+	WarmupJob* job = new WarmupJob(self->db, self->caches, self->open_options.comparator, callback);
+	job->codec = self->codec;
+	job->env = self->open_options.env;
+	job->directory = self->directory;
+	job->holder = v8::Persistent<v8::Object>::New(args.This());
+	job->current_db = &self->db;
+
+	v8::Local<v8::Object> opts_from = args.Length() > 1 && args[0]->IsObject() ? args[0]->ToObject() : v8::Object::New();
+	job->index_only = opts_from->Get(v8::String::NewSymbol("indexOnly"))->IsTrue();
+	job->priority = self->fill_priority(opts_from, Dispatcher::Bulk);
+	job->hot_keys = opts_from->Get(v8::String::NewSymbol("hotKeys"))->IsTrue();
+	v8::Local<v8::Value> budget = opts_from->Get(v8::String::NewSymbol("budgetBytes"));
+	job->budget = budget->IsNumber() && budget->IntegerValue() > 0 ? budget->IntegerValue() : 0;
+	v8::Local<v8::Value> chunk = opts_from->Get(v8::String::NewSymbol("chunkBytes"));
+	if (chunk->IsNumber() && chunk->IntegerValue() > 0)
+	{
+		job->chunk_size = chunk->IntegerValue();
+	}
+	v8::Local<v8::Value> rate = opts_from->Get(v8::String::NewSymbol("bytesPerSecond"));
+	if (rate->IsNumber() && rate->IntegerValue() > 0)
+	{
+		job->limiter.set_rate(rate->IntegerValue());
+	}
+	v8::Local<v8::Value> progress = opts_from->Get(v8::String::NewSymbol("progress"));
+	if (progress->IsFunction())
+	{
+		job->progress = v8::Persistent<v8::Function>::New(v8::Local<v8::Function>::Cast(progress));
+	}
+
+	v8::Local<v8::Value> ranges = opts_from->Get(v8::String::NewSymbol("ranges"));
+	if (ranges->IsArray())
+	{
+		v8::Local<v8::Array> list = v8::Local<v8::Array>::Cast(ranges);
+		for (uint32_t i = 0; i < list->Length(); ++i)
+		{
+			if (CS_BUNLIKELY(!list->Get(i)->IsObject()))
+			{
+				raise_typeerr("every range must be an Object");
+				delete job;
+				return scope.Close(v8::Undefined());
+			}
+			v8::Local<v8::Object> range = list->Get(i)->ToObject();
+			std::pair<std::string, std::string> bounds;
+			if (range->Has(iter_option_start))
+			{
+				JsBytes start(range->Get(iter_option_start));
+				if (CS_BUNLIKELY(!start.ok()))
+				{
+					delete job;
+					return scope.Close(v8::Undefined());
+				}
+				bounds.first = start.str();
+			}
+			if (range->Has(iter_option_end))
+			{
+				JsBytes end(range->Get(iter_option_end));
+				if (CS_BUNLIKELY(!end.ok()))
+				{
+					delete job;
+					return scope.Close(v8::Undefined());
+				}
+				bounds.second = end.str();
+			}
+			job->ranges.push_back(bounds);
+		}
+	}
+	else if (!job->index_only)
+	{
+		job->ranges.push_back(std::make_pair(std::string(), std::string()));
+	}
+
+	Dispatcher::instance().queue(&job->uv_work, job->execute, on_warmup, job->priority, job->db);
+	return args.This();
+}
+
+static v8::Local<v8::Object> warmup_progress(const WarmupJob* job)
+{
+	v8::Local<v8::Object> res = v8::Object::New();
+	res->Set(v8::String::NewSymbol("tables"), v8::Number::New(job->tables));
+	res->Set(v8::String::NewSymbol("hotKeys"), v8::Number::New(job->hot_keys_read));
+	res->Set(v8::String::NewSymbol("keys"), v8::Number::New(job->keys));
+	res->Set(v8::String::NewSymbol("bytes"), v8::Number::New(job->bytes));
+	res->Set(v8::String::NewSymbol("rangesDone"), v8::Number::New(job->range_index));
+	res->Set(v8::String::NewSymbol("ranges"), v8::Number::New(job->ranges.size()));
+	return res;
+}
+
+void HyperLevelDB::on_warmup(uv_work_t* uv_work, int uv_status)
+{
+	WarmupJob* job = reinterpret_cast<WarmupJob*>(uv_work->data);
+	if (CS_BUNLIKELY(job->abandoned()))
+	{
+		job->status = leveldb::Status::IOError("warmup", "the database was closed");
+		job->done = true;
+	}
+	if (!job->done)
+	{
+		if (!job->progress.IsEmpty())
+		{
+			const uint32_t argc = 1;
+			v8::Local<v8::Value> argv[argc] = { warmup_progress(job) };
+			job->progress->Call(v8::Context::GetCurrent()->Global(), argc, argv);
+		}
+		if (job->wait_us)
+		{
+			// the rate limit is waited out on the loop, a close waits for it like for a queued run.
+			Dispatcher::instance().hold(job->db);
+			uv_timer_init(uv_default_loop(), &job->timer);
+			job->timer.data = job;
+			uv_timer_start(&job->timer, on_warmup_timer, (job->wait_us + 999) / 1000, 0);
+			return;
+		}
+		Dispatcher::instance().queue(&job->uv_work, job->execute, on_warmup, job->priority, job->db);
+		return;
+	}
+
+	if (CS_BLIKELY(job->status.ok()))
+	{
+		const uint32_t argc = 2;
+		v8::Local<v8::Value> argv[argc] = { v8::Local<v8::Value>::New(v8::Null()), warmup_progress(job) };
+		job->callback->Call(v8::Context::GetCurrent()->Global(), argc, argv);
+	}
+	else
+	{
+		const uint32_t argc = 1;
+		v8::Local<v8::Value> argv[argc] = { Jstatus::convert(job->status) };
+		job->callback->Call(v8::Context::GetCurrent()->Global(), argc, argv);
+	}
+	delete job;
+}
+
+#if UV_VERSION_MAJOR == 0
+void HyperLevelDB::on_warmup_timer(uv_timer_t* timer, int uv_status)
+#else
+void HyperLevelDB::on_warmup_timer(uv_timer_t* timer)
+#endif
+{
+	uv_close(reinterpret_cast<uv_handle_t*>(timer), on_warmup_waited);
+}
+
+void HyperLevelDB::on_warmup_waited(uv_handle_t* timer)
+{
+	WarmupJob* job = static_cast<WarmupJob*>(timer->data);
+	job->wait_us = 0;
+	const void* owner = job->db;
+	if (CS_BUNLIKELY(job->abandoned()))
+	{
+		// closed meanwhile, `on_warmup` reports it without running again.
+		Dispatcher::instance().release(owner);
+		on_warmup(&job->uv_work, 0);
+		return;
+	}
+	// queued before the hold is released, so a close queued meanwhile still waits for the run.
+	Dispatcher::instance().queue(&job->uv_work, job->execute, on_warmup, job->priority, owner);
+	Dispatcher::instance().release(owner);
+}
+
+void HyperLevelDB::on_immediate(uv_work_t* uv_work, int uv_status)
+{
+	ImmediateJob* job = reinterpret_cast<ImmediateJob*>(uv_work->data);
+	if (CS_BLIKELY(job->callback->IsFunction()))
+	{
+		if (job->status.ok())
+		{
+			job->callback->Call(v8::Context::GetCurrent()->Global(), 0, NULL);
+		}
+		else
+		{
+			const uint32_t argc = 1;
+			v8::Local<v8::Value> argv[argc] = { Jstatus::convert(job->status) };
+			job->callback->Call(v8::Context::GetCurrent()->Global(), argc, argv);
+		}
+	}
+	delete job;
+}
+
+v8::Handle<v8::Value> HyperLevelDB::js_repair(const v8::Arguments& args)
+{
+	v8::HandleScope scope;
+
+	HyperLevelDB* self = node::ObjectWrap::Unwrap<HyperLevelDB>(args.This());
+
+	leveldb::Options options;
+	self->init_default_open_options(options);
+
+	if (CS_BUNLIKELY(args.Length() < 2))
+	{
+		raise_typeerr("at least 2 arguments (location, callback) are required.");
+		return scope.Close(v8::Undefined());
+	}
+
+	Dispatcher::Priority priority = Dispatcher::Bulk;
+	if (args.Length() > 2 && args[1]->IsObject())
+	{
+		v8::Local<v8::Object> opts_from = args[1]->ToObject();
+		MemoryBudget budget;
+		if (CS_BUNLIKELY(!self->fill_open_options(opts_from, options, budget)))
+		{
+			delete options.block_cache;
+			return scope.Close(v8::Undefined());
+		}
+		priority = self->fill_priority(opts_from, priority);
+	}
+
+	v8::Persistent<v8::Function> callback = v8::Persistent<v8::Function>::New(v8::Local<v8::Function>::Cast(args[args.Length() - 1]));
+	RepairJob* job = new RepairJob(self->db, v8::String::AsciiValue(args[0]->ToString()), options, callback);
+	Dispatcher::instance().queue(&job->uv_work, job->execute, on_repair, priority, job->db);
+
+	return args.This();
+}
+
+void HyperLevelDB::on_repair(uv_work_t* uv_work, int uv_status)
+{
+	RepairJob* job = reinterpret_cast<RepairJob*>(uv_work->data);
+	if (CS_BLIKELY(job->status.ok()))
+	{
+		if (CS_BLIKELY(job->callback->IsFunction()))
+		{
+			job->callback->Call(v8::Context::GetCurrent()->Global(), 0, NULL);
+		}
+	}
+	else
+	{
+		if (CS_BLIKELY(job->callback->IsFunction()))
+		{
+			const uint32_t argc = 1;
+			v8::Local<v8::Value> argv[argc] = { Jstatus::convert(job->status) };
+			job->callback->Call(v8::Context::GetCurrent()->Global(), argc, argv);
+		}
+	}
+	delete job;
+}
+
+v8::Handle<v8::Value> HyperLevelDB::js_destroy(const v8::Arguments& args)
+{
+	v8::HandleScope scope;
+
+	HyperLevelDB* self = node::ObjectWrap::Unwrap<HyperLevelDB>(args.This());
+
+	leveldb::Options options;
+	self->init_default_open_options(options);
+
+	if (CS_BUNLIKELY(args.Length() < 2))
+	{
+		raise_typeerr("at least 2 arguments (location, callback) are required.");
+		return scope.Close(v8::Undefined());
+	}
+
+	if (args.Length() > 2 && args[1]->IsObject())
+	{
+		v8::Local<v8::Object> opts_from = args[1]->ToObject();
+		MemoryBudget budget;
+		if (CS_BUNLIKELY(!self->fill_open_options(opts_from, options, budget)))
+		{
+			delete options.block_cache;
+			return scope.Close(v8::Undefined());
+		}
+	}
+
+	v8::Persistent<v8::Function> callback = v8::Persistent<v8::Function>::New(v8::Local<v8::Function>::Cast(args[args.Length() - 1]));
+	DestroyJob* job = new DestroyJob(self->db, v8::String::AsciiValue(args[0]->ToString()), options, callback);
+	Dispatcher::instance().queue(&job->uv_work, job->execute, on_destroy, Dispatcher::Bulk, NULL);
+
+	return scope.Close(v8::Undefined());
+}
+
+void HyperLevelDB::on_destroy(uv_work_t* uv_work, int uv_status)
+{
+	DestroyJob* job = reinterpret_cast<DestroyJob*>(uv_work->data);
+	if (CS_BLIKELY(job->status.ok()))
+	{
+		if (CS_BLIKELY(job->callback->IsFunction()))
+		{
+			job->callback->Call(v8::Context::GetCurrent()->Global(), 0, NULL);
+		}
+	}
+	else
+	{
+		if (CS_BLIKELY(job->callback->IsFunction()))
+		{
+			const uint32_t argc = 1;
+			v8::Local<v8::Value> argv[argc] = { Jstatus::convert(job->status) };
+			job->callback->Call(v8::Context::GetCurrent()->Global(), argc, argv);
+		}
+	}
+	delete job;
+}
+
+inline leveldb::Status HyperLevelDB::put(const leveldb::WriteOptions& options, const leveldb::Slice& key, const leveldb::Slice& value)
+{
+	caches.invalidate(key);
+	KeyLocks::WriteGuard guard(locks, key);
+	leveldb::Status status;
+	if (codec)
+	{
+		ValueCodec::WriteScope scope(codec);
+		std::string encoded;
+		codec->encode(value, encoded);
+		status = scope.sync(options.sync);
+		if (status.ok())
+		{
+			status = db->Put(options, key, leveldb::Slice(encoded));
+		}
+	}
+	else
+	{
+		status = db->Put(options, key, value);
+	}
+	caches.invalidate(key);
+	return status;
+}
+
+inline leveldb::Status HyperLevelDB::get(const leveldb::ReadOptions& options, const leveldb::Slice& key, std::string& res)
+{
+	return caches.read(db, options, key, &res, codec);
+}
+
+inline leveldb::Status HyperLevelDB::del(const leveldb::WriteOptions& options, const leveldb::Slice& key)
 {
-	v8::String::AsciiValue key_data(key_->ToString());
-	leveldb::Slice key(*key_data, key_data.length());
-	return db->Get(options, key, &res);
+	caches.invalidate(key);
+	leveldb::Status status;
+	{
+		KeyLocks::WriteGuard guard(locks, key);
+		ValueCodec::WriteScope scope(codec);
+		status = db->Delete(options, key);
+	}
+	caches.invalidate(key);
+	return status;
 }
 
-inline leveldb::Status HyperLevelDB::del(const leveldb::WriteOptions& options, const v8::Handle<v8::Value>& key_)
+inline leveldb::Status HyperLevelDB::write(const leveldb::WriteOptions& options, leveldb::WriteBatch& batch, const std::vector<std::string>& keys,
+		const ValueCodec::WriteScope& scope)
 {
-	v8::String::AsciiValue key_data(key_->ToString());
-	leveldb::Slice key(*key_data, key_data.length());
-	return db->Delete(options, key);
+	for (std::vector<std::string>::const_iterator it = keys.begin(); it != keys.end(); ++it)
+	{
+		caches.invalidate(leveldb::Slice(*it));
+	}
+	leveldb::Status status = scope.sync(options.sync);
+	if (status.ok())
+	{
+		status = db->Write(options, &batch);
+	}
+	for (std::vector<std::string>::const_iterator it = keys.begin(); it != keys.end(); ++it)
+	{
+		caches.invalidate(leveldb::Slice(*it));
+	}
+	return status;
 }
 
 const v8::Persistent<v8::String> HyperLevelDB::batch_operation_type = v8::Persistent<v8::String>::New(v8::String::New("type"));
 const v8::Persistent<v8::String> HyperLevelDB::batch_operation_put = v8::Persistent<v8::String>::New(v8::String::New("put"));
 const v8::Persistent<v8::String> HyperLevelDB::batch_operation_del = v8::Persistent<v8::String>::New(v8::String::New("del"));
+const v8::Persistent<v8::String> HyperLevelDB::batch_operation_check = v8::Persistent<v8::String>::New(v8::String::New("check"));
+const v8::Persistent<v8::String> HyperLevelDB::batch_operation_update = v8::Persistent<v8::String>::New(v8::String::New("update"));
+const v8::Persistent<v8::String> HyperLevelDB::batch_operation_absent = v8::Persistent<v8::String>::New(v8::String::New("absent"));
+const v8::Persistent<v8::String> HyperLevelDB::batch_operation_version = v8::Persistent<v8::String>::New(v8::String::New("version"));
 const v8::Persistent<v8::String> HyperLevelDB::batch_operation_key = v8::Persistent<v8::String>::New(v8::String::New("key"));
 const v8::Persistent<v8::String> HyperLevelDB::batch_operation_value = v8::Persistent<v8::String>::New(v8::String::New("value"));
 
 const v8::Persistent<v8::String> HyperLevelDB::write_option_sync = v8::Persistent<v8::String>::New(v8::String::New("sync"));
 
+const v8::Persistent<v8::String> HyperLevelDB::option_timeout_ms = v8::Persistent<v8::String>::New(v8::String::New("timeoutMs"));
+const v8::Persistent<v8::String> HyperLevelDB::option_deadline = v8::Persistent<v8::String>::New(v8::String::New("deadline"));
+const v8::Persistent<v8::String> HyperLevelDB::option_priority = v8::Persistent<v8::String>::New(v8::String::New("priority"));
+
 const v8::Persistent<v8::String> HyperLevelDB::read_option_verify_checksums = v8::Persistent<v8::String>::New(v8::String::New("verifyChecksums"));
 const v8::Persistent<v8::String> HyperLevelDB::read_option_fill_cache = v8::Persistent<v8::String>::New(v8::String::New("fillCache"));
 const v8::Persistent<v8::String> HyperLevelDB::read_option_as_buffer = v8::Persistent<v8::String>::New(v8::String::New("asBuffer"));
+const v8::Persistent<v8::String> HyperLevelDB::read_option_offset = v8::Persistent<v8::String>::New(v8::String::New("offset"));
+const v8::Persistent<v8::String> HyperLevelDB::read_option_length = v8::Persistent<v8::String>::New(v8::String::New("length"));
 
 const v8::Persistent<v8::String> HyperLevelDB::iter_option_start = v8::Persistent<v8::String>::New(v8::String::New("start"));
 const v8::Persistent<v8::String> HyperLevelDB::iter_option_end = v8::Persistent<v8::String>::New(v8::String::New("end"));
@@ -657,19 +2191,42 @@ const v8::Persistent<v8::String> HyperLevelDB::iter_option_limit = v8::Persisten
 const v8::Persistent<v8::String> HyperLevelDB::iter_option_fill_cache = v8::Persistent<v8::String>::New(v8::String::New("fillCache"));
 const v8::Persistent<v8::String> HyperLevelDB::iter_option_key_as_buffer = v8::Persistent<v8::String>::New(v8::String::New("keyAsBuffer"));
 const v8::Persistent<v8::String> HyperLevelDB::iter_option_value_as_buffer = v8::Persistent<v8::String>::New(v8::String::New("valueAsBuffer"));
+const v8::Persistent<v8::String> HyperLevelDB::iter_option_readahead = v8::Persistent<v8::String>::New(v8::String::New("readahead"));
+const v8::Persistent<v8::String> HyperLevelDB::iter_option_value_offset = v8::Persistent<v8::String>::New(v8::String::New("valueOffset"));
+const v8::Persistent<v8::String> HyperLevelDB::iter_option_value_length = v8::Persistent<v8::String>::New(v8::String::New("valueLength"));
+const v8::Persistent<v8::String> HyperLevelDB::iter_option_parallelism = v8::Persistent<v8::String>::New(v8::String::New("parallelism"));
+const v8::Persistent<v8::String> HyperLevelDB::iter_option_ordered = v8::Persistent<v8::String>::New(v8::String::New("ordered"));
+const v8::Persistent<v8::String> HyperLevelDB::iter_option_chunk_size = v8::Persistent<v8::String>::New(v8::String::New("chunkSize"));
+
+const v8::Persistent<v8::String> HyperLevelDB::update_option_op = v8::Persistent<v8::String>::New(v8::String::New("op"));
+const v8::Persistent<v8::String> HyperLevelDB::update_option_operand = v8::Persistent<v8::String>::New(v8::String::New("operand"));
 
+const v8::Persistent<v8::String> HyperLevelDB::aggregate_option_op = v8::Persistent<v8::String>::New(v8::String::New("op"));
+const v8::Persistent<v8::String> HyperLevelDB::aggregate_option_value_type = v8::Persistent<v8::String>::New(v8::String::New("valueType"));
 
 const leveldb::Status Job::status_ok = leveldb::Status::OK();
+const leveldb::Status Job::status_not_found = leveldb::Status::NotFound(leveldb::Slice());
+const char* const Job::would_block_reason = "hyperleveldown: would block";
+const char* const Job::timed_out_reason = "hyperleveldown: timed out";
+const leveldb::Status Job::status_would_block = leveldb::Status::IOError(Job::would_block_reason, "too many pending operations");
+const leveldb::Status Job::status_timed_out = leveldb::Status::IOError(Job::timed_out_reason, "the deadline passed before the operation ran");
 
 v8::Persistent<v8::Function> Jstatus::jsctor;	// extern here to omit "jstatus.cc".
+v8::Persistent<v8::Object> Jstatus::interned[Jstatus::CodeCount];
 
 const v8::Persistent<v8::String> Jstatus::js_err_ok = v8::Persistent<v8::String>::New(v8::String::New("OK"));
 const v8::Persistent<v8::String> Jstatus::js_err_prefix = v8::Persistent<v8::String>::New(v8::String::New("leveldb Error: "));
 const v8::Persistent<v8::String> Jstatus::js_err_io_error = v8::Persistent<v8::String>::New(v8::String::New("IOError"));
 const v8::Persistent<v8::String> Jstatus::js_err_not_found = v8::Persistent<v8::String>::New(v8::String::New("Not Found"));
 const v8::Persistent<v8::String> Jstatus::js_err_corruption = v8::Persistent<v8::String>::New(v8::String::New("Corruption"));
+const v8::Persistent<v8::String> Jstatus::js_err_would_block = v8::Persistent<v8::String>::New(v8::String::New("Would Block"));
+const v8::Persistent<v8::String> Jstatus::js_err_timed_out = v8::Persistent<v8::String>::New(v8::String::New("Timed Out"));
 const v8::Persistent<v8::String> Jstatus::js_err_unknown = v8::Persistent<v8::String>::New(v8::String::New("Unknown"));
 
+v8::Persistent<v8::FunctionTemplate> Jresources::jstpl;
+
 v8::Persistent<v8::Function> Jiterator::jsctor;
 
+v8::Persistent<v8::Function> JparallelIterator::jsctor;
+
 }
@@ -11,22 +11,64 @@
 #include <status.h>
 #include <options.h>
 #include <cache.h>
+#include <write_batch.h>
+#include <vector>
 #include <uv.h>
 #include "./jiterator.h"
+#include "./read_caches.h"
+#include "./admission.h"
+#include "./dispatcher.h"
+#include "./memory_budget.h"
+#include "./db_registry.h"
+#include "./shared_cache.h"
+#include "./envs.h"
+#include "./keycodec.h"
+#include "./key_locks.h"
+#include "./update.h"
+#include "./jobs.h"
 
 namespace leveldb {
 
 class HyperLevelDB:
 	public node::ObjectWrap
 {
-private:
+protected:
 	const std::string directory;
 
 	leveldb::Options open_options;
 
 	leveldb::DB* db;
 
-	leveldb::Cache* cache;
+	leveldb::Cache* cache;		// always an `AccountingCache` if set.
+
+	ValueCodec* codec;		// NULL unless opened with `valueCodec`.
+
+	ThrottledEnv* env;		// what the database is opened with, owned until handed to the close job.
+
+	Admission admission;
+
+	MemoryBudget memory;
+
+	// whether `get` reports a missing key as `callback()`, rather than a NotFound status.
+	bool not_found_as_undefined;
+
+	// whether `close` records the keys of the hot cache, for `warmup({hotKeys: true})` after the next `open`.
+	bool record_hot_keys;
+
+	// while the open job runs, it uses the codec and the caches, which `open` and `close` would free.
+	bool opening;
+
+	// shares a database another handle opened, which tells V8 of its memory and holds it to its budget.
+	bool adopted;
+
+private:
+	ReadCaches caches;
+
+	// serialize `update`s of the same keys on the worker threads, of every handle sharing the database.
+	KeyLocks* locks;
+
+	// whether hot-cache and miss-cache hits call back right away, instead of on the next loop iteration.
+	bool sync_cache_hits;
 
 public:
 	static void init(v8::Handle<v8::Object> exports);
@@ -46,16 +88,42 @@ public:
 	static v8::Handle<v8::Value> js_get(const v8::Arguments& args);
 	static v8::Handle<v8::Value> js_del(const v8::Arguments& args);
 	static v8::Handle<v8::Value> js_batch(const v8::Arguments& args);
+	static v8::Handle<v8::Value> js_update(const v8::Arguments& args);
+	static v8::Handle<v8::Value> js_update_batch(const v8::Arguments& args);
 	static v8::Handle<v8::Value> js_approximate_size(const v8::Arguments& args);
+	static v8::Handle<v8::Value> js_aggregate(const v8::Arguments& args);
 	static v8::Handle<v8::Value> js_get_property(const v8::Arguments& args);
 	static v8::Handle<v8::Value> js_iterator(const v8::Arguments& args);
 	static v8::Handle<v8::Value> js_next(const v8::Arguments& args);
 	static v8::Handle<v8::Value> js_end(const v8::Arguments& args);
+	static v8::Handle<v8::Value> js_hot_cache_stats(const v8::Arguments& args);
+	static v8::Handle<v8::Value> js_miss_cache_stats(const v8::Arguments& args);
+	static v8::Handle<v8::Value> js_drain(const v8::Arguments& args);
+	static v8::Handle<v8::Value> js_pending_stats(const v8::Arguments& args);
+	static v8::Handle<v8::Value> js_cache_usage(const v8::Arguments& args);
+	static v8::Handle<v8::Value> js_memory_usage(const v8::Arguments& args);
+	static v8::Handle<v8::Value> js_train_value_dictionary(const v8::Arguments& args);
+	static v8::Handle<v8::Value> js_codec_stats(const v8::Arguments& args);
+	static v8::Handle<v8::Value> js_collect_value_log(const v8::Arguments& args);
+	static v8::Handle<v8::Value> js_value_log_stats(const v8::Arguments& args);
+	static v8::Handle<v8::Value> js_set_compaction_rate_limit(const v8::Arguments& args);
+	static v8::Handle<v8::Value> js_compaction_rate_limit(const v8::Arguments& args);
+	static v8::Handle<v8::Value> js_io_stats(const v8::Arguments& args);
+	static v8::Handle<v8::Value> js_warmup(const v8::Arguments& args);
+
+	// synchronous variants, run on the calling thread. Return the result directly or throw.
+	// The writes wait on the loop for the keys a locked `update` holds and for the value log a running
+	// `collectValueLog` swaps pointers in (a synced write), so they stall the loop meanwhile: use the
+	// asynchronous ones alongside those.
+	static v8::Handle<v8::Value> js_put_sync(const v8::Arguments& args);
+	static v8::Handle<v8::Value> js_get_sync(const v8::Arguments& args);
+	static v8::Handle<v8::Value> js_del_sync(const v8::Arguments& args);
+	static v8::Handle<v8::Value> js_batch_sync(const v8::Arguments& args);
 
 	static v8::Handle<v8::Value> js_destroy(const v8::Arguments& args);
 	static v8::Handle<v8::Value> js_repair(const v8::Arguments& args);
 
-private:
+protected:
 	static void on_open(uv_work_t* uv_work, int uv_status);
 	static void on_close(uv_work_t* uv_work, int uv_status);
 
@@ -63,43 +131,115 @@ private:
 	static void on_get(uv_work_t* uv_work, int uv_status);
 	static void on_del(uv_work_t* uv_work, int uv_status);
 	static void on_batch(uv_work_t* uv_work, int uv_status);
+	static void on_update(uv_work_t* uv_work, int uv_status);
 	static void on_approximate_size(uv_work_t* uv_work, int uv_status);
+	static void on_aggregate(uv_work_t* uv_work, int uv_status);
 	static void on_get_property(uv_work_t* uv_work, int uv_status);
 	static void on_next(uv_work_t* uv_work, int uv_status);
 	static void on_end(uv_work_t* uv_work, int uv_status);
 
 	static void on_destroy(uv_work_t* uv_work, int uv_status);
 	static void on_repair(uv_work_t* uv_work, int uv_status);
+	static void on_immediate(uv_work_t* uv_work, int uv_status);
+	static void on_train_value_dictionary(uv_work_t* uv_work, int uv_status);
+	static void on_collect_value_log(uv_work_t* uv_work, int uv_status);
+	static void on_warmup(uv_work_t* uv_work, int uv_status);
+#if UV_VERSION_MAJOR == 0
+	static void on_warmup_timer(uv_timer_t* timer, int uv_status);
+#else
+	static void on_warmup_timer(uv_timer_t* timer);
+#endif
+	static void on_warmup_waited(uv_handle_t* timer);
 
 private:
-	inline leveldb::Status put(const leveldb::WriteOptions& options, const v8::Handle<v8::Value>& key_, const v8::Handle<v8::Value>& value_);
-	inline leveldb::Status get(const leveldb::ReadOptions& options, const v8::Handle<v8::Value>& key_, std::string& res);
-	inline leveldb::Status del(const leveldb::WriteOptions& options, const v8::Handle<v8::Value>& key_);
+	inline leveldb::Status put(const leveldb::WriteOptions& options, const leveldb::Slice& key, const leveldb::Slice& value);
+	inline leveldb::Status get(const leveldb::ReadOptions& options, const leveldb::Slice& key, std::string& res);
+	inline leveldb::Status del(const leveldb::WriteOptions& options, const leveldb::Slice& key);
+	// `scope` is taken before the values of `batch` are encoded.
+	inline leveldb::Status write(const leveldb::WriteOptions& options, leveldb::WriteBatch& batch, const std::vector<std::string>& keys,
+			const ValueCodec::WriteScope& scope);
+
+	// throws unless the database is open.
+	CS_FORCE_INLINE bool check_open() const;
 
 protected:
 	// Provide this since that not only make a default open-options diffrent from `leveldb`'s may be useful,
 	// but also can provide more options that `leveldb`.
 	CS_FORCE_INLINE void init_default_open_options(leveldb::Options& options);
-	CS_FORCE_INLINE void fill_open_options(v8::Handle<v8::Object>& opts_from, leveldb::Options& opts_to);
+	// `budget` is split by `memoryBudget`: the handle's own for `open`, a scratch one for `repair` and `destroy`.
+	// Throws and returns false for an invalid option, the caller frees `opts_to.block_cache`.
+	CS_FORCE_INLINE bool fill_open_options(v8::Handle<v8::Object>& opts_from, leveldb::Options& opts_to, MemoryBudget& budget);
+	// the Env of an open: `compactionRateLimit`, `compactionLatencyTarget`, `tableReads` and `mmapLimit`.
+	// Installs it into `env`, so only `open` calls it, after `fill_open_options`. Throws and returns false for a bad `tableReads`.
+	CS_FORCE_INLINE bool fill_env_options(v8::Handle<v8::Object>& opts_from, leveldb::Options& opts_to);
+	// wraps `opts_to.env` into `env`.
+	CS_FORCE_INLINE void install_env(leveldb::Options& opts_to, uint64_t rate, uint64_t latency_target_us,
+			TableReadEnv::Mode table_read_mode = TableReadEnv::ModeDefault, uint64_t mmap_limit = 0);
+	// options of the binding itself, rather than of `leveldb`. throws and returns false for an invalid one.
+	CS_FORCE_INLINE bool fill_binding_options(v8::Handle<v8::Object>& opts_from);
+	// whether the options of this handle agree with those `shared` was opened with, `status` tells how not.
+	CS_FORCE_INLINE bool compatible(const DbRegistry::Shared& shared, leveldb::Status& status) const;
+	// frees what the options made for this handle, for `adopt` or an open that failed before its job.
+	CS_FORCE_INLINE void drop_open_state();
+	// use what another handle opened, in place of what the options made for this one.
+	CS_FORCE_INLINE void adopt(const DbRegistry::Shared& shared);
+	// opens the database for `job`, shares it with the handle that has it open, or waits for the one opening it.
+	void start_open(OpenJob* job);
+	static void resume_open(void* arg);
 
 	CS_FORCE_INLINE void fill_write_options(const v8::Handle<v8::Object>& opts_from, leveldb::WriteOptions& opts_to) const;
+	// throws and returns false for an unknown operator or an operand it does not take.
+	CS_FORCE_INLINE bool fill_update(const v8::Handle<v8::Value>& key, const v8::Handle<v8::Value>& op,
+			const v8::Handle<v8::Value>& operand, Update& update) const;
 
-	CS_FORCE_INLINE void fill_iter_settings(const v8::Handle<v8::Object>& opts_from, leveldb::ReadOptions& read_options, IterOptions& iter_options);
+	// throws and returns false for a `start` or `end` that can not be encoded.
+	CS_FORCE_INLINE bool fill_iter_settings(const v8::Handle<v8::Object>& opts_from, leveldb::ReadOptions& read_options, IterOptions& iter_options);
 	CS_FORCE_INLINE bool fill_read_options(const v8::Handle<v8::Object>& opts_from, leveldb::ReadOptions& opts_to, bool fill_cache_default = true) const;
-	CS_FORCE_INLINE void fill_iter_options(const v8::Handle<v8::Object>& opts_from, IterOptions& iter_options);
+	CS_FORCE_INLINE bool fill_iter_options(const v8::Handle<v8::Object>& opts_from, IterOptions& iter_options);
+	// the `uv_hrtime` deadline of `timeoutMs` (from now) or `deadline` (a `Date.now()` time), 0 for none.
+	CS_FORCE_INLINE uint64_t fill_deadline(const v8::Handle<v8::Object>& opts_from) const;
+	// the class named by `priority`, `default_priority` if none or unknown.
+	CS_FORCE_INLINE Dispatcher::Priority fill_priority(const v8::Handle<v8::Object>& opts_from, Dispatcher::Priority default_priority) const;
+	// reads `offset` and `length` as named by the caller, negatives count as 0.
+	CS_FORCE_INLINE void fill_projection(const v8::Handle<v8::Object>& opts_from, const v8::Persistent<v8::String>& offset,
+			const v8::Persistent<v8::String>& length, Projection& projection) const;
 
-private:
+	// deliver a job that was completed on the event loop (e.g. a cache hit).
+	CS_FORCE_INLINE void complete_inline(uv_work_t* uv_work, uv_after_work_cb after) const;
+
+	// count a job against the pending limits until it completes.
+	CS_FORCE_INLINE void admit(Job* job, size_t charge);
+	// tell V8 what the caches and write buffers hold, and hold the cache to the budget. At most every `tick_ms` unless `force`.
+	CS_FORCE_INLINE void account_memory(bool force = false);
+	// the most the memtables hold, the one written and the one being flushed.
+	CS_FORCE_INLINE uint64_t write_buffer_bytes() const;
+	CS_FORCE_INLINE uint64_t hot_cache_bytes() const;
+	// call back with a "would block" error on the next loop iteration, for a write over the pending limits.
+	CS_FORCE_INLINE v8::Handle<v8::Value> refuse(Callback callback);
+
+protected:
 	static const v8::Persistent<v8::String> batch_operation_type;
 	static const v8::Persistent<v8::String> batch_operation_put;
 	static const v8::Persistent<v8::String> batch_operation_del;
+	static const v8::Persistent<v8::String> batch_operation_check;
+	static const v8::Persistent<v8::String> batch_operation_update;
+	static const v8::Persistent<v8::String> batch_operation_absent;
+	static const v8::Persistent<v8::String> batch_operation_version;
 	static const v8::Persistent<v8::String> batch_operation_key;
 	static const v8::Persistent<v8::String> batch_operation_value;
 
 	static const v8::Persistent<v8::String> write_option_sync;
 
+	// read and write options both.
+	static const v8::Persistent<v8::String> option_timeout_ms;
+	static const v8::Persistent<v8::String> option_deadline;
+	static const v8::Persistent<v8::String> option_priority;
+
 	static const v8::Persistent<v8::String> read_option_verify_checksums;
 	static const v8::Persistent<v8::String> read_option_fill_cache;
 	static const v8::Persistent<v8::String> read_option_as_buffer;
+	static const v8::Persistent<v8::String> read_option_offset;
+	static const v8::Persistent<v8::String> read_option_length;
 
 	static const v8::Persistent<v8::String> iter_option_start;
 	static const v8::Persistent<v8::String> iter_option_end;
@@ -110,6 +250,18 @@ private:
 	static const v8::Persistent<v8::String> iter_option_fill_cache;
 	static const v8::Persistent<v8::String> iter_option_key_as_buffer;
 	static const v8::Persistent<v8::String> iter_option_value_as_buffer;
+	static const v8::Persistent<v8::String> iter_option_readahead;
+	static const v8::Persistent<v8::String> iter_option_value_offset;
+	static const v8::Persistent<v8::String> iter_option_value_length;
+	static const v8::Persistent<v8::String> iter_option_parallelism;
+	static const v8::Persistent<v8::String> iter_option_ordered;
+	static const v8::Persistent<v8::String> iter_option_chunk_size;
+
+	static const v8::Persistent<v8::String> update_option_op;
+	static const v8::Persistent<v8::String> update_option_operand;
+
+	static const v8::Persistent<v8::String> aggregate_option_op;
+	static const v8::Persistent<v8::String> aggregate_option_value_type;
 
 };
 
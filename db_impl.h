@@ -4,10 +4,14 @@
 #include "./assist.h"
 #include <cstdlib>
 #include <sstream>
+#include <sys/time.h>
 #include <v8.h>
 #include <options.h>
 #include <db.h>
 #include "./db.h"
+#include "./ready_queue.h"
+#include "./jresources.h"
+#include "./comparators.h"
 
 namespace leveldb {
 
@@ -34,8 +38,36 @@ namespace leveldb {
 		}																		\
 	}
 
-void HyperLevelDB::fill_open_options(v8::Handle<v8::Object>& opts_from, leveldb::Options& opts_to)
+bool HyperLevelDB::fill_open_options(v8::Handle<v8::Object>& opts_from, leveldb::Options& opts_to, MemoryBudget& budget)
 {
+	{
+		// split between the write buffers, the block cache and the queued jobs, but for those set on their own.
+		v8::Local<v8::String> key = v8::String::New("memoryBudget");
+		int64_t limit = opts_from->Has(key) ? opts_from->Get(key)->IntegerValue() : 0;
+		budget.split(limit > 0 ? limit : 0);
+		if (budget.limit && !opts_from->Has(v8::String::New("writeBufferSize")))
+		{
+			opts_to.write_buffer_size = budget.write_buffers / 2;
+		}
+	}
+
+	{
+		// a `SharedResources` handle overrides `cacheSize`.
+		v8::Local<v8::String> key = v8::String::New("shared");
+		if (opts_from->Has(key))
+		{
+			SharedResources* shared = Jresources::unwrap(opts_from->Get(key));
+			if (CS_BUNLIKELY(!shared))
+			{
+				raise_typeerr("`shared` must be a SharedResources.");
+				return false;
+			}
+			opts_to.block_cache = new AccountingCache(shared, budget.limit > 0);
+			opts_to.env = shared->env;
+		}
+	}
+
+	if (!opts_to.block_cache)
 	{
 		v8::Local<v8::String> key = v8::String::New("cacheSize");
 		if (opts_from->Has(key))
@@ -43,18 +75,25 @@ void HyperLevelDB::fill_open_options(v8::Handle<v8::Object>& opts_from, leveldb:
 			int64_t block_cache_size = opts_from->Get(key)->ToInteger()->Value();
 			if (block_cache_size > 0)
 			{
-				cache = static_cast<leveldb::Cache*>(std::malloc(block_cache_size));
-				if (CS_BUNLIKELY(!cache))
+				// a private cache, wrapped all the same so `cacheUsage` works either way.
+				SharedResources* own = new SharedResources(block_cache_size);
+				opts_to.block_cache = new AccountingCache(own, budget.limit > 0);
+				own->unref();
+				if (budget.limit)
 				{
-					std::stringstream stream;
-					stream << "failed to alloc " << block_cache_size << " bytes block-cache";
-					raise_err(stream.str());
+					budget.cache = budget.cache_limit = block_cache_size;
 				}
-				opts_to.block_cache = cache;
 			}
 		}
 	}
 
+	if (!opts_to.block_cache && budget.limit)
+	{
+		SharedResources* own = new SharedResources(budget.cache);
+		opts_to.block_cache = new AccountingCache(own, true);
+		own->unref();
+	}
+
 	{
 		v8::Local<v8::String> key = v8::String::New("compression");
 		if (opts_from->Has(key))
@@ -64,6 +103,22 @@ void HyperLevelDB::fill_open_options(v8::Handle<v8::Object>& opts_from, leveldb:
 		}
 	}
 
+	{
+		// must stay the same for the life of a database, leveldb refuses to open it with another one.
+		v8::Local<v8::String> key = v8::String::New("comparator");
+		if (opts_from->Has(key))
+		{
+			std::string name = jstr2str(opts_from->Get(key));
+			const leveldb::Comparator* comparator = comparator_by_name(name);
+			if (CS_BUNLIKELY(!comparator))
+			{
+				raise_typeerr("`comparator` must be one of `bytewise`, `reverseBytewise`, `u64Descending` and `tuple`.");
+				return false;
+			}
+			opts_to.comparator = comparator;
+		}
+	}
+
 	__FRANK_FILL_OPTIONS_BOOLEAN(create_if_missing, "createIfMissing", opts_from, opts_to)
 	__FRANK_FILL_OPTIONS_BOOLEAN(error_if_exists, "errorIfExists", opts_from, opts_to)
 
@@ -71,16 +126,346 @@ void HyperLevelDB::fill_open_options(v8::Handle<v8::Object>& opts_from, leveldb:
 	__FRANK_FILL_OPTIONS_INTEGER(block_size, "blockSize", opts_from, opts_to)
 	__FRANK_FILL_OPTIONS_INTEGER(max_open_files, "maxOpenFiles", opts_from, opts_to)
 	__FRANK_FILL_OPTIONS_INTEGER(block_restart_interval, "blockRestartInterval", opts_from, opts_to)
+
+	{
+		// leveldb keeps `max_open_files` less the few non-table files in its table cache.
+		// Mapped tables hold no descriptor, so with `tableReads: "mmap"` this can go past the descriptor limit.
+		v8::Local<v8::String> key = v8::String::New("tableCacheSize");
+		if (opts_from->Has(key) && opts_from->Get(key)->IntegerValue() > 0)
+		{
+			opts_to.max_open_files = opts_from->Get(key)->IntegerValue() + 10;
+		}
+	}
+	return true;
+}
+
+bool HyperLevelDB::fill_env_options(v8::Handle<v8::Object>& opts_from, leveldb::Options& opts_to)
+{
+	// bytes per second flushes and compactions may write, 0 for no limit.
+	uint64_t rate = 0, latency_target_us = 0;
+	v8::Local<v8::String> key = v8::String::New("compactionRateLimit");
+	if (opts_from->Has(key) && opts_from->Get(key)->IntegerValue() > 0)
+	{
+		rate = opts_from->Get(key)->IntegerValue();
+	}
+	v8::Local<v8::String> target_key = v8::String::New("compactionLatencyTarget");
+	if (opts_from->Has(target_key) && opts_from->Get(target_key)->NumberValue() > 0)
+	{
+		latency_target_us = static_cast<uint64_t>(opts_from->Get(target_key)->NumberValue() * 1000);
+	}
+
+	// `mmap` or `pread`, leveldb decides otherwise. `mmapLimit` caps the bytes mapped, the tables past it use pread.
+	TableReadEnv::Mode table_read_mode = TableReadEnv::ModeDefault;
+	uint64_t mmap_limit = ~static_cast<uint64_t>(0);
+	v8::Local<v8::String> mode_key = v8::String::New("tableReads");
+	if (opts_from->Has(mode_key))
+	{
+		std::string mode = jstr2str(opts_from->Get(mode_key));
+		if (mode == "mmap")
+		{
+			table_read_mode = TableReadEnv::ModeMmap;
+		}
+		else if (mode == "pread")
+		{
+			table_read_mode = TableReadEnv::ModePread;
+		}
+		else if (CS_BUNLIKELY(mode != "default"))
+		{
+			raise_typeerr("`tableReads` must be one of `mmap`, `pread` and `default`.");
+			return false;
+		}
+	}
+	v8::Local<v8::String> limit_key = v8::String::New("mmapLimit");
+	if (opts_from->Has(limit_key) && opts_from->Get(limit_key)->IntegerValue() >= 0)
+	{
+		mmap_limit = opts_from->Get(limit_key)->IntegerValue();
+	}
+	install_env(opts_to, rate, latency_target_us, table_read_mode, mmap_limit);
+	return true;
+}
+
+void HyperLevelDB::install_env(leveldb::Options& opts_to, uint64_t rate, uint64_t latency_target_us,
+		TableReadEnv::Mode table_read_mode, uint64_t mmap_limit)
+{
+	env = new ThrottledEnv(opts_to.env, rate, latency_target_us, table_read_mode, mmap_limit);
+	opts_to.env = env;
 }
 #	undef __FRANK_HYPERLEVELDB_FILL_OPTIONS
 #endif
 
+bool HyperLevelDB::compatible(const DbRegistry::Shared& shared, leveldb::Status& status) const
+{
+	// the rest, caches and limits, may differ: the handle takes those of the database.
+	if (open_options.comparator != shared.options.comparator)
+	{
+		status = leveldb::Status::InvalidArgument(shared.directory, "is open with another `comparator`");
+		return false;
+	}
+	if (!ValueCodec::same_format(codec, shared.codec))
+	{
+		status = leveldb::Status::InvalidArgument(shared.directory, "is open with another `valueCodec` or `valueLog`");
+		return false;
+	}
+	return true;
+}
+
+void HyperLevelDB::drop_open_state()
+{
+	// made by the options of this open, no job has them: the handle is not open nor being opened.
+	delete cache;
+	cache = NULL;
+	caches.clear();
+	delete codec;
+	codec = NULL;
+	delete env;
+	env = NULL;
+	memory.report(0);
+}
+
+void HyperLevelDB::adopt(const DbRegistry::Shared& shared)
+{
+	drop_open_state();
+
+	db = shared.db;
+	open_options = shared.options;
+	cache = shared.cache;
+	codec = shared.codec;
+	env = shared.env;
+	caches = shared.caches;
+	locks = shared.locks;
+	// the handle that opened it accounts for it, once.
+	adopted = true;
+}
+
+bool HyperLevelDB::fill_binding_options(v8::Handle<v8::Object>& opts_from)
+{
+	{
+		// checked before anything is made for the handle.
+		v8::Local<v8::String> key = v8::String::New("valueCodec");
+		if (opts_from->Has(key))
+		{
+			std::string name = jstr2str(opts_from->Get(key));
+			if (CS_BUNLIKELY(name != "zstd" && name != "none"))
+			{
+				raise_typeerr("`valueCodec` must be `zstd` or `none`.");
+				return false;
+			}
+		}
+	}
+
+	{
+		v8::Local<v8::String> key = v8::String::New("hotCacheSize");
+		if (opts_from->Has(key))
+		{
+			int64_t hot_cache_size = opts_from->Get(key)->ToInteger()->Value();
+			if (hot_cache_size > 0)
+			{
+				size_t shards = 16;
+				v8::Local<v8::String> shards_key = v8::String::New("hotCacheShards");
+				if (opts_from->Has(shards_key) && opts_from->Get(shards_key)->ToInteger()->Value() > 0)
+				{
+					shards = opts_from->Get(shards_key)->ToInteger()->Value();
+				}
+				caches.hot = new HotCache(hot_cache_size, shards);
+			}
+		}
+	}
+
+	{
+		v8::Local<v8::String> key = v8::String::New("missCacheSize");
+		if (opts_from->Has(key))
+		{
+			int64_t miss_cache_size = opts_from->Get(key)->ToInteger()->Value();
+			if (miss_cache_size > 0)
+			{
+				caches.miss = new MissCache(miss_cache_size, 16);
+			}
+		}
+	}
+
+	{
+		// 64 bits, `ToInt32` would wrap a budget of 2GB or more. Negative means no limit.
+		v8::Local<v8::String> jobs_key = v8::String::New("maxPendingJobs");
+		if (opts_from->Has(jobs_key))
+		{
+			int64_t max_jobs = opts_from->Get(jobs_key)->IntegerValue();
+			admission.max_jobs = max_jobs > 0 ? static_cast<uint64_t>(max_jobs) : 0;
+		}
+		v8::Local<v8::String> bytes_key = v8::String::New("maxPendingBytes");
+		if (opts_from->Has(bytes_key))
+		{
+			int64_t max_bytes = opts_from->Get(bytes_key)->IntegerValue();
+			admission.max_bytes = max_bytes > 0 ? static_cast<uint64_t>(max_bytes) : 0;
+		}
+	}
+	if (memory.limit && !opts_from->Has(v8::String::New("maxPendingBytes")))
+	{
+		admission.max_bytes = memory.in_flight;
+	}
+
+	{
+		// values written before are unreadable with a codec, so it is chosen once when the database is created.
+		v8::Local<v8::String> key = v8::String::New("valueCodec");
+		if (opts_from->Has(key))
+		{
+			std::string name = jstr2str(opts_from->Get(key));
+			if (name == "zstd")
+			{
+				int level = 3;
+				size_t min_size = 64;
+				v8::Local<v8::String> level_key = v8::String::New("valueCodecLevel");
+				if (opts_from->Has(level_key))
+				{
+					level = opts_from->Get(level_key)->Int32Value();
+				}
+				v8::Local<v8::String> min_size_key = v8::String::New("valueCodecMinSize");
+				if (opts_from->Has(min_size_key) && opts_from->Get(min_size_key)->IntegerValue() >= 0)
+				{
+					min_size = opts_from->Get(min_size_key)->IntegerValue();
+				}
+				codec = new ValueCodec(level, min_size);
+			}
+		}
+	}
+
+	{
+		// pointers to the value log are values of the codec, so a codec that does not compress is made for it if needed.
+		v8::Local<v8::String> key = v8::String::New("valueLog");
+		if (opts_from->Has(key) && opts_from->Get(key)->IsTrue())
+		{
+			size_t min_size = 4096;
+			uint64_t file_size = 64 << 20;
+			v8::Local<v8::String> min_size_key = v8::String::New("valueLogMinSize");
+			if (opts_from->Has(min_size_key) && opts_from->Get(min_size_key)->IntegerValue() >= 0)
+			{
+				min_size = opts_from->Get(min_size_key)->IntegerValue();
+			}
+			v8::Local<v8::String> file_size_key = v8::String::New("valueLogFileSize");
+			if (opts_from->Has(file_size_key) && opts_from->Get(file_size_key)->IntegerValue() > 0)
+			{
+				file_size = opts_from->Get(file_size_key)->IntegerValue();
+			}
+			if (!codec)
+			{
+				codec = new ValueCodec(3, ValueCodec::never);
+			}
+			codec->use_log(min_size, file_size);
+		}
+	}
+
+	{
+		v8::Local<v8::String> key = v8::String::New("recordHotKeys");
+		if (opts_from->Has(key))
+		{
+			record_hot_keys = opts_from->Get(key)->IsTrue();
+		}
+	}
+
+	{
+		v8::Local<v8::String> key = v8::String::New("notFoundAsUndefined");
+		if (opts_from->Has(key))
+		{
+			not_found_as_undefined = opts_from->Get(key)->IsTrue();
+		}
+	}
+
+	{
+		v8::Local<v8::String> key = v8::String::New("hotCacheSyncHits");
+		if (opts_from->Has(key))
+		{
+			sync_cache_hits = opts_from->Get(key)->IsTrue();
+		}
+	}
+	return true;
+}
+
+void HyperLevelDB::complete_inline(uv_work_t* uv_work, uv_after_work_cb after) const
+{
+	if (sync_cache_hits)
+	{
+		after(uv_work, 0);
+	}
+	else
+	{
+		ReadyQueue::instance().push(uv_work, after);
+	}
+}
+
+void HyperLevelDB::admit(Job* job, size_t charge)
+{
+	job->admission = &admission;
+	job->charge = charge + Admission::job_overhead;
+	admission.acquire(job->charge, handle_);
+	account_memory();
+}
+
+uint64_t HyperLevelDB::write_buffer_bytes() const
+{
+	return db ? 2 * open_options.write_buffer_size : 0;
+}
+
+uint64_t HyperLevelDB::hot_cache_bytes() const
+{
+	if (!caches.hot)
+	{
+		return 0;
+	}
+	HotCache::Stats stats;
+	caches.hot->stats(stats);
+	return stats.usage;
+}
+
+void HyperLevelDB::account_memory(bool force)
+{
+	if (adopted)
+	{
+		return;
+	}
+	const uint64_t now = uv_now(uv_default_loop());
+	if (!force && now - memory.last_tick < MemoryBudget::tick_ms)
+	{
+		return;
+	}
+	memory.last_tick = now;
+
+	AccountingCache* accounting = static_cast<AccountingCache*>(cache);
+	uint64_t cache_bytes = accounting ? accounting->bytes() : 0;
+	uint64_t native = cache_bytes + hot_cache_bytes() + write_buffer_bytes();
+	memory.report(native);
+
+	if (memory.limit && accounting)
+	{
+		memory.adapt(native + admission.bytes, cache_bytes);
+		accounting->set_limit(memory.cache_limit);
+	}
+}
+
+bool HyperLevelDB::check_open() const
+{
+	if (CS_BUNLIKELY(!db))
+	{
+		raise_err("the database is not open.");
+		return false;
+	}
+	return true;
+}
+
+v8::Handle<v8::Value> HyperLevelDB::refuse(Callback callback)
+{
+	++admission.rejected;
+	ImmediateJob* job = new ImmediateJob(Job::status_would_block, callback);
+	ReadyQueue::instance().push(&job->uv_work, on_immediate);
+	return v8::False();
+}
+
 void HyperLevelDB::init_default_open_options(leveldb::Options& options)
 {
 	options.create_if_missing = true;
 	options.error_if_exists = false;
 	options.compression = leveldb::kSnappyCompression;
 	options.block_cache = NULL;
+	options.comparator = leveldb::BytewiseComparator();
+	options.env = leveldb::Env::Default();
 
 	options.write_buffer_size = 4 << 20;
 	options.block_size = 4 << 10;
@@ -88,10 +473,6 @@ void HyperLevelDB::init_default_open_options(leveldb::Options& options)
 	options.block_restart_interval = 16;
 }
 
-HyperLevelDB::HyperLevelDB(const std::string& directory_)
-	: directory(directory_), db(NULL), cache(NULL)
-{}
-
 void HyperLevelDB::fill_write_options(const v8::Handle<v8::Object>& opts_from, leveldb::WriteOptions& opts_to) const
 {
 	if (opts_from->Has(write_option_sync))
@@ -100,6 +481,75 @@ void HyperLevelDB::fill_write_options(const v8::Handle<v8::Object>& opts_from, l
 	}
 }
 
+bool HyperLevelDB::fill_update(const v8::Handle<v8::Value>& key, const v8::Handle<v8::Value>& op,
+		const v8::Handle<v8::Value>& operand, Update& update) const
+{
+	std::string op_name = jstr2str(op);
+	if (op_name == "add")
+	{
+		update.op = UpdateAdd;
+	}
+	else if (op_name == "addFloat")
+	{
+		update.op = UpdateAddFloat;
+	}
+	else if (op_name == "max")
+	{
+		update.op = UpdateMax;
+	}
+	else if (op_name == "min")
+	{
+		update.op = UpdateMin;
+	}
+	else if (op_name == "append")
+	{
+		update.op = UpdateAppend;
+	}
+	else if (op_name == "or")
+	{
+		update.op = UpdateOr;
+	}
+	else
+	{
+		raise_typeerr("update `op` must be one of `add`, `addFloat`, `max`, `min`, `append` and `or`.");
+		return false;
+	}
+
+	JsBytes key_data(key);
+	if (CS_BUNLIKELY(!key_data.ok()))
+	{
+		return false;
+	}
+	update.key = key_data.str();
+
+	if (update.numeric())
+	{
+		if (CS_BUNLIKELY(!operand->IsNumber()))
+		{
+			raise_typeerr("the operand of a numeric update must be a Number.");
+			return false;
+		}
+		if (update.op == UpdateAddFloat)
+		{
+			update::encode_le(operand->NumberValue(), update.operand);
+		}
+		else
+		{
+			update::encode_le(static_cast<int64_t>(operand->IntegerValue()), update.operand);
+		}
+	}
+	else
+	{
+		JsBytes operand_data(operand);
+		if (CS_BUNLIKELY(!operand_data.ok()))
+		{
+			return false;
+		}
+		update.operand = operand_data.str();
+	}
+	return true;
+}
+
 bool HyperLevelDB::fill_read_options(const v8::Handle<v8::Object>& opts_from, leveldb::ReadOptions& opts_to, bool fill_cache_default) const
 {
 	if (opts_from->Has(read_option_verify_checksums))
@@ -110,6 +560,53 @@ bool HyperLevelDB::fill_read_options(const v8::Handle<v8::Object>& opts_from, le
 	return !(opts_from->Has(read_option_as_buffer) && opts_from->Get(read_option_as_buffer)->IsFalse());
 }
 
+uint64_t HyperLevelDB::fill_deadline(const v8::Handle<v8::Object>& opts_from) const
+{
+	double timeout_ms = -1;
+	if (opts_from->Has(option_timeout_ms))
+	{
+		timeout_ms = opts_from->Get(option_timeout_ms)->NumberValue();
+	}
+	else if (opts_from->Has(option_deadline))
+	{
+		struct timeval now;
+		gettimeofday(&now, NULL);
+		timeout_ms = opts_from->Get(option_deadline)->NumberValue() - (now.tv_sec * 1000.0 + now.tv_usec / 1000.0);
+		timeout_ms = timeout_ms > 0 ? timeout_ms : 0;
+	}
+	if (!(timeout_ms >= 0))		// also NaN.
+	{
+		return 0;
+	}
+	// a deadline already passed still has to be set, 1 ns past now.
+	return uv_hrtime() + (timeout_ms > 0 ? static_cast<uint64_t>(timeout_ms * 1000000) : 1);
+}
+
+Dispatcher::Priority HyperLevelDB::fill_priority(const v8::Handle<v8::Object>& opts_from, Dispatcher::Priority default_priority) const
+{
+	Dispatcher::Priority priority = default_priority;
+	if (opts_from->Has(option_priority))
+	{
+		Dispatcher::parse(*v8::String::Utf8Value(opts_from->Get(option_priority)), priority);
+	}
+	return priority;
+}
+
+void HyperLevelDB::fill_projection(const v8::Handle<v8::Object>& opts_from, const v8::Persistent<v8::String>& offset,
+		const v8::Persistent<v8::String>& length, Projection& projection) const
+{
+	if (opts_from->Has(offset))
+	{
+		int64_t value = opts_from->Get(offset)->ToInteger()->Value();
+		projection.offset = value > 0 ? value : 0;
+	}
+	if (opts_from->Has(length))
+	{
+		int64_t value = opts_from->Get(length)->ToInteger()->Value();
+		projection.length = value > 0 ? value : 0;
+	}
+}
+
 #ifdef __FRANK_FILL_ITER_OPTION_BOOLEAN
 #	error "macro __FRANK_FILL_ITER_OPTION_BOOLEAN already exists!"
 #else
@@ -121,20 +618,28 @@ bool HyperLevelDB::fill_read_options(const v8::Handle<v8::Object>& opts_from, le
 		}																				\
 	}
 
-void HyperLevelDB::fill_iter_options(const v8::Handle<v8::Object>& opts_from, IterOptions& iter_options)
+bool HyperLevelDB::fill_iter_options(const v8::Handle<v8::Object>& opts_from, IterOptions& iter_options)
 {
 	{
 		if (opts_from->Has(iter_option_start))
 		{
-			v8::String::AsciiValue data(opts_from->Get(iter_option_start)->ToString());
-			iter_options.start = std::string(*data, data.length());
+			JsBytes data(opts_from->Get(iter_option_start));
+			if (CS_BUNLIKELY(!data.ok()))
+			{
+				return false;
+			}
+			iter_options.start = data.str();
 		}
 	}
 	{
 		if (opts_from->Has(iter_option_end))
 		{
-			v8::String::AsciiValue data(opts_from->Get(iter_option_end)->ToString());
-			iter_options.end = std::string(*data, data.length());
+			JsBytes data(opts_from->Get(iter_option_end));
+			if (CS_BUNLIKELY(!data.ok()))
+			{
+				return false;
+			}
+			iter_options.end = data.str();
 		}
 	}
 	{
@@ -143,19 +648,44 @@ void HyperLevelDB::fill_iter_options(const v8::Handle<v8::Object>& opts_from, It
 			iter_options.limit = opts_from->Get(iter_option_limit)->ToInteger()->Value();
 		}
 	}
+	{
+		if (opts_from->Has(iter_option_readahead))
+		{
+			int64_t readahead = opts_from->Get(iter_option_readahead)->ToInteger()->Value();
+			iter_options.readahead = readahead > 0 ? readahead : 0;
+		}
+	}
+	{
+		if (opts_from->Has(iter_option_parallelism))
+		{
+			int64_t parallelism = opts_from->Get(iter_option_parallelism)->ToInteger()->Value();
+			iter_options.parallelism = parallelism > 1 ? parallelism : 1;
+		}
+	}
+	{
+		if (opts_from->Has(iter_option_chunk_size))
+		{
+			int64_t chunk_size = opts_from->Get(iter_option_chunk_size)->ToInteger()->Value();
+			iter_options.chunk_size = chunk_size > 1 ? chunk_size : 1;
+		}
+	}
+	fill_projection(opts_from, iter_option_value_offset, iter_option_value_length, iter_options.value_range);
+	iter_options.priority = fill_priority(opts_from, iter_options.priority);
 	__FRANK_FILL_ITER_OPTION_BOOLEAN(opts_from, iter_options, reverse);
+	__FRANK_FILL_ITER_OPTION_BOOLEAN(opts_from, iter_options, ordered);
 	__FRANK_FILL_ITER_OPTION_BOOLEAN(opts_from, iter_options, keys);
 	__FRANK_FILL_ITER_OPTION_BOOLEAN(opts_from, iter_options, values);
 	__FRANK_FILL_ITER_OPTION_BOOLEAN(opts_from, iter_options, key_as_buffer);
 	__FRANK_FILL_ITER_OPTION_BOOLEAN(opts_from, iter_options, value_as_buffer);
+	return true;
 }
 #	undef __FRANK_FILL_ITER_OPTION_BOOLEAN
 #endif
 
-void HyperLevelDB::fill_iter_settings(const v8::Handle<v8::Object>& opts_from, leveldb::ReadOptions& read_options, IterOptions& iter_options)
+bool HyperLevelDB::fill_iter_settings(const v8::Handle<v8::Object>& opts_from, leveldb::ReadOptions& read_options, IterOptions& iter_options)
 {
 	fill_read_options(opts_from, read_options);
-	fill_iter_options(opts_from, iter_options);
+	return fill_iter_options(opts_from, iter_options);
 }
 
 }
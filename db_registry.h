@@ -0,0 +1,176 @@
+#pragma once
+
+#include "./assist.h"
+#include "./read_caches.h"
+#include "./value_codec.h"
+#include "./key_locks.h"
+#include "./envs.h"
+#include <map>
+#include <string>
+#include <vector>
+#include <cstdlib>
+#include <stdint.h>
+#include <uv.h>
+#include <db.h>
+#include <cache.h>
+#include <env.h>
+#include <options.h>
+
+namespace leveldb {
+
+// The databases open in the process, by directory. A handle that opens a directory already open
+// shares what the first one opened: the database, its caches, codec, Env and key locks,
+// and the last one to close it closes it. leveldb locks its directory, a second `DB::Open` of it would fail.
+// A directory is registered as soon as a handle starts opening it, the handles opening it meanwhile wait for that open.
+class DbRegistry
+{
+public:
+	typedef void (*Resume)(void* arg);
+
+	class Shared
+	{
+	public:
+		std::string directory;
+		leveldb::DB* db;
+		leveldb::Options options;		// what the first handle opened it with, the others adopt them.
+		leveldb::Cache* cache;
+		ValueCodec* codec;
+		ThrottledEnv* env;
+		ReadCaches caches;
+		KeyLocks* locks;
+		uint32_t refs;
+		bool open;		// false while the first handle opens it.
+		std::vector<std::pair<Resume, void*> > waiting;		// the handles that opened it meanwhile.
+
+		explicit Shared(const std::string& directory_):
+			directory(directory_), db(NULL), cache(NULL), codec(NULL), env(NULL), locks(NULL), refs(1), open(false)
+		{}
+	};
+
+	enum Claim {Opens, Shares, Waits};
+
+private:
+	typedef std::map<std::string, Shared*> SharedMap;
+
+	uv_mutex_t lock;
+	SharedMap opened_;
+
+	DbRegistry()
+	{
+		uv_mutex_init(&lock);
+	}
+
+	// one key for every path of a directory. One that does not exist yet is resolved through its parent.
+	static std::string canonical(const std::string& directory)
+	{
+		std::string path(directory);
+		while (path.size() > 1 && path[path.size() - 1] == '/')
+		{
+			path.erase(path.size() - 1);
+		}
+		std::string res;
+		char* resolved = realpath(path.c_str(), NULL);
+		if (resolved)
+		{
+			res = resolved;
+		}
+		else
+		{
+			std::string::size_type slash = path.rfind('/');
+			std::string parent = slash == std::string::npos ? std::string(".") : (slash ? path.substr(0, slash) : std::string("/"));
+			resolved = realpath(parent.c_str(), NULL);
+			if (!resolved)
+			{
+				return directory;
+			}
+			res = std::string(resolved) + (resolved[1] ? "/" : "") + path.substr(slash == std::string::npos ? 0 : slash + 1);
+		}
+		std::free(resolved);
+		return res;
+	}
+
+public:
+	static DbRegistry& instance()
+	{
+		static DbRegistry registry;
+		return registry;
+	}
+
+	// what the handle opening `directory` does. `Opens`: nothing is open there, `shared` is registered
+	// for the handle to fill and open, until `opened`. `Shares`: `shared` is what is open there, referenced.
+	// `Waits`: another handle is opening it, `resume(arg)` is called once it is done, to claim it again.
+	Claim claim(const std::string& directory, Shared*& shared, Resume resume, void* arg)
+	{
+		std::string key = canonical(directory);
+		Claim res;
+		uv_mutex_lock(&lock);
+		SharedMap::iterator it = opened_.find(key);
+		if (it == opened_.end())
+		{
+			shared = new Shared(key);
+			opened_.insert(std::make_pair(key, shared));
+			res = Opens;
+		}
+		else if (it->second->open)
+		{
+			shared = it->second;
+			++shared->refs;
+			res = Shares;
+		}
+		else
+		{
+			shared = NULL;
+			it->second->waiting.push_back(std::make_pair(resume, arg));
+			res = Waits;
+		}
+		uv_mutex_unlock(&lock);
+		return res;
+	}
+
+	// the open `shared` was registered for is done: shared from now on if `ok`, dropped otherwise.
+	// The handles that waited for it are resumed either way.
+	void opened(Shared* shared, bool ok)
+	{
+		std::vector<std::pair<Resume, void*> > waiting;
+		uv_mutex_lock(&lock);
+		waiting.swap(shared->waiting);
+		if (ok)
+		{
+			shared->open = true;
+		}
+		else
+		{
+			opened_.erase(shared->directory);
+			delete shared;
+		}
+		uv_mutex_unlock(&lock);
+		for (std::vector<std::pair<Resume, void*> >::iterator it = waiting.begin(); it != waiting.end(); ++it)
+		{
+			it->first(it->second);
+		}
+	}
+
+	// drops a reference to `db`, true if it was the last one (or `db` is not shared) and the caller closes it.
+	bool release(leveldb::DB* db)
+	{
+		bool last = true;
+		uv_mutex_lock(&lock);
+		for (SharedMap::iterator it = opened_.begin(); db && it != opened_.end(); ++it)
+		{
+			if (it->second->open && it->second->db == db)
+			{
+				last = --it->second->refs == 0;
+				if (last)
+				{
+					delete it->second;
+					opened_.erase(it);
+				}
+				break;
+			}
+		}
+		uv_mutex_unlock(&lock);
+		return last;
+	}
+};
+
+}
@@ -0,0 +1,355 @@
+#pragma once
+
+#include "./assist.h"
+#include <deque>
+#include <map>
+#include <string>
+#include <vector>
+#include <cstdlib>
+#include <stdint.h>
+#include <uv.h>
+#include <v8.h>
+
+namespace leveldb {
+
+// Sits in front of the threadpool: jobs are queued per priority class and handed to libuv
+// a few at a time, so that a burst of bulk work queues here rather than ahead of every `get` in the pool.
+// Classes share the slots by weighted fair queuing (stride scheduling, one job is one unit of work),
+// and a job that waited past `aging` is served before the others, oldest first, so bulk work can't starve.
+// One slot is kept for interactive jobs, and bulk jobs take at most half of them.
+// Jobs are counted by the database they work on, so that closing it waits for them.
+// Lives on the event loop only.
+class Dispatcher
+{
+public:
+	enum Priority {Interactive, Normal, Bulk, PriorityCount};
+
+	class ClassStats
+	{
+	public:
+		uint64_t queued, running;
+		uint64_t dispatched, aged;
+		uint64_t waited_ns, max_wait_ns;		// time spent queued here, by the jobs dispatched.
+
+		ClassStats(): queued(0), running(0), dispatched(0), aged(0), waited_ns(0), max_wait_ns(0) {}
+	};
+
+private:
+	static const uint64_t stride_unit = 1 << 20;
+
+	class Entry
+	{
+	public:
+		uv_work_t uv_work;
+		uv_work_t* inner;
+		uv_work_cb execute;
+		uv_after_work_cb after;
+		Priority priority;
+		const void* owner;		// the database worked on, NULL if none is open yet.
+		uint64_t queued_at;
+
+		Entry(uv_work_t* inner_, uv_work_cb execute_, uv_after_work_cb after_, Priority priority_, const void* owner_):
+			inner(inner_), execute(execute_), after(after_), priority(priority_), owner(owner_), queued_at(uv_hrtime())
+		{
+			uv_work.data = this;
+		}
+	};
+
+	typedef std::deque<Entry*> EntryQueue;
+	typedef std::map<const void*, size_t> OwnerMap;
+
+	EntryQueue queues[PriorityCount];
+	ClassStats stats_[PriorityCount];
+	uint64_t pass[PriorityCount], weights[PriorityCount];
+	uint64_t virtual_time;
+
+	// the jobs queued or running, by owner.
+	OwnerMap owned;
+
+	// jobs that wait for every job of their owner to be done (closing a database), queued as normal jobs then.
+	std::vector<Entry*> barriers;
+
+	size_t slots, running;
+	uint64_t aging_ns;
+
+	Dispatcher(): virtual_time(0), running(0), aging_ns(500 * 1000000ULL)
+	{
+		const char* pool_size = std::getenv("UV_THREADPOOL_SIZE");
+		slots = pool_size && std::atoi(pool_size) > 0 ? std::atoi(pool_size) : 4;
+		weights[Interactive] = 16;
+		weights[Normal] = 4;
+		weights[Bulk] = 1;
+		for (int i = 0; i < PriorityCount; ++i)
+		{
+			pass[i] = 0;
+		}
+	}
+
+	// the slots a class may hold at once.
+	size_t share(Priority priority) const
+	{
+		if (priority == Interactive || slots < 2)
+		{
+			return slots;
+		}
+		return priority == Bulk ? (slots / 2 > 0 ? slots / 2 : 1) : slots - 1;
+	}
+
+	bool eligible(Priority priority) const
+	{
+		if (queues[priority].empty())
+		{
+			return false;
+		}
+		if (priority == Interactive)
+		{
+			return true;
+		}
+		// normal and bulk jobs together leave the last slot free.
+		size_t others = stats_[Normal].running + stats_[Bulk].running;
+		return others < share(Normal) && stats_[priority].running < share(priority);
+	}
+
+	// PriorityCount if none may start.
+	Priority pick(uint64_t now, bool* aged) const
+	{
+		Priority oldest = PriorityCount, fairest = PriorityCount;
+		for (int i = 0; i < PriorityCount; ++i)
+		{
+			Priority priority = static_cast<Priority>(i);
+			if (!eligible(priority))
+			{
+				continue;
+			}
+			const Entry* head = queues[i].front();
+			if (now - head->queued_at > aging_ns && (oldest == PriorityCount || head->queued_at < queues[oldest].front()->queued_at))
+			{
+				oldest = priority;
+			}
+			if (fairest == PriorityCount || pass[i] < pass[fairest])
+			{
+				fairest = priority;
+			}
+		}
+		*aged = oldest != PriorityCount && oldest != fairest;
+		return oldest != PriorityCount ? oldest : fairest;
+	}
+
+	void push(Entry* entry)
+	{
+		EntryQueue& queue = queues[entry->priority];
+		if (queue.empty())
+		{
+			// an idle class starts from the current virtual time rather than the credit it did not use.
+			pass[entry->priority] = pass[entry->priority] > virtual_time ? pass[entry->priority] : virtual_time;
+		}
+		queue.push_back(entry);
+		++stats_[entry->priority].queued;
+		if (entry->owner)
+		{
+			++owned[entry->owner];
+		}
+	}
+
+	void pump()
+	{
+		release_barriers();
+		const uint64_t now = uv_hrtime();
+		while (running < slots)
+		{
+			bool aged = false;
+			Priority priority = pick(now, &aged);
+			if (priority == PriorityCount)
+			{
+				break;
+			}
+			Entry* entry = queues[priority].front();
+			queues[priority].pop_front();
+
+			virtual_time = pass[priority];
+			pass[priority] += stride_unit / weights[priority];
+
+			ClassStats& stats = stats_[priority];
+			uint64_t waited = now - entry->queued_at;
+			--stats.queued;
+			++stats.running;
+			++stats.dispatched;
+			stats.aged += aged;
+			stats.waited_ns += waited;
+			stats.max_wait_ns = waited > stats.max_wait_ns ? waited : stats.max_wait_ns;
+			++running;
+			uv_queue_work(uv_default_loop(), &entry->uv_work, on_execute, on_after);
+		}
+	}
+
+	void release_barriers()
+	{
+		if (barriers.empty())
+		{
+			return;
+		}
+		std::vector<Entry*> waiting;
+		for (std::vector<Entry*>::iterator it = barriers.begin(); it != barriers.end(); ++it)
+		{
+			if (owned.count((*it)->owner))
+			{
+				waiting.push_back(*it);
+			}
+			else
+			{
+				// nothing left to wait for, the owner is gone once it runs.
+				(*it)->owner = NULL;
+				(*it)->queued_at = uv_hrtime();
+				push(*it);
+			}
+		}
+		barriers.swap(waiting);
+	}
+
+	static void on_execute(uv_work_t* uv_work)
+	{
+		Entry* entry = static_cast<Entry*>(uv_work->data);
+		entry->execute(entry->inner);
+	}
+
+	static void on_after(uv_work_t* uv_work, int uv_status)
+	{
+		Entry* entry = static_cast<Entry*>(uv_work->data);
+		Dispatcher& self = instance();
+		--self.running;
+		--self.stats_[entry->priority].running;
+		if (entry->owner && --self.owned[entry->owner] == 0)
+		{
+			self.owned.erase(entry->owner);
+		}
+		// the callback may queue again, the freed slot goes through `pump` either way.
+		entry->after(entry->inner, uv_status);
+		delete entry;
+		self.pump();
+	}
+
+public:
+	static Dispatcher& instance()
+	{
+		static Dispatcher dispatcher;
+		return dispatcher;
+	}
+
+	// `priority` unchanged unless `name` is one of `interactive`, `normal` and `bulk`.
+	static bool parse(const std::string& name, Priority& priority)
+	{
+		static const char* const names[PriorityCount] = {"interactive", "normal", "bulk"};
+		for (int i = 0; i < PriorityCount; ++i)
+		{
+			if (name == names[i])
+			{
+				priority = static_cast<Priority>(i);
+				return true;
+			}
+		}
+		return false;
+	}
+
+	// in place of `uv_queue_work(uv_default_loop(), uv_work, execute, after)`, for a job working on `owner`.
+	void queue(uv_work_t* uv_work, uv_work_cb execute, uv_after_work_cb after, Priority priority, const void* owner)
+	{
+		push(new Entry(uv_work, execute, after, priority, owner));
+		pump();
+	}
+
+	// keeps the barriers of `owner` waiting, for a job between two runs that is not queued here meanwhile.
+	void hold(const void* owner)
+	{
+		++owned[owner];
+	}
+
+	void release(const void* owner)
+	{
+		if (--owned[owner] == 0)
+		{
+			owned.erase(owner);
+		}
+		pump();
+	}
+
+	// queued once no job of `owner` is queued or running any more, for what frees what they use.
+	void queue_barrier(uv_work_t* uv_work, uv_work_cb execute, uv_after_work_cb after, const void* owner)
+	{
+		barriers.push_back(new Entry(uv_work, execute, after, Normal, owner));
+		pump();
+	}
+
+	void configure(size_t slots_, const uint64_t* weights_, uint64_t aging_ms)
+	{
+		if (slots_ > 0)
+		{
+			slots = slots_;
+		}
+		for (int i = 0; weights_ && i < PriorityCount; ++i)
+		{
+			if (weights_[i] > 0)
+			{
+				weights[i] = weights_[i] < stride_unit ? weights_[i] : stride_unit;
+			}
+		}
+		if (aging_ms > 0)
+		{
+			aging_ns = aging_ms * 1000000;
+		}
+		pump();
+	}
+
+	// `scheduler({slots, weights: {interactive, normal, bulk}, agingMs})` sets what is given,
+	// and returns the settings with the stats of each class.
+	static v8::Handle<v8::Value> js_scheduler(const v8::Arguments& args)
+	{
+		v8::HandleScope scope;
+		static const char* const names[PriorityCount] = {"interactive", "normal", "bulk"};
+		Dispatcher& self = instance();
+
+		if (args.Length() > 0 && args[0]->IsObject())
+		{
+			v8::Local<v8::Object> opts_from = args[0]->ToObject();
+			int64_t slots_ = opts_from->Get(v8::String::NewSymbol("slots"))->IntegerValue();
+			int64_t aging_ms = opts_from->Get(v8::String::NewSymbol("agingMs"))->IntegerValue();
+			uint64_t weights_[PriorityCount] = {0, 0, 0};
+			v8::Local<v8::Value> weights_from = opts_from->Get(v8::String::NewSymbol("weights"));
+			if (weights_from->IsObject())
+			{
+				for (int i = 0; i < PriorityCount; ++i)
+				{
+					int64_t weight = weights_from->ToObject()->Get(v8::String::NewSymbol(names[i]))->IntegerValue();
+					weights_[i] = weight > 0 ? weight : 0;
+				}
+			}
+			self.configure(slots_ > 0 ? slots_ : 0, weights_, aging_ms > 0 ? aging_ms : 0);
+		}
+
+		v8::Local<v8::Object> res = v8::Object::New();
+		res->Set(v8::String::NewSymbol("slots"), v8::Number::New(self.slots));
+		res->Set(v8::String::NewSymbol("running"), v8::Number::New(self.running));
+		res->Set(v8::String::NewSymbol("agingMs"), v8::Number::New(self.aging_ns / 1000000));
+		for (int i = 0; i < PriorityCount; ++i)
+		{
+			const ClassStats& stats = self.stats_[i];
+			v8::Local<v8::Object> klass = v8::Object::New();
+			klass->Set(v8::String::NewSymbol("weight"), v8::Number::New(self.weights[i]));
+			klass->Set(v8::String::NewSymbol("queued"), v8::Number::New(stats.queued));
+			klass->Set(v8::String::NewSymbol("running"), v8::Number::New(stats.running));
+			klass->Set(v8::String::NewSymbol("dispatched"), v8::Number::New(stats.dispatched));
+			klass->Set(v8::String::NewSymbol("aged"), v8::Number::New(stats.aged));
+			klass->Set(v8::String::NewSymbol("meanWaitMs"),
+					v8::Number::New(stats.dispatched ? stats.waited_ns / 1e6 / stats.dispatched : 0));
+			klass->Set(v8::String::NewSymbol("maxWaitMs"), v8::Number::New(stats.max_wait_ns / 1e6));
+			res->Set(v8::String::NewSymbol(names[i]), klass);
+		}
+		return scope.Close(res);
+	}
+
+	static void init(v8::Handle<v8::Object> exports)
+	{
+		exports->Set(v8::String::NewSymbol("scheduler"), v8::FunctionTemplate::New(js_scheduler)->GetFunction());
+	}
+};
+
+}
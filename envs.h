@@ -0,0 +1,872 @@
+#pragma once
+
+#include "./assist.h"
+#include <string>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <uv.h>
+#include <env.h>
+#include <iterator.h>
+#include <slice.h>
+#include <status.h>
+
+namespace leveldb {
+
+// Envs a database is opened with, wrapping the Env it would use otherwise (the shared one, or the default).
+namespace envs {
+
+// Whether the calling thread runs the background work of leveldb (flushes and compactions).
+// Threads are marked when the Env starts them, everything else is foreground.
+class ThreadRole
+{
+public:
+	static bool& background()
+	{
+		static __thread bool role = false;
+		return role;
+	}
+};
+
+// Marks the thread running `function` as a background one, for `Schedule` and `StartThread`.
+class BackgroundCall
+{
+public:
+	void (*function)(void* arg);
+	void* arg;
+
+	BackgroundCall(void (*function_)(void* arg), void* arg_):
+		function(function_), arg(arg_)
+	{}
+
+	static void run(void* call)
+	{
+		BackgroundCall* self = reinterpret_cast<BackgroundCall*>(call);
+		void (*function)(void* arg) = self->function;
+		void* arg = self->arg;
+		delete self;
+		ThreadRole::background() = true;
+		function(arg);
+	}
+};
+
+// How far ahead of a table read the calling thread wants the kernel to read, set by iterators opened with `readahead`.
+class Readahead
+{
+public:
+	static size_t& size()
+	{
+		static __thread size_t bytes = 0;
+		return bytes;
+	}
+};
+
+// Sets the readahead of the thread for its lifetime.
+class ReadaheadScope
+{
+private:
+	const size_t saved;
+
+public:
+	explicit ReadaheadScope(size_t bytes):
+		saved(Readahead::size())
+	{
+		Readahead::size() = bytes;
+	}
+
+	~ReadaheadScope()
+	{
+		Readahead::size() = saved;
+	}
+};
+
+// Moves the iterator it wraps with the readahead on, so the table files it reads are hinted.
+class ReadaheadIterator: public leveldb::Iterator
+{
+private:
+	leveldb::Iterator* const base;
+	const size_t bytes;
+
+public:
+	// takes the ownership of `base_`.
+	ReadaheadIterator(leveldb::Iterator* base_, size_t bytes_):
+		base(base_), bytes(bytes_)
+	{}
+
+	virtual ~ReadaheadIterator()
+	{
+		delete base;
+	}
+
+	virtual bool Valid() const
+	{
+		return base->Valid();
+	}
+
+	virtual void SeekToFirst()
+	{
+		ReadaheadScope scope(bytes);
+		base->SeekToFirst();
+	}
+
+	virtual void SeekToLast()
+	{
+		ReadaheadScope scope(bytes);
+		base->SeekToLast();
+	}
+
+	virtual void Seek(const leveldb::Slice& target)
+	{
+		ReadaheadScope scope(bytes);
+		base->Seek(target);
+	}
+
+	virtual void Next()
+	{
+		ReadaheadScope scope(bytes);
+		base->Next();
+	}
+
+	virtual void Prev()
+	{
+		ReadaheadScope scope(bytes);
+		base->Prev();
+	}
+
+	virtual leveldb::Slice key() const
+	{
+		return base->key();
+	}
+
+	virtual leveldb::Slice value() const
+	{
+		return base->value();
+	}
+
+	virtual leveldb::Status status() const
+	{
+		return base->status();
+	}
+
+	// wraps `it` unless `bytes` is 0.
+	static leveldb::Iterator* wrap(leveldb::Iterator* it, size_t bytes)
+	{
+		return bytes ? new ReadaheadIterator(it, bytes) : it;
+	}
+};
+
+CS_FORCE_INLINE static bool ends_with(const std::string& name, const char* suffix, size_t suffix_size)
+{
+	return name.size() >= suffix_size && name.compare(name.size() - suffix_size, suffix_size, suffix) == 0;
+}
+
+// table files are written only by flushes and compactions.
+CS_FORCE_INLINE static bool is_table_file(const std::string& name)
+{
+	return ends_with(name, ".sst", 4) || ends_with(name, ".ldb", 4);
+}
+
+// the BLOB-<number> files of a value log.
+CS_FORCE_INLINE static bool is_blob_file(const std::string& name)
+{
+	std::string::size_type slash = name.rfind('/');
+	return name.compare(slash == std::string::npos ? 0 : slash + 1, 5, "BLOB-") == 0;
+}
+
+}
+
+// Token bucket of bytes per second. Writers take tokens and may run into debt,
+// then sleep until it is repaid, so a large write is throttled as a whole rather than refused.
+class RateLimiter
+{
+private:
+	// the bucket holds at most this long of the rate, so an idle limiter lets a short burst through.
+	static const uint64_t burst_us = 100000;
+
+	mutable uv_mutex_t lock;
+	uint64_t rate;			// bytes per second, 0 means unlimited.
+	double tokens;
+	uint64_t refilled_at;	// micros.
+
+public:
+	uint64_t throttled_bytes;	// written while limited.
+	uint64_t throttled_us;		// slept to honor the rate.
+
+	explicit RateLimiter(uint64_t rate_):
+		rate(rate_), tokens(0), refilled_at(0), throttled_bytes(0), throttled_us(0)
+	{
+		uv_mutex_init(&lock);
+	}
+
+	~RateLimiter()
+	{
+		uv_mutex_destroy(&lock);
+	}
+
+	uint64_t get_rate() const
+	{
+		uv_mutex_lock(&lock);
+		uint64_t res = rate;
+		uv_mutex_unlock(&lock);
+		return res;
+	}
+
+	void set_rate(uint64_t rate_)
+	{
+		uv_mutex_lock(&lock);
+		// the tokens are kept, the next `take` caps them to the burst of the new rate.
+		rate = rate_;
+		uv_mutex_unlock(&lock);
+	}
+
+	// how long the caller has to sleep before writing `bytes`, having taken the tokens for them.
+	uint64_t take(size_t bytes, uint64_t now_us)
+	{
+		uv_mutex_lock(&lock);
+		if (!rate)
+		{
+			uv_mutex_unlock(&lock);
+			return 0;
+		}
+		if (refilled_at && now_us > refilled_at)
+		{
+			double cap = static_cast<double>(rate) * burst_us / 1000000;
+			tokens += static_cast<double>(rate) * (now_us - refilled_at) / 1000000;
+			tokens = tokens > cap ? cap : tokens;
+		}
+		refilled_at = now_us;
+		tokens -= bytes;
+		uint64_t wait_us = tokens < 0 ? static_cast<uint64_t>(-tokens * 1000000 / rate) : 0;
+		throttled_bytes += bytes;
+		throttled_us += wait_us;
+		uv_mutex_unlock(&lock);
+		return wait_us;
+	}
+};
+
+// How table files are read: as the wrapped Env does, with pread, or mapped.
+// Mapped files keep no descriptor open, so the table cache can hold more of them than the process may open.
+class TableReadEnv: public leveldb::EnvWrapper
+{
+public:
+	enum Mode {ModeDefault, ModePread, ModeMmap};
+
+private:
+	class PreadFile: public leveldb::RandomAccessFile
+	{
+	private:
+		const std::string fname;
+		const int fd;
+		mutable volatile uint64_t advised_until;
+
+	public:
+		PreadFile(const std::string& fname_, int fd_):
+			fname(fname_), fd(fd_), advised_until(0)
+		{}
+
+		virtual ~PreadFile()
+		{
+			close(fd);
+		}
+
+		virtual leveldb::Status Read(uint64_t offset, size_t n, leveldb::Slice* result, char* scratch) const
+		{
+			size_t readahead = envs::Readahead::size();
+			if (readahead && offset + n > advised_until)
+			{
+				advised_until = offset + readahead;
+#ifdef POSIX_FADV_WILLNEED
+				posix_fadvise(fd, offset, readahead, POSIX_FADV_WILLNEED);
+#endif
+			}
+			ssize_t r = pread(fd, scratch, n, static_cast<off_t>(offset));
+			*result = leveldb::Slice(scratch, r < 0 ? 0 : r);
+			return r < 0 ? leveldb::Status::IOError(fname, "pread failed") : leveldb::Status::OK();
+		}
+	};
+
+	class MappedFile: public leveldb::RandomAccessFile
+	{
+	private:
+		const std::string fname;
+		char* const base;
+		const size_t size;
+		TableReadEnv* const env;
+		mutable volatile uint64_t advised_until;
+
+	public:
+		MappedFile(const std::string& fname_, void* base_, size_t size_, TableReadEnv* env_):
+			fname(fname_), base(reinterpret_cast<char*>(base_)), size(size_), env(env_), advised_until(0)
+		{}
+
+		virtual ~MappedFile()
+		{
+			munmap(base, size);
+			__sync_fetch_and_sub(&env->mapped, size);
+		}
+
+		virtual leveldb::Status Read(uint64_t offset, size_t n, leveldb::Slice* result, char* scratch) const
+		{
+			if (CS_BUNLIKELY(offset > size))
+			{
+				*result = leveldb::Slice();
+				return leveldb::Status::IOError(fname, "read past the end of the file");
+			}
+			n = n > size - offset ? size - offset : n;
+			size_t readahead = envs::Readahead::size();
+			if (readahead && offset + n > advised_until)
+			{
+				advised_until = offset + readahead;
+				static const uint64_t page_mask = 4095;
+				uint64_t from = offset & ~page_mask;
+				uint64_t to = offset + readahead > size ? size : offset + readahead;
+				madvise(base + from, to - from, MADV_WILLNEED);
+			}
+			*result = leveldb::Slice(base + offset, n);
+			return leveldb::Status::OK();
+		}
+	};
+
+	const Mode mode;
+	const uint64_t mmap_limit;		// bytes mapped at most, tables past it are read with pread.
+
+	leveldb::Status open_table(const std::string& fname, leveldb::RandomAccessFile** result)
+	{
+		int fd = open(fname.c_str(), O_RDONLY);
+		if (fd < 0)
+		{
+			return leveldb::Status::IOError(fname, "failed to open");
+		}
+		if (mode == ModeMmap)
+		{
+			struct stat st;
+			// the size is added only if the stat worked, and given back if it went past the limit.
+			bool added = fstat(fd, &st) == 0 && st.st_size > 0;
+			if (added && __sync_add_and_fetch(&mapped, st.st_size) <= mmap_limit)
+			{
+				void* base = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+				close(fd);
+				if (base == MAP_FAILED)
+				{
+					__sync_fetch_and_sub(&mapped, st.st_size);
+					return leveldb::Status::IOError(fname, "failed to map");
+				}
+				*result = new MappedFile(fname, base, st.st_size, this);
+				return leveldb::Status::OK();
+			}
+			if (added)
+			{
+				__sync_fetch_and_sub(&mapped, st.st_size);
+			}
+		}
+		*result = new PreadFile(fname, fd);
+		return leveldb::Status::OK();
+	}
+
+public:
+	volatile uint64_t mapped;
+
+	TableReadEnv(leveldb::Env* base, Mode mode_, uint64_t mmap_limit_):
+		leveldb::EnvWrapper(base), mode(mode_), mmap_limit(mmap_limit_), mapped(0)
+	{}
+
+	virtual ~TableReadEnv() {}
+
+	virtual leveldb::Status NewRandomAccessFile(const std::string& fname, leveldb::RandomAccessFile** result)
+	{
+		// value log files grow while they are read, a mapping would stop at the size they had when opened.
+		if (envs::is_blob_file(fname))
+		{
+			int fd = open(fname.c_str(), O_RDONLY);
+			if (fd < 0)
+			{
+				return leveldb::Status::IOError(fname, "failed to open");
+			}
+			*result = new PreadFile(fname, fd);
+			return leveldb::Status::OK();
+		}
+		if (mode == ModeDefault || !envs::is_table_file(fname))
+		{
+			return target()->NewRandomAccessFile(fname, result);
+		}
+		return open_table(fname, result);
+	}
+};
+
+// Counts the I/O of the files it opens, by file class and by the role of the calling thread.
+class AccountingEnv: public leveldb::EnvWrapper
+{
+public:
+	enum FileClass {FileLog, FileTable, FileManifest, FileBlob, FileOther, FileClassCount};
+	enum Role {RoleForeground, RoleBackground, RoleCount};
+
+	class Counters
+	{
+	public:
+		volatile uint64_t read_ops, read_bytes, read_ns;
+		volatile uint64_t write_ops, write_bytes, write_ns;
+		volatile uint64_t syncs, sync_ns;
+
+		Counters():
+			read_ops(0), read_bytes(0), read_ns(0), write_ops(0), write_bytes(0), write_ns(0), syncs(0), sync_ns(0)
+		{}
+	};
+
+private:
+	Counters counters[FileClassCount][RoleCount];
+
+	CS_FORCE_INLINE Counters& of(FileClass file_class)
+	{
+		return counters[file_class][envs::ThreadRole::background() ? RoleBackground : RoleForeground];
+	}
+
+	CS_FORCE_INLINE void count_read(FileClass file_class, size_t bytes, uint64_t begin)
+	{
+		Counters& c = of(file_class);
+		__sync_fetch_and_add(&c.read_ops, 1);
+		__sync_fetch_and_add(&c.read_bytes, bytes);
+		__sync_fetch_and_add(&c.read_ns, uv_hrtime() - begin);
+	}
+
+	CS_FORCE_INLINE void count_write(FileClass file_class, size_t bytes, uint64_t begin)
+	{
+		Counters& c = of(file_class);
+		__sync_fetch_and_add(&c.write_ops, 1);
+		__sync_fetch_and_add(&c.write_bytes, bytes);
+		__sync_fetch_and_add(&c.write_ns, uv_hrtime() - begin);
+	}
+
+	CS_FORCE_INLINE void count_sync(FileClass file_class, uint64_t begin)
+	{
+		Counters& c = of(file_class);
+		__sync_fetch_and_add(&c.syncs, 1);
+		__sync_fetch_and_add(&c.sync_ns, uv_hrtime() - begin);
+	}
+
+	class CountedSequentialFile: public leveldb::SequentialFile
+	{
+	private:
+		leveldb::SequentialFile* const base;
+		AccountingEnv* const env;
+		const FileClass file_class;
+
+	public:
+		CountedSequentialFile(leveldb::SequentialFile* base_, AccountingEnv* env_, FileClass file_class_):
+			base(base_), env(env_), file_class(file_class_)
+		{}
+
+		virtual ~CountedSequentialFile()
+		{
+			delete base;
+		}
+
+		virtual leveldb::Status Read(size_t n, leveldb::Slice* result, char* scratch)
+		{
+			uint64_t begin = uv_hrtime();
+			leveldb::Status status = base->Read(n, result, scratch);
+			env->count_read(file_class, status.ok() ? result->size() : 0, begin);
+			return status;
+		}
+
+		virtual leveldb::Status Skip(uint64_t n)
+		{
+			return base->Skip(n);
+		}
+	};
+
+	class CountedRandomAccessFile: public leveldb::RandomAccessFile
+	{
+	private:
+		leveldb::RandomAccessFile* const base;
+		AccountingEnv* const env;
+		const FileClass file_class;
+
+	public:
+		CountedRandomAccessFile(leveldb::RandomAccessFile* base_, AccountingEnv* env_, FileClass file_class_):
+			base(base_), env(env_), file_class(file_class_)
+		{}
+
+		virtual ~CountedRandomAccessFile()
+		{
+			delete base;
+		}
+
+		virtual leveldb::Status Read(uint64_t offset, size_t n, leveldb::Slice* result, char* scratch) const
+		{
+			uint64_t begin = uv_hrtime();
+			leveldb::Status status = base->Read(offset, n, result, scratch);
+			env->count_read(file_class, status.ok() ? result->size() : 0, begin);
+			return status;
+		}
+	};
+
+	// `File` is `WritableFile` or `ConcurrentWritableFile`, the latter also counts `WriteAt`.
+	template<typename File>
+	class CountedWritableFileBase: public File
+	{
+	protected:
+		File* const base;
+		AccountingEnv* const env;
+		const FileClass file_class;
+
+	public:
+		CountedWritableFileBase(File* base_, AccountingEnv* env_, FileClass file_class_):
+			base(base_), env(env_), file_class(file_class_)
+		{}
+
+		virtual ~CountedWritableFileBase()
+		{
+			delete base;
+		}
+
+		virtual leveldb::Status Append(const leveldb::Slice& data)
+		{
+			uint64_t begin = uv_hrtime();
+			leveldb::Status status = base->Append(data);
+			env->count_write(file_class, data.size(), begin);
+			return status;
+		}
+
+		virtual leveldb::Status Close()
+		{
+			return base->Close();
+		}
+
+		virtual leveldb::Status Flush()
+		{
+			return base->Flush();
+		}
+
+		virtual leveldb::Status Sync()
+		{
+			uint64_t begin = uv_hrtime();
+			leveldb::Status status = base->Sync();
+			env->count_sync(file_class, begin);
+			return status;
+		}
+	};
+
+	typedef CountedWritableFileBase<leveldb::WritableFile> CountedWritableFile;
+
+	class CountedConcurrentWritableFile: public CountedWritableFileBase<leveldb::ConcurrentWritableFile>
+	{
+	public:
+		CountedConcurrentWritableFile(leveldb::ConcurrentWritableFile* base_, AccountingEnv* env_, FileClass file_class_):
+			CountedWritableFileBase<leveldb::ConcurrentWritableFile>(base_, env_, file_class_)
+		{}
+
+		virtual leveldb::Status WriteAt(uint64_t offset, const leveldb::Slice& data)
+		{
+			uint64_t begin = uv_hrtime();
+			leveldb::Status status = base->WriteAt(offset, data);
+			env->count_write(file_class, data.size(), begin);
+			return status;
+		}
+	};
+
+public:
+	static FileClass classify(const std::string& fname)
+	{
+		if (envs::is_table_file(fname))
+		{
+			return FileTable;
+		}
+		if (envs::ends_with(fname, ".log", 4))
+		{
+			return FileLog;
+		}
+		std::string::size_type slash = fname.rfind('/');
+		if (fname.compare(slash == std::string::npos ? 0 : slash + 1, 9, "MANIFEST-") == 0)
+		{
+			return FileManifest;
+		}
+		if (envs::is_blob_file(fname))
+		{
+			return FileBlob;
+		}
+		return FileOther;
+	}
+
+	explicit AccountingEnv(leveldb::Env* base):
+		leveldb::EnvWrapper(base)
+	{}
+
+	virtual ~AccountingEnv() {}
+
+	const Counters& stats(FileClass file_class, Role role) const
+	{
+		return counters[file_class][role];
+	}
+
+	virtual leveldb::Status NewSequentialFile(const std::string& fname, leveldb::SequentialFile** result)
+	{
+		leveldb::Status status = target()->NewSequentialFile(fname, result);
+		if (status.ok())
+		{
+			*result = new CountedSequentialFile(*result, this, classify(fname));
+		}
+		return status;
+	}
+
+	virtual leveldb::Status NewRandomAccessFile(const std::string& fname, leveldb::RandomAccessFile** result)
+	{
+		leveldb::Status status = target()->NewRandomAccessFile(fname, result);
+		if (status.ok())
+		{
+			*result = new CountedRandomAccessFile(*result, this, classify(fname));
+		}
+		return status;
+	}
+
+	virtual leveldb::Status NewWritableFile(const std::string& fname, leveldb::WritableFile** result)
+	{
+		leveldb::Status status = target()->NewWritableFile(fname, result);
+		if (status.ok())
+		{
+			*result = new CountedWritableFile(*result, this, classify(fname));
+		}
+		return status;
+	}
+
+	virtual leveldb::Status NewConcurrentWritableFile(const std::string& fname, leveldb::ConcurrentWritableFile** result)
+	{
+		leveldb::Status status = target()->NewConcurrentWritableFile(fname, result);
+		if (status.ok())
+		{
+			*result = new CountedConcurrentWritableFile(*result, this, classify(fname));
+		}
+		return status;
+	}
+};
+
+// Throttles what flushes and compactions write to table files, so that the foreground reads get the disk,
+// and accounts for all the I/O of the database.
+// With a latency target, the rate follows the latency foreground reads of table files see:
+// down by a quarter while above the target, back up by an eighth while under half of it,
+// never above the configured rate and never below 1/64 of it.
+class ThrottledEnv: public leveldb::EnvWrapper
+{
+private:
+	class ThrottledFile: public leveldb::WritableFile
+	{
+	private:
+		leveldb::WritableFile* const base;
+		ThrottledEnv* const env;
+
+	public:
+		ThrottledFile(leveldb::WritableFile* base_, ThrottledEnv* env_):
+			base(base_), env(env_)
+		{}
+
+		virtual ~ThrottledFile()
+		{
+			delete base;
+		}
+
+		virtual leveldb::Status Append(const leveldb::Slice& data)
+		{
+			env->throttle(data.size());
+			return base->Append(data);
+		}
+
+		virtual leveldb::Status Close()
+		{
+			return base->Close();
+		}
+
+		virtual leveldb::Status Flush()
+		{
+			return base->Flush();
+		}
+
+		virtual leveldb::Status Sync()
+		{
+			return base->Sync();
+		}
+	};
+
+	class TimedFile: public leveldb::RandomAccessFile
+	{
+	private:
+		leveldb::RandomAccessFile* const base;
+		ThrottledEnv* const env;
+
+	public:
+		TimedFile(leveldb::RandomAccessFile* base_, ThrottledEnv* env_):
+			base(base_), env(env_)
+		{}
+
+		virtual ~TimedFile()
+		{
+			delete base;
+		}
+
+		virtual leveldb::Status Read(uint64_t offset, size_t n, leveldb::Slice* result, char* scratch) const
+		{
+			if (envs::ThreadRole::background() || !env->latency_target_us)
+			{
+				return base->Read(offset, n, result, scratch);
+			}
+			uint64_t begin = uv_hrtime();
+			leveldb::Status status = base->Read(offset, n, result, scratch);
+			env->sample_latency((uv_hrtime() - begin) / 1000);
+			return status;
+		}
+	};
+
+	static const uint64_t tune_interval_us = 100000;
+
+	// the env this one wraps, below the throttling so that it counts the I/O that really happens.
+	// It wraps `table_reads` in turn.
+	TableReadEnv table_reads;
+	AccountingEnv accounting;
+
+	RateLimiter limiter;
+	mutable uv_mutex_t tuning;		// of `ceiling`, and of the rate while it is tuned.
+	uint64_t ceiling;		// the configured rate.
+
+	volatile uint64_t latency_ewma_us;	// of foreground table reads, fixed point with 4 fraction bits.
+	volatile uint64_t tuned_at;
+
+	void sample_latency(uint64_t latency_us)
+	{
+		// racy by design: a lost sample does not matter to a moving average.
+		uint64_t ewma = latency_ewma_us;
+		latency_ewma_us = ewma - (ewma >> 3) + ((latency_us << 4) >> 3);
+	}
+
+	void tune(uint64_t now_us)
+	{
+		uint64_t last = tuned_at;
+		if (now_us < last + tune_interval_us || !__sync_bool_compare_and_swap(&tuned_at, last, now_us))
+		{
+			return;
+		}
+		uv_mutex_lock(&tuning);
+		if (!ceiling)
+		{
+			uv_mutex_unlock(&tuning);
+			return;
+		}
+		uint64_t rate = limiter.get_rate(), latency_us = latency_ewma_us >> 4;
+		uint64_t floor = ceiling / 64 ? ceiling / 64 : 1;
+		if (latency_us > latency_target_us)
+		{
+			rate -= rate / 4;
+		}
+		else if (latency_us < latency_target_us / 2)
+		{
+			rate += rate / 8 ? rate / 8 : 1;
+		}
+		limiter.set_rate(rate < floor ? floor : (rate > ceiling ? ceiling : rate));
+		uv_mutex_unlock(&tuning);
+	}
+
+	void throttle(size_t bytes)
+	{
+		uint64_t now_us = target()->NowMicros();
+		if (latency_target_us)
+		{
+			tune(now_us);
+		}
+		uint64_t wait_us = limiter.take(bytes, now_us);
+		if (wait_us)
+		{
+			target()->SleepForMicroseconds(static_cast<int>(wait_us));
+		}
+	}
+
+public:
+	volatile uint64_t latency_target_us;	// 0 disables tuning.
+
+	ThrottledEnv(leveldb::Env* base, uint64_t rate, uint64_t latency_target_us_,
+			TableReadEnv::Mode table_read_mode = TableReadEnv::ModeDefault, uint64_t mmap_limit = 0):
+		leveldb::EnvWrapper(&accounting), table_reads(base, table_read_mode, mmap_limit), accounting(&table_reads),
+		limiter(rate), ceiling(rate),
+		latency_ewma_us(0), tuned_at(0), latency_target_us(latency_target_us_)
+	{
+		uv_mutex_init(&tuning);
+	}
+
+	virtual ~ThrottledEnv()
+	{
+		uv_mutex_destroy(&tuning);
+	}
+
+	// `rate` 0 lifts the limit. Tuning, if on, starts again from `rate`.
+	void set_rate(uint64_t rate, uint64_t latency_target_us_)
+	{
+		uv_mutex_lock(&tuning);
+		ceiling = rate;
+		latency_target_us = latency_target_us_;
+		limiter.set_rate(rate);
+		uv_mutex_unlock(&tuning);
+	}
+
+	uint64_t rate() const
+	{
+		return limiter.get_rate();
+	}
+
+	uint64_t configured_rate() const
+	{
+		uv_mutex_lock(&tuning);
+		uint64_t res = ceiling;
+		uv_mutex_unlock(&tuning);
+		return res;
+	}
+
+	uint64_t read_latency_us() const
+	{
+		return latency_ewma_us >> 4;
+	}
+
+	const RateLimiter& stats() const
+	{
+		return limiter;
+	}
+
+	const AccountingEnv& io() const
+	{
+		return accounting;
+	}
+
+	uint64_t mapped_bytes() const
+	{
+		return table_reads.mapped;
+	}
+
+	virtual leveldb::Status NewWritableFile(const std::string& fname, leveldb::WritableFile** result)
+	{
+		leveldb::Status status = target()->NewWritableFile(fname, result);
+		if (status.ok() && envs::is_table_file(fname))
+		{
+			*result = new ThrottledFile(*result, this);
+		}
+		return status;
+	}
+
+	virtual leveldb::Status NewRandomAccessFile(const std::string& fname, leveldb::RandomAccessFile** result)
+	{
+		leveldb::Status status = target()->NewRandomAccessFile(fname, result);
+		if (status.ok())
+		{
+			*result = new TimedFile(*result, this);
+		}
+		return status;
+	}
+
+	virtual void Schedule(void (*function)(void* arg), void* arg)
+	{
+		target()->Schedule(envs::BackgroundCall::run, new envs::BackgroundCall(function, arg));
+	}
+
+	virtual void StartThread(void (*function)(void* arg), void* arg)
+	{
+		target()->StartThread(envs::BackgroundCall::run, new envs::BackgroundCall(function, arg));
+	}
+};
+
+}
@@ -0,0 +1,264 @@
+#pragma once
+
+#include "./assist.h"
+#include <string>
+#include <vector>
+#include <tr1/unordered_map>
+#include <stdint.h>
+#include <uv.h>
+#include <slice.h>
+
+namespace leveldb {
+
+// Bounded cache of decoded values kept above the LSM, for the few keys that take most of the gets.
+// Shards are guarded by their own mutex since they are filled from worker threads.
+// Eviction is CLOCK, bounded by a byte budget (keys + values + per-entry overhead).
+class HotCache
+{
+public:
+	class Stats
+	{
+	public:
+		uint64_t hits, misses, inserts, evictions, invalidations;
+		uint64_t entries, usage, capacity;
+
+		Stats():
+			hits(0), misses(0), inserts(0), evictions(0), invalidations(0),
+			entries(0), usage(0), capacity(0)
+		{}
+	};
+
+private:
+	static const size_t entry_overhead = 64;
+
+	class Entry
+	{
+	public:
+		std::string key, value;
+		bool used, referenced;
+
+		Entry(): used(false), referenced(false) {}
+
+		size_t charge() const
+		{
+			return key.size() + value.size() + entry_overhead;
+		}
+	};
+
+	typedef std::tr1::unordered_map<std::string, size_t> Index;
+
+	class Shard
+	{
+	public:
+		uv_mutex_t mutex;
+		Index index;
+		std::vector<Entry> slots;
+		std::vector<size_t> free_slots;
+		size_t hand;
+		size_t usage, capacity;
+		// bumped by every invalidation, so that a value read before a write can not be cached after it.
+		uint64_t epoch;
+		Stats stats;
+
+		Shard(): hand(0), usage(0), capacity(0), epoch(0)
+		{
+			uv_mutex_init(&mutex);
+		}
+
+		~Shard()
+		{
+			uv_mutex_destroy(&mutex);
+		}
+
+		void evict(size_t slot)
+		{
+			Entry& entry = slots[slot];
+			usage -= entry.charge();
+			index.erase(entry.key);
+			entry.used = false;
+			entry.referenced = false;
+			std::string().swap(entry.key);
+			std::string().swap(entry.value);
+			free_slots.push_back(slot);
+		}
+
+		// sweep the clock hand until `charge` more bytes fit in.
+		void make_room(size_t charge)
+		{
+			while (usage + charge > capacity && !index.empty())
+			{
+				if (hand >= slots.size())
+				{
+					hand = 0;
+				}
+				Entry& entry = slots[hand];
+				if (entry.used)
+				{
+					if (entry.referenced)
+					{
+						entry.referenced = false;
+					}
+					else
+					{
+						evict(hand);
+						++stats.evictions;
+					}
+				}
+				++hand;
+			}
+		}
+	};
+
+	Shard* shards;
+	size_t shard_mask;
+
+	CS_FORCE_INLINE Shard& shard_of(const Slice& key) const
+	{
+		return shards[hash_bytes(key.data(), key.size()) & shard_mask];
+	}
+
+public:
+	// `shard_count` is rounded up to a power of two.
+	HotCache(size_t capacity, size_t shard_count)
+	{
+		size_t count = 1;
+		while (count < shard_count)
+		{
+			count <<= 1;
+		}
+		shards = new Shard[count];
+		shard_mask = count - 1;
+		for (size_t i = 0; i < count; ++i)
+		{
+			shards[i].capacity = capacity / count;
+		}
+	}
+
+	~HotCache()
+	{
+		delete[] shards;
+	}
+
+	// take it before reading the LSM, and hand it to `insert` after.
+	uint64_t epoch(const Slice& key) const
+	{
+		Shard& shard = shard_of(key);
+		uv_mutex_lock(&shard.mutex);
+		uint64_t epoch = shard.epoch;
+		uv_mutex_unlock(&shard.mutex);
+		return epoch;
+	}
+
+	bool lookup(const Slice& key, std::string& value)
+	{
+		Shard& shard = shard_of(key);
+		uv_mutex_lock(&shard.mutex);
+		Index::iterator it = shard.index.find(key.ToString());
+		bool hit = it != shard.index.end();
+		if (hit)
+		{
+			Entry& entry = shard.slots[it->second];
+			entry.referenced = true;
+			value = entry.value;
+			++shard.stats.hits;
+		}
+		else
+		{
+			++shard.stats.misses;
+		}
+		uv_mutex_unlock(&shard.mutex);
+		return hit;
+	}
+
+	// returns false if the value was not cached, either too large or a write raced with the read.
+	bool insert(const Slice& key, const Slice& value, uint64_t epoch)
+	{
+		Shard& shard = shard_of(key);
+		size_t charge = key.size() + value.size() + entry_overhead;
+		bool inserted = false;
+		uv_mutex_lock(&shard.mutex);
+		if (CS_BLIKELY(shard.epoch == epoch && charge <= shard.capacity))
+		{
+			std::string key_str(key.data(), key.size());
+			Index::iterator it = shard.index.find(key_str);
+			if (it != shard.index.end())
+			{
+				shard.evict(it->second);
+			}
+			shard.make_room(charge);
+
+			size_t slot;
+			if (shard.free_slots.empty())
+			{
+				slot = shard.slots.size();
+				shard.slots.push_back(Entry());
+			}
+			else
+			{
+				slot = shard.free_slots.back();
+				shard.free_slots.pop_back();
+			}
+			Entry& entry = shard.slots[slot];
+			entry.key.swap(key_str);
+			entry.value.assign(value.data(), value.size());
+			entry.used = true;
+			entry.referenced = false;
+			shard.index[entry.key] = slot;
+			shard.usage += charge;
+			++shard.stats.inserts;
+			inserted = true;
+		}
+		uv_mutex_unlock(&shard.mutex);
+		return inserted;
+	}
+
+	void invalidate(const Slice& key)
+	{
+		Shard& shard = shard_of(key);
+		uv_mutex_lock(&shard.mutex);
+		++shard.epoch;
+		Index::iterator it = shard.index.find(key.ToString());
+		if (it != shard.index.end())
+		{
+			shard.evict(it->second);
+			++shard.stats.invalidations;
+		}
+		uv_mutex_unlock(&shard.mutex);
+	}
+
+	// up to `max` of the cached keys, a few from each shard in turn.
+	void keys(std::vector<std::string>& out, size_t max) const
+	{
+		for (size_t i = 0; i <= shard_mask && out.size() < max; ++i)
+		{
+			Shard& shard = shards[i];
+			uv_mutex_lock(&shard.mutex);
+			size_t quota = (max - out.size()) / (shard_mask + 1 - i);
+			for (Index::const_iterator it = shard.index.begin(); it != shard.index.end() && quota > 0; ++it, --quota)
+			{
+				out.push_back(it->first);
+			}
+			uv_mutex_unlock(&shard.mutex);
+		}
+	}
+
+	void stats(Stats& total) const
+	{
+		for (size_t i = 0; i <= shard_mask; ++i)
+		{
+			Shard& shard = shards[i];
+			uv_mutex_lock(&shard.mutex);
+			total.hits += shard.stats.hits;
+			total.misses += shard.stats.misses;
+			total.inserts += shard.stats.inserts;
+			total.evictions += shard.stats.evictions;
+			total.invalidations += shard.stats.invalidations;
+			total.entries += shard.index.size();
+			total.usage += shard.usage;
+			total.capacity += shard.capacity;
+			uv_mutex_unlock(&shard.mutex);
+		}
+	}
+};
+
+}
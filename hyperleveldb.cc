@@ -2,14 +2,24 @@
 #include <node.h>
 #include <v8.h>
 #include "./db.h"
+#include "./sharded_db.h"
 #include "./jstatus.h"
 #include "./jiterator.h"
+#include "./jparallel_iterator.h"
+#include "./jresources.h"
+#include "./keycodec.h"
+#include "./dispatcher.h"
 
 extern "C" void init(v8::Handle<v8::Object> exports)
 {
 	leveldb::HyperLevelDB::init(exports);
+	leveldb::ShardedHyperLevelDB::init(exports);
 	leveldb::Jstatus::init(exports);
 	leveldb::Jiterator::init(exports);
+	leveldb::JparallelIterator::init(exports);
+	leveldb::Jresources::init(exports);
+	leveldb::Jkeycodec::init(exports);
+	leveldb::Dispatcher::init(exports);
 }
 
 NODE_MODULE(hyperleveldb, init)
@@ -7,7 +7,10 @@
 #include <node.h>
 #include <node_buffer.h>
 #include <iterator.h>
+#include <comparator.h>
 #include "jstatus.h"
+#include "./projection.h"
+#include "./dispatcher.h"
 
 namespace leveldb {
 
@@ -16,6 +19,7 @@ class IterOptions
 public:
 	static const int64_t no_limit = -1;
 
+	// forward scans cover [start, end), reverse ones walk down from `start` until `end`, exclusive.
 	std::string start, end;
 	int64_t limit;
 	bool reverse,
@@ -24,9 +28,21 @@ public:
 		key_as_buffer,
 		value_as_buffer;
 
+	// the bytes of each value handed out, `valueOffset` and `valueLength`.
+	Projection value_range;
+
+	// bytes the kernel is asked to read ahead of the table reads, 0 for none.
+	size_t readahead;
+
+	// parallel scans only.
+	size_t parallelism, chunk_size;
+	bool ordered;
+	Dispatcher::Priority priority;		// of the chunk reads, bulk unless asked.
+
 	IterOptions():
 		limit(no_limit),
-		reverse(false), keys(true), values(true), key_as_buffer(true), value_as_buffer(true)
+		reverse(false), keys(true), values(true), key_as_buffer(true), value_as_buffer(true),
+		readahead(0), parallelism(1), chunk_size(1000), ordered(true), priority(Dispatcher::Bulk)
 	{}
 };
 
@@ -36,44 +52,74 @@ private:
 	IterOptions options;
 
 	leveldb::Iterator* iter;
+	const leveldb::Comparator* comparator;
 
 	int64_t walked;
 
 	std::string cur_key, cur_value;
 
+	// what V8 was told the iterator holds, so that its GC collects forgotten ones before they pile up.
+	int64_t external;
+
 	static v8::Persistent<v8::Function> jsctor;
 
 public:
+	// charged for an open iterator besides its buffers: it pins the memtables and tables of the version it reads.
+	static const int64_t pinned_charge = 16 << 10;
+
 	Jiterator()
-		: iter(NULL), walked(0)
+		: iter(NULL), comparator(leveldb::BytewiseComparator()), walked(0), external(0)
 	{}
 
 	static void init(v8::Handle<v8::Object> exports)
 	{
 		v8::Local<v8::FunctionTemplate> tpl = v8::FunctionTemplate::New(js_new);
 		tpl->SetClassName(v8::String::NewSymbol("Iterator"));
-		tpl->InstanceTemplate()->SetInternalFieldCount(4);
+		tpl->InstanceTemplate()->SetInternalFieldCount(1);
 
 		v8::Local<v8::ObjectTemplate> prototype = tpl->PrototypeTemplate();
 		attach_func(prototype, "next", js_next);
 		attach_func(prototype, "end", js_end);
+
+		jsctor = v8::Persistent<v8::Function>::New(tpl->GetFunction());
 	}
 
-	static v8::Local<v8::Value> create(leveldb::Iterator* it, const IterOptions& iter_options)
+	static v8::Local<v8::Value> create(leveldb::Iterator* it, const IterOptions& iter_options,
+			const leveldb::Comparator* comparator = leveldb::BytewiseComparator())
 	{
 		v8::HandleScope scope;
 		v8::Local<v8::Object> js_iter = jsctor->NewInstance();
 		Jiterator* self = node::ObjectWrap::Unwrap<Jiterator>(js_iter);
 		self->options = iter_options;
 		self->iter = it;
+		self->comparator = comparator;
 		if (self->options.start.empty())
 		{
-			self->iter->SeekToFirst();
+			if (self->options.reverse)
+			{
+				self->iter->SeekToLast();
+			}
+			else
+			{
+				self->iter->SeekToFirst();
+			}
 		}
 		else
 		{
 			self->iter->Seek(leveldb::Slice(self->options.start));
+			if (self->options.reverse)
+			{
+				if (!self->iter->Valid())
+				{
+					self->iter->SeekToLast();
+				}
+				else if (comparator->Compare(self->iter->key(), leveldb::Slice(self->options.start)) > 0)
+				{
+					self->iter->Prev();
+				}
+			}
 		}
+		self->account();
 		return scope.Close(js_iter);
 	}
 
@@ -85,6 +131,8 @@ public:
 		return scope.Close(args.This());
 	}
 
+	// calls back `(err, key, value)` for the current entry and moves on, or `()` once the scan is over.
+	// Runs on the loop, reading and decoding the value included: blocking for a value in the value log.
 	static v8::Handle<v8::Value> js_next(const v8::Arguments& args)
 	{
 		v8::HandleScope scope;
@@ -92,38 +140,36 @@ public:
 		if (CS_BUNLIKELY(args.Length() < 1 || !args[0]->IsFunction()))
 		{
 			raise_typeerr("the first argument (callback) must be a Function.");
+			return scope.Close(v8::Undefined());
 		}
 
 		Jiterator* self = node::ObjectWrap::Unwrap<Jiterator>(args.This());
+		if (CS_BUNLIKELY(!self->iter))
+		{
+			raise_err("the iterator has ended.");
+			return scope.Close(v8::Undefined());
+		}
+		v8::Local<v8::Function> callback = v8::Local<v8::Function>::Cast(args[0]);
 
-		if (CS_BLIKELY(self->iter->Valid() &&
-				(self->options.limit == self->options.no_limit || self->walked < self->options.limit)))
+		if (CS_BUNLIKELY(!self->iter->Valid() || !self->in_range(self->iter->key()) ||
+				(self->options.limit != self->options.no_limit && self->walked >= self->options.limit)))
 		{
-			++self->walked;
-			if (self->options.reverse)
+			if (CS_BUNLIKELY(!self->iter->status().ok()))
 			{
-				self->iter->Prev();
+				const int argc = 1;
+				v8::Local<v8::Value> argv[argc] = { Jstatus::convert(self->iter->status()) };
+				callback->Call(v8::Context::GetCurrent()->Global(), argc, argv);
 			}
 			else
 			{
-				self->iter->Next();
+				callback->Call(v8::Context::GetCurrent()->Global(), 0, NULL);
 			}
-		}
-		else
-		{
-			v8::Local<v8::Function>::Cast(args[0])->Call(v8::Context::GetCurrent()->Global(), 0, NULL);
+			return args.This();
 		}
 
 		int argc = 1;
 		v8::Local<v8::Value> argv[3];
-		if (CS_BLIKELY(self->iter->status().ok()))
-		{
-			argv[0] = v8::Local<v8::Value>::New(v8::Undefined());
-		}
-		else
-		{
-			argv[0] = Jstatus::convert(self->iter->status());
-		}
+		argv[0] = v8::Local<v8::Value>::New(v8::Undefined());
 		if (self->options.keys)
 		{
 			self->cur_key = self->iter->key().ToString();
@@ -139,8 +185,8 @@ public:
 		}
 		if (self->options.values)
 		{
-			self->cur_value = self->iter->value().ToString();
-			if (self->options.key_as_buffer)
+			self->options.value_range.assign(self->iter->value(), self->cur_value);
+			if (self->options.value_as_buffer)
 			{
 				argv[argc] = v8::Local<v8::Value>::New(node::Buffer::New(self->cur_value.data(), self->cur_value.size())->handle_);
 			}
@@ -150,7 +196,19 @@ public:
 			}
 			argc += 1;
 		}
-		v8::Local<v8::Function>::Cast(args[0])->Call(v8::Context::GetCurrent()->Global(), argc, argv);
+
+		// moves on before calling back, which may end the iterator.
+		++self->walked;
+		if (self->options.reverse)
+		{
+			self->iter->Prev();
+		}
+		else
+		{
+			self->iter->Next();
+		}
+		self->account();
+		callback->Call(v8::Context::GetCurrent()->Global(), argc, argv);
 
 		return args.This();
 	}
@@ -163,8 +221,11 @@ public:
 
 		delete self->iter;
 		self->iter = NULL;
+		std::string().swap(self->cur_key);
+		std::string().swap(self->cur_value);
+		self->account();
 
-		if (args.Length() > 0 and args[0]->IsFunction())
+		if (args.Length() > 0 && args[0]->IsFunction())
 		{
 			v8::Local<v8::Function>::Cast(args[0])->Call(v8::Context::GetCurrent()->Global(), 0, NULL);
 		}
@@ -172,9 +233,32 @@ public:
 		return scope.Close(v8::Undefined());
 	}
 
+private:
+	void account()
+	{
+		int64_t held = (iter ? pinned_charge : 0) + cur_key.capacity() + cur_value.capacity();
+		if (held != external)
+		{
+			v8::V8::AdjustAmountOfExternalAllocatedMemory(held - external);
+			external = held;
+		}
+	}
+
+	CS_FORCE_INLINE bool in_range(const leveldb::Slice& key) const
+	{
+		if (options.end.empty())
+		{
+			return true;
+		}
+		int order = comparator->Compare(key, leveldb::Slice(options.end));
+		return options.reverse ? order > 0 : order < 0;
+	}
+
+public:
 	~Jiterator()
 	{
 		delete iter;
+		v8::V8::AdjustAmountOfExternalAllocatedMemory(-external);
 	}
 };
 
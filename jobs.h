@@ -1,20 +1,36 @@
 
 #pragma once
 
+#include <cstdio>
 #include <cstdlib>
 #include <vector>
+#include <map>
 #include <queue>
 #include <string>
 #include <db.h>
 #include <options.h>
 #include <status.h>
 #include <write_batch.h>
+#include <cache.h>
+#include <comparator.h>
+#include <env.h>
+#include <iterator.h>
 #include <uv.h>
 #include <v8.h>
+#include "./read_caches.h"
+#include "./admission.h"
+#include "./dispatcher.h"
+#include "./db_registry.h"
+#include "./aggregate.h"
+#include "./value_codec.h"
+#include "./key_locks.h"
+#include "./update.h"
+#include "./envs.h"
+#include "./projection.h"
 
 namespace leveldb {
 
-enum BatchOpType {Put, Del};
+enum BatchOpType {Put, Del, Check, Modify};
 
 typedef v8::Persistent<v8::Function> Callback;
 
@@ -25,6 +41,12 @@ public:
 	static void execute(uv_work_t* uv_work)
 	{
 		JobType* job = reinterpret_cast<JobType*>(uv_work->data);
+		// the caller gave up on it while it was queued.
+		if (CS_BUNLIKELY(job->expired()))
+		{
+			job->time_out();
+			return;
+		}
 		job->operate();
 	}
 
@@ -38,6 +60,14 @@ class Job
 protected:
 	static const leveldb::Status status_ok;
 
+public:
+	static const leveldb::Status status_not_found;
+	static const leveldb::Status status_would_block;
+	static const leveldb::Status status_timed_out;
+	// the messages of the two start with these, which no status of leveldb does.
+	static const char* const would_block_reason;
+	static const char* const timed_out_reason;
+
 public:
 	uv_work_t uv_work;
 	leveldb::DB* db;
@@ -45,51 +75,188 @@ public:
 
 	leveldb::Status status;		// operate status. Exists only if status.ok() is false.
 
+	Admission* admission;		// set if the job was counted by admission control, released on completion.
+	size_t charge;
+
+	uint64_t deadline;		// `uv_hrtime` past which the job is skipped if it has not started yet, 0 for none.
+	bool shed;
+
 	Job(leveldb::DB* db, Callback callback_):
-		db(db), callback(callback_)
+		db(db), callback(callback_), admission(NULL), charge(0), deadline(0), shed(false)
 	{
 		uv_work.data = this;
 	}
 
+	CS_FORCE_INLINE bool expired() const
+	{
+		return deadline && uv_hrtime() > deadline;
+	}
+
+	void time_out()
+	{
+		status = status_timed_out;
+		shed = true;
+	}
+
 	virtual ~Job()
 	{
 		callback.Dispose();
+		if (admission)
+		{
+			if (shed)
+			{
+				++admission->shed;
+			}
+			admission->release(charge);
+		}
 	}
 };
 
+// Completes on the event loop without doing anything, for callbacks that are known right away
+// (e.g. refused by admission control).
+class ImmediateJob: public Job, public Execute<ImmediateJob>
+{
+public:
+	explicit ImmediateJob(Callback callback_):
+		Job(NULL, callback_)
+	{}
+
+	ImmediateJob(const leveldb::Status& status_, Callback callback_):
+		Job(NULL, callback_)
+	{
+		status = status_;
+	}
+
+	virtual void operate()
+	{}
+};
+
 class OpenJob: public Job, public Execute<OpenJob>
 {
 public:
-	const leveldb::Options options;
+	leveldb::Options options;		// set again if the handle waited for another one to open the directory.
 	const std::string directory;
 	leveldb::DB** db_ptr;
+	ValueCodec* codec;		// its dictionaries are loaded once the database is open.
+	DbRegistry::Shared* shared;		// registered while the database is opened, for other handles to share it once it is.
+	bool* opening;		// the handle's, cleared when the job calls back.
+	v8::Persistent<v8::Object> holder;		// the handle, kept alive while it waits for another one to open the directory.
 
 	OpenJob(leveldb::DB* db, const leveldb::Options& options_, const std::string& directory_, leveldb::DB** db_ptr, Callback callback_):
-		Job(db, callback_), options(options_), directory(directory_), db_ptr(db_ptr)
+		Job(db, callback_), options(options_), directory(directory_), db_ptr(db_ptr), codec(NULL), shared(NULL), opening(NULL)
 	{}
 
+	virtual ~OpenJob()
+	{
+		holder.Dispose();
+	}
+
 	virtual void operate()
 	{
 		status = leveldb::DB::Open(options, directory, db_ptr);
+		if (status.ok() && codec)
+		{
+			status = codec->load(options.env, directory);
+			if (CS_BUNLIKELY(!status.ok()))
+			{
+				// the open fails as a whole, the handle is left without the database and its lock.
+				delete *db_ptr;
+				*db_ptr = NULL;
+			}
+		}
+	}
+};
+
+// The keys of the hot cache, kept beside the database by `close` to be warmed up after the next `open`.
+// Each key is a 4-byte little-endian length then its bytes.
+class HotKeysFile
+{
+public:
+	static std::string name(const std::string& directory)
+	{
+		return directory + "/HOTKEYS";
+	}
+
+	static bool is_file(const std::string& name)
+	{
+		return name == "HOTKEYS";
+	}
+
+	static leveldb::Status save(leveldb::Env* env, const std::string& directory, const std::vector<std::string>& keys)
+	{
+		std::string content;
+		for (std::vector<std::string>::const_iterator it = keys.begin(); it != keys.end(); ++it)
+		{
+			std::string size;
+			update::encode_le(static_cast<uint32_t>(it->size()), size);
+			content.append(size);
+			content.append(*it);
+		}
+		return leveldb::WriteStringToFile(env, leveldb::Slice(content), name(directory));
+	}
+
+	// no file is no keys.
+	static leveldb::Status load(leveldb::Env* env, const std::string& directory, std::vector<std::string>& keys)
+	{
+		if (!env->FileExists(name(directory)))
+		{
+			return leveldb::Status::OK();
+		}
+		std::string content;
+		leveldb::Status status = leveldb::ReadFileToString(env, name(directory), &content);
+		for (size_t pos = 0; status.ok() && pos < content.size(); )
+		{
+			if (content.size() - pos < 4)
+			{
+				return leveldb::Status::Corruption(name(directory), "truncated");
+			}
+			uint32_t size = aggregate::decode_le<uint32_t>(content.data() + pos);
+			pos += 4;
+			if (content.size() - pos < size)
+			{
+				return leveldb::Status::Corruption(name(directory), "truncated");
+			}
+			keys.push_back(content.substr(pos, size));
+			pos += size;
+		}
+		return status;
 	}
 };
 
 class CloseJob: public Job, public Execute<CloseJob>
 {
 public:
+	static const size_t max_hot_keys = 100000;
+
 	leveldb::Cache* cache;
+	ReadCaches caches;
+	ValueCodec* codec;
+	leveldb::Env* env;		// deleted after the database, whose background threads use it until then.
+	KeyLocks* locks;
+	std::string hot_keys_directory;		// where to record the keys of the hot cache, if not empty.
 
-	CloseJob(leveldb::DB* db, leveldb::Cache* cache_, Callback callback_):
-		Job(db, callback_), cache(cache_)
+	// all NULL when other handles still share the database.
+	// Queued as a barrier of the database, it runs once no job of it is queued or running:
+	// the jobs hold copies of `caches` and the codec, and are the last to use them.
+	CloseJob(leveldb::DB* db, leveldb::Cache* cache_, const ReadCaches& caches_, Callback callback_):
+		Job(db, callback_), cache(cache_), caches(caches_), codec(NULL), env(NULL), locks(NULL)
 	{}
 
 	virtual void operate()
 	{
-		delete db;
-		if (cache)
+		if (!hot_keys_directory.empty() && caches.hot)
 		{
-			std::free(cache);
+			std::vector<std::string> keys;
+			caches.hot->keys(keys, max_hot_keys);
+			// only a hint for the next warmup, failing to record it does not fail the close.
+			HotKeysFile::save(env ? env : leveldb::Env::Default(), hot_keys_directory, keys);
 		}
+		delete db;
+		delete cache;
+		caches.clear();
+		delete codec;
+		delete env;
+		delete locks;
 	}
 };
 
@@ -98,19 +265,41 @@ class PutJob: public Job, public Execute<PutJob>
 public:
 	const leveldb::WriteOptions options;
 	const std::string key, value;
+	const ReadCaches caches;
+	const ValueCodec* codec;
+	KeyLocks* locks;		// NULL for a database without locked jobs.
 
-	PutJob(leveldb::DB* db, const leveldb::WriteOptions& options_, const std::string& key_, const std::string& value_, Callback callback_):
-		Job(db, callback_), options(options_), key(key_), value(value_)
+	PutJob(leveldb::DB* db, const leveldb::WriteOptions& options_, const std::string& key_, const std::string& value_,
+			const ReadCaches& caches_, Callback callback_):
+		Job(db, callback_), options(options_), key(key_), value(value_), caches(caches_), codec(NULL), locks(NULL)
 	{}
 
 	PutJob(leveldb::DB* db, const leveldb::WriteOptions& options_,
-			const v8::String::AsciiValue& key_data, const v8::String::AsciiValue& value_data, Callback callback_):
-		Job(db, callback_), options(options_), key(*key_data, key_data.length()), value(*value_data, value_data.length())
+			const v8::String::AsciiValue& key_data, const v8::String::AsciiValue& value_data,
+			const ReadCaches& caches_, Callback callback_):
+		Job(db, callback_), options(options_), key(*key_data, key_data.length()), value(*value_data, value_data.length()), caches(caches_), codec(NULL),
+		locks(NULL)
 	{}
 
 	virtual void operate()
 	{
-		status = db->Put(options, leveldb::Slice(key), leveldb::Slice(value));
+		KeyLocks::WriteGuard guard(locks, leveldb::Slice(key));
+		if (codec)
+		{
+			ValueCodec::WriteScope scope(codec);
+			std::string encoded;
+			codec->encode(leveldb::Slice(value), encoded);
+			status = scope.sync(options.sync);
+			if (status.ok())
+			{
+				status = db->Put(options, leveldb::Slice(key), leveldb::Slice(encoded));
+			}
+		}
+		else
+		{
+			status = db->Put(options, leveldb::Slice(key), leveldb::Slice(value));
+		}
+		caches.invalidate(leveldb::Slice(key));
 	}
 };
 
@@ -119,18 +308,25 @@ class DelJob: public Job, public Execute<DelJob>
 public:
 	const leveldb::WriteOptions options;
 	const std::string key;
+	const ReadCaches caches;
+	const ValueCodec* codec;
+	KeyLocks* locks;		// NULL for a database without locked jobs.
 
-	DelJob(leveldb::DB* db, const leveldb::WriteOptions& options_, const std::string& key_, Callback callback_):
-		Job(db, callback_), options(options_), key(key_)
+	DelJob(leveldb::DB* db, const leveldb::WriteOptions& options_, const std::string& key_, const ReadCaches& caches_, Callback callback_):
+		Job(db, callback_), options(options_), key(key_), caches(caches_), codec(NULL), locks(NULL)
 	{}
 
-	DelJob(leveldb::DB* db, const leveldb::WriteOptions& options_, const v8::String::AsciiValue& key_data, Callback callback_):
-		Job(db, callback_), options(options_), key(*key_data, key_data.length())
+	DelJob(leveldb::DB* db, const leveldb::WriteOptions& options_, const v8::String::AsciiValue& key_data,
+			const ReadCaches& caches_, Callback callback_):
+		Job(db, callback_), options(options_), key(*key_data, key_data.length()), caches(caches_), codec(NULL), locks(NULL)
 	{}
 
 	virtual void operate()
 	{
+		KeyLocks::WriteGuard guard(locks, leveldb::Slice(key));
+		ValueCodec::WriteScope scope(codec);
 		status = db->Delete(options, leveldb::Slice(key));
+		caches.invalidate(leveldb::Slice(key));
 	}
 };
 
@@ -141,21 +337,60 @@ public:
 	const std::string key;
 	std::string result;
 	const bool as_buffer;
+	const ReadCaches caches;
+	bool not_found_as_undefined;
+	const ValueCodec* codec;
+	Projection projection;
+	const leveldb::Comparator* comparator;
 
-	GetJob(leveldb::DB* db, const leveldb::ReadOptions& options_, bool as_buffer_, const std::string& key_, Callback callback_):
-		Job(db, callback_), options(options_), key(key_), as_buffer(as_buffer_)
+	GetJob(leveldb::DB* db, const leveldb::ReadOptions& options_, bool as_buffer_, const std::string& key_,
+			const ReadCaches& caches_, Callback callback_):
+		Job(db, callback_), options(options_), key(key_), as_buffer(as_buffer_), caches(caches_), not_found_as_undefined(false), codec(NULL),
+		comparator(leveldb::BytewiseComparator())
 	{}
 
-	GetJob(leveldb::DB* db, const leveldb::ReadOptions& options_, bool as_buffer_, const v8::String::AsciiValue& key_data, Callback callback_):
-		Job(db, callback_), options(options_), key(*key_data, key_data.length()), as_buffer(as_buffer_)
+	GetJob(leveldb::DB* db, const leveldb::ReadOptions& options_, bool as_buffer_, const v8::String::AsciiValue& key_data,
+			const ReadCaches& caches_, Callback callback_):
+		Job(db, callback_), options(options_), key(*key_data, key_data.length()), as_buffer(as_buffer_), caches(caches_), not_found_as_undefined(false), codec(NULL),
+		comparator(leveldb::BytewiseComparator())
 	{}
 
 	virtual void operate()
 	{
-		status = db->Get(options, leveldb::Slice(key), &result);
+		// encoded values are inflated whole anyway, so they go through the caches and are trimmed after.
+		if (projection.all() || codec)
+		{
+			status = caches.fetch(db, options, leveldb::Slice(key), &result, codec);
+			projection.trim(result);
+		}
+		else
+		{
+			read_range();
+		}
+	}
+
+private:
+	// seeks rather than `Get`, which would copy the whole value: only the range is copied out of the block.
+	// Iterators skip the bloom filters, so a missing key costs more than with `Get`.
+	void read_range()
+	{
+		leveldb::Iterator* it = db->NewIterator(options);
+		it->Seek(leveldb::Slice(key));
+		if (it->Valid() && comparator->Compare(it->key(), leveldb::Slice(key)) == 0)
+		{
+			projection.assign(it->value(), result);
+			status = status_ok;
+		}
+		else
+		{
+			status = it->status().ok() ? status_not_found : it->status();
+		}
+		delete it;
 	}
 };
 
+// A batch with `Check` or `Modify` ops is conditional: it runs under the locks of all its keys,
+// the checks see the writes of the ops before them, and nothing is written if one fails.
 class BatchJob: public Job, public Execute<BatchJob>
 {
 public:
@@ -185,6 +420,31 @@ public:
 		{}
 	};
 
+	enum CheckKind {CheckEquals, CheckAbsent, CheckVersion};
+
+	class BatchWorkCheck: public BatchWork
+	{
+	public:
+		std::string key;
+		CheckKind kind;
+		std::string value;		// for `CheckVersion`, the version encoded like `update` numbers.
+		uint32_t index;			// of the operation in the js array.
+
+		BatchWorkCheck(const std::string& key_, CheckKind kind_, const std::string& value_, uint32_t index_)
+			: key(key_), kind(kind_), value(value_), index(index_)
+		{}
+	};
+
+	class BatchWorkModify: public BatchWork
+	{
+	public:
+		Update update;
+
+		BatchWorkModify(const Update& update_)
+			: update(update_)
+		{}
+	};
+
 	class BatchOp
 	{
 	public:
@@ -199,15 +459,38 @@ public:
 		{
 			delete work;
 		}
+
+		const std::string& key() const
+		{
+			switch (type)
+			{
+			case Put:
+				return static_cast<BatchWorkPut*>(work)->key;
+			case Del:
+				return static_cast<BatchWorkDel*>(work)->key;
+			case Check:
+				return static_cast<BatchWorkCheck*>(work)->key;
+			default:
+				return static_cast<BatchWorkModify*>(work)->update.key;
+			}
+		}
 	};
 
 	typedef std::vector<BatchOp*> BatchOpList;
 
 	const leveldb::WriteOptions options;
 	BatchOpList oplist;
+	const ReadCaches caches;
+	const ValueCodec* codec;
+	KeyLocks* locks;		// required once the batch is conditional, a plain batch takes them once a locked job ran.
 
-	BatchJob(leveldb::DB* db, const leveldb::WriteOptions& options_, Callback callback_):
-		Job(db, callback_), options(options_)
+	bool conditional;
+	bool committed;
+	uint32_t failed_index;		// of the failed check, if not `committed`.
+
+	BatchJob(leveldb::DB* db, const leveldb::WriteOptions& options_, const ReadCaches& caches_, Callback callback_):
+		Job(db, callback_), options(options_), caches(caches_), codec(NULL), locks(NULL),
+		conditional(false), committed(false), failed_index(0)
 	{}
 
 	void append_put(const std::string& key_, const std::string& value_)
@@ -230,17 +513,46 @@ public:
 		append_del(std::string(*key_data, key_data.length()));
 	}
 
+	void append_check(const std::string& key_, CheckKind kind, const std::string& value_, uint32_t index)
+	{
+		oplist.push_back(new BatchOp(Check, new BatchWorkCheck(key_, kind, value_, index)));
+		conditional = true;
+	}
+
+	void append_modify(const Update& update)
+	{
+		oplist.push_back(new BatchOp(Modify, new BatchWorkModify(update)));
+		conditional = true;
+	}
+
 	virtual void operate()
 	{
-		if (!oplist.empty())
+		if (conditional)
+		{
+			operate_conditional();
+		}
+		else if (!oplist.empty())
 		{
+			KeyLocks::WriteGuard guard(locks);
+			if (guard.locking())
+			{
+				std::vector<std::string> keys;
+				keys.reserve(oplist.size());
+				for (BatchOpList::const_iterator it = oplist.begin(); it != oplist.end(); ++it)
+				{
+					keys.push_back((*it)->key());
+				}
+				guard.lock(keys);
+			}
+			ValueCodec::WriteScope scope(codec);
 			leveldb::WriteBatch batch;
+			std::string encoded;
 			for (BatchOpList::iterator it = oplist.begin(); it != oplist.end(); ++it)
 			{
 				if ((*it)->type == Put)
 				{
 					BatchWorkPut* work = (BatchWorkPut*)((*it)->work);
-					batch.Put(leveldb::Slice(work->key), leveldb::Slice(work->value));
+					put(batch, work->key, work->value, encoded);
 				}
 				else if ((*it)->type == Del)
 				{
@@ -248,11 +560,29 @@ public:
 					batch.Delete(leveldb::Slice(work->key));
 				}
 			}
-			status = db->Write(options, &batch);
+			status = scope.sync(options.sync);
+			if (status.ok())
+			{
+				status = db->Write(options, &batch);
+			}
+			committed = status.ok();
+			invalidate_caches();
 		}
 		else
 		{
 			status = status_ok;
+			committed = true;
+		}
+	}
+
+	void invalidate_caches() const
+	{
+		for (BatchOpList::const_iterator it = oplist.begin(); it != oplist.end(); ++it)
+		{
+			if ((*it)->type != Check)
+			{
+				caches.invalidate(leveldb::Slice((*it)->key()));
+			}
 		}
 	}
 
@@ -263,6 +593,607 @@ public:
 			delete *it;
 		}
 	}
+
+private:
+	// what the ops before have written to a key, so later ops of the same batch see it.
+	class Staged
+	{
+	public:
+		bool exists;
+		std::string value;
+
+		Staged(): exists(false) {}
+	};
+
+	typedef std::map<std::string, Staged> StagedMap;
+
+	void put(leveldb::WriteBatch& batch, const std::string& key, const std::string& value, std::string& encoded) const
+	{
+		if (codec)
+		{
+			codec->encode(leveldb::Slice(value), encoded);
+			batch.Put(leveldb::Slice(key), leveldb::Slice(encoded));
+		}
+		else
+		{
+			batch.Put(leveldb::Slice(key), leveldb::Slice(value));
+		}
+	}
+
+	// the current value of `key` as this batch sees it, `*exists` false if missing.
+	leveldb::Status read(const StagedMap& staged, const std::string& key, std::string& value, bool* exists) const
+	{
+		StagedMap::const_iterator it = staged.find(key);
+		if (it != staged.end())
+		{
+			*exists = it->second.exists;
+			value = it->second.value;
+			return status_ok;
+		}
+		leveldb::Status res = db->Get(leveldb::ReadOptions(), leveldb::Slice(key), &value);
+		*exists = res.ok();
+		if (res.ok() && codec)
+		{
+			res = codec->decode_in_place(value);
+		}
+		return res.IsNotFound() ? status_ok : res;
+	}
+
+	static bool passes(const BatchWorkCheck* check, const std::string& value, bool exists)
+	{
+		switch (check->kind)
+		{
+		case CheckEquals:
+			return exists && value == check->value;
+		case CheckAbsent:
+			return !exists;
+		default:
+			// a missing version key is version 0.
+			return exists ? value == check->value : check->value == std::string(8, '\0');
+		}
+	}
+
+	void operate_conditional()
+	{
+		std::vector<std::string> keys;
+		keys.reserve(oplist.size());
+		for (BatchOpList::const_iterator it = oplist.begin(); it != oplist.end(); ++it)
+		{
+			keys.push_back((*it)->key());
+		}
+		KeyLocks::Guard guard(*locks, keys);
+		ValueCodec::WriteScope scope(codec);
+
+		leveldb::WriteBatch batch;
+		StagedMap staged;
+		std::string value, encoded;
+		bool exists;
+		for (BatchOpList::const_iterator it = oplist.begin(); it != oplist.end(); ++it)
+		{
+			const std::string& key = (*it)->key();
+			switch ((*it)->type)
+			{
+			case Put:
+				put(batch, key, static_cast<BatchWorkPut*>((*it)->work)->value, encoded);
+				staged[key].exists = true;
+				staged[key].value = static_cast<BatchWorkPut*>((*it)->work)->value;
+				break;
+			case Del:
+				batch.Delete(leveldb::Slice(key));
+				staged[key].exists = false;
+				staged[key].value.clear();
+				break;
+			case Check:
+				status = read(staged, key, value, &exists);
+				if (!status.ok())
+				{
+					return;
+				}
+				if (!passes(static_cast<BatchWorkCheck*>((*it)->work), value, exists))
+				{
+					failed_index = static_cast<BatchWorkCheck*>((*it)->work)->index;
+					return;
+				}
+				break;
+			case Modify:
+				{
+					status = read(staged, key, value, &exists);
+					if (!status.ok())
+					{
+						return;
+					}
+					Staged& next = staged[key];
+					status = update::apply(static_cast<BatchWorkModify*>((*it)->work)->update, exists ? &value : NULL, next.value);
+					if (!status.ok())
+					{
+						return;
+					}
+					next.exists = true;
+					put(batch, key, next.value, encoded);
+				}
+				break;
+			}
+		}
+		status = scope.sync(options.sync);
+		if (status.ok())
+		{
+			status = db->Write(options, &batch);
+		}
+		committed = status.ok();
+		invalidate_caches();
+	}
+};
+
+// Applies read-modify-write updates in one write batch, under the locks of their keys.
+// Updates of the same key see the result of the ones before them.
+class UpdateJob: public Job, public Execute<UpdateJob>
+{
+public:
+	typedef std::vector<Update> UpdateList;
+
+	const leveldb::WriteOptions options;
+	UpdateList updates;
+	const ReadCaches caches;
+	KeyLocks* const locks;
+	const ValueCodec* codec;
+	bool single;		// called as `update` rather than `updateBatch`, answers a value instead of an array.
+
+	std::vector<std::string> results;		// the new value for each update.
+
+	UpdateJob(leveldb::DB* db, const leveldb::WriteOptions& options_, const ReadCaches& caches_, KeyLocks* locks_, Callback callback_):
+		Job(db, callback_), options(options_), caches(caches_), locks(locks_), codec(NULL), single(false)
+	{}
+
+	virtual void operate()
+	{
+		std::vector<std::string> keys;
+		keys.reserve(updates.size());
+		for (UpdateList::const_iterator it = updates.begin(); it != updates.end(); ++it)
+		{
+			keys.push_back(it->key);
+		}
+
+		KeyLocks::Guard guard(*locks, keys);
+		ValueCodec::WriteScope scope(codec);
+		leveldb::WriteBatch batch;
+		leveldb::ReadOptions read_options;
+		std::string stored, encoded;
+		results.resize(updates.size());
+		for (size_t i = 0; i < updates.size(); ++i)
+		{
+			const Update& u = updates[i];
+			const std::string* current = NULL;
+			for (size_t j = i; j > 0; --j)
+			{
+				if (updates[j - 1].key == u.key)
+				{
+					current = &results[j - 1];
+					break;
+				}
+			}
+			if (!current)
+			{
+				status = db->Get(read_options, leveldb::Slice(u.key), &stored);
+				if (status.ok())
+				{
+					if (codec)
+					{
+						status = codec->decode_in_place(stored);
+					}
+					current = &stored;
+				}
+				else if (status.IsNotFound())
+				{
+					status = status_ok;
+				}
+				if (!status.ok())
+				{
+					return;
+				}
+			}
+			status = update::apply(u, current, results[i]);
+			if (!status.ok())
+			{
+				return;
+			}
+			if (codec)
+			{
+				codec->encode(leveldb::Slice(results[i]), encoded);
+				batch.Put(leveldb::Slice(u.key), leveldb::Slice(encoded));
+			}
+			else
+			{
+				batch.Put(leveldb::Slice(u.key), leveldb::Slice(results[i]));
+			}
+		}
+		status = scope.sync(options.sync);
+		if (status.ok())
+		{
+			status = db->Write(options, &batch);
+		}
+		invalidate_caches();
+	}
+
+	void invalidate_caches() const
+	{
+		for (UpdateList::const_iterator it = updates.begin(); it != updates.end(); ++it)
+		{
+			caches.invalidate(leveldb::Slice(it->key));
+		}
+	}
+};
+
+// Warms the caches up a chunk at a time: each run of the job does one chunk, then `on_warmup` queues it again
+// until it is `done`, so a warmup never holds a worker thread for long.
+// In order: the tables are opened (loading their index and filter blocks), the keys recorded in HOTKEYS are read,
+// then the ranges are scanned with `fill_cache`, up to `budget` bytes.
+class WarmupJob: public Job, public Execute<WarmupJob>
+{
+public:
+	typedef std::vector<std::pair<std::string, std::string> > RangeList;
+
+	const leveldb::ReadOptions options;
+	const ReadCaches caches;
+	const leveldb::Comparator* const comparator;
+	const ValueCodec* codec;
+	leveldb::Env* env;
+	std::string directory;
+
+	RangeList ranges;		// an empty bound is the first or the last key.
+	bool index_only;		// stop once the tables are opened.
+	bool hot_keys;			// read the keys recorded in HOTKEYS.
+	uint64_t budget;		// bytes scanned at most, 0 for no limit.
+	size_t chunk_size;		// bytes scanned by one run.
+	RateLimiter limiter;	// of the bytes scanned.
+	Dispatcher::Priority priority;		// of every run.
+	uint64_t wait_us;		// before the next run, for `limiter`.
+	uv_timer_t timer;		// waits `wait_us` on the loop.
+
+	v8::Persistent<v8::Function> progress;
+	v8::Persistent<v8::Object> holder;		// the database, kept alive while warming up.
+	leveldb::DB* const* current_db;			// where the database keeps its handle, to notice it was closed.
+
+	// progress.
+	uint64_t tables, hot_keys_read, keys, bytes;
+	size_t range_index;
+	bool done;
+
+private:
+	enum Phase {PhaseTables, PhaseHotKeys, PhaseRanges};
+
+	Phase phase;
+	std::string resume;		// the last key scanned in the current range.
+
+	// the largest user key of every table, from the `leveldb.sstables` property.
+	// Its lines read `number:size['smallest' @ seq : type .. 'largest' @ seq : type]`, with non-printable bytes as \xNN.
+	static void largest_keys(const std::string& sstables, std::vector<std::string>& out)
+	{
+		std::string::size_type line_start = 0;
+		while (line_start < sstables.size())
+		{
+			std::string::size_type line_end = sstables.find('\n', line_start);
+			line_end = line_end == std::string::npos ? sstables.size() : line_end;
+			std::string line = sstables.substr(line_start, line_end - line_start);
+			line_start = line_end + 1;
+
+			std::string::size_type from = line.find(" .. '"), to = line.rfind("' @ ");
+			if (from == std::string::npos || to == std::string::npos || to < from + 5)
+			{
+				continue;
+			}
+			std::string key;
+			for (std::string::size_type i = from + 5; i < to; ++i)
+			{
+				if (line[i] == '\\' && i + 3 < to && line[i + 1] == 'x')
+				{
+					key.push_back(static_cast<char>(std::strtoul(line.substr(i + 2, 2).c_str(), NULL, 16)));
+					i += 3;
+				}
+				else
+				{
+					key.push_back(line[i]);
+				}
+			}
+			out.push_back(key);
+		}
+	}
+
+	// estimating the size up to a key inside a table opens it, which loads its index and filter into the table cache.
+	void open_tables()
+	{
+		std::string sstables;
+		std::vector<std::string> keys;
+		if (db->GetProperty("leveldb.sstables", &sstables))
+		{
+			largest_keys(sstables, keys);
+		}
+		if (!keys.empty())
+		{
+			std::vector<leveldb::Range> probes;
+			for (std::vector<std::string>::const_iterator key = keys.begin(); key != keys.end(); ++key)
+			{
+				probes.push_back(leveldb::Range(leveldb::Slice(*key), leveldb::Slice(*key)));
+			}
+			std::vector<uint64_t> sizes(probes.size());
+			db->GetApproximateSizes(&probes[0], probes.size(), &sizes[0]);
+		}
+		tables = keys.size();
+	}
+
+	void read_hot_keys()
+	{
+		std::vector<std::string> recorded;
+		status = HotKeysFile::load(env, directory, recorded);
+		std::string value;
+		for (std::vector<std::string>::const_iterator key = recorded.begin(); status.ok() && key != recorded.end(); ++key)
+		{
+			leveldb::Status res = caches.fetch(db, options, leveldb::Slice(*key), &value, codec);
+			if (!res.ok() && !res.IsNotFound())
+			{
+				status = res;
+			}
+			++hot_keys_read;
+		}
+	}
+
+	// every chunk opens its own iterator and resumes after the last key scanned,
+	// so that no iterator outlives the database when it is closed between chunks.
+	void scan_chunk()
+	{
+		size_t scanned = 0;
+		while (range_index < ranges.size() && scanned < chunk_size && (!budget || bytes < budget))
+		{
+			const std::pair<std::string, std::string>& range = ranges[range_index];
+			leveldb::Iterator* it = db->NewIterator(options);
+			if (!resume.empty())
+			{
+				it->Seek(leveldb::Slice(resume));
+				if (it->Valid() && it->key() == leveldb::Slice(resume))
+				{
+					it->Next();
+				}
+			}
+			else if (range.first.empty())
+			{
+				it->SeekToFirst();
+			}
+			else
+			{
+				it->Seek(leveldb::Slice(range.first));
+			}
+			for (; it->Valid() && scanned < chunk_size && (!budget || bytes < budget); it->Next())
+			{
+				leveldb::Slice key = it->key();
+				if (!range.second.empty() && comparator->Compare(key, leveldb::Slice(range.second)) >= 0)
+				{
+					break;
+				}
+				size_t size = key.size() + it->value().size();
+				scanned += size;
+				bytes += size;
+				++keys;
+				resume.assign(key.data(), key.size());
+			}
+			status = it->status();
+			delete it;
+			if (!status.ok())
+			{
+				return;
+			}
+			if (scanned < chunk_size && (!budget || bytes < budget))
+			{
+				// the range is over.
+				resume.clear();
+				++range_index;
+			}
+		}
+		// waited out by `on_warmup`, not on this thread.
+		wait_us = limiter.take(scanned, env->NowMicros());
+		done = range_index >= ranges.size() || (budget && bytes >= budget);
+	}
+
+public:
+	WarmupJob(leveldb::DB* db, const ReadCaches& caches_, const leveldb::Comparator* comparator_, Callback callback_):
+		Job(db, callback_), options(fill_cache_options()), caches(caches_), comparator(comparator_), codec(NULL), env(leveldb::Env::Default()),
+		index_only(false), hot_keys(false), budget(0), chunk_size(4 << 20), limiter(0), priority(Dispatcher::Bulk), wait_us(0), current_db(NULL),
+		tables(0), hot_keys_read(0), keys(0), bytes(0), range_index(0), done(false),
+		phase(PhaseTables)
+	{}
+
+	virtual ~WarmupJob()
+	{
+		progress.Dispose();
+		holder.Dispose();
+	}
+
+	static leveldb::ReadOptions fill_cache_options()
+	{
+		leveldb::ReadOptions options;
+		options.fill_cache = true;
+		return options;
+	}
+
+	// the database was closed since the last chunk.
+	bool abandoned() const
+	{
+		return current_db && *current_db != db;
+	}
+
+	virtual void operate()
+	{
+		switch (phase)
+		{
+		case PhaseTables:
+			open_tables();
+			phase = hot_keys ? PhaseHotKeys : PhaseRanges;
+			done = index_only && !hot_keys;
+			break;
+		case PhaseHotKeys:
+			read_hot_keys();
+			phase = PhaseRanges;
+			done = index_only;
+			break;
+		case PhaseRanges:
+			scan_chunk();
+			break;
+		}
+		if (!status.ok())
+		{
+			done = true;
+		}
+	}
+};
+
+// Reclaims the value log files of which at least `min_garbage` is records no key points to any more.
+// Their live records are copied to the newest file, then the pointers are swapped while no write runs,
+// only for the keys still pointing to the old records, and the files are deleted.
+class CollectValueLogJob: public Job, public Execute<CollectValueLogJob>
+{
+public:
+	static const size_t batch_size = 256;		// pointers swapped per pause of the writes.
+
+	ValueLog* const log;
+	const double min_garbage;
+	uint64_t files, reclaimed, relocated;
+
+	CollectValueLogJob(leveldb::DB* db, ValueLog* log_, double min_garbage_, Callback callback_):
+		Job(db, callback_), log(log_), min_garbage(min_garbage_), files(0), reclaimed(0), relocated(0)
+	{}
+
+	virtual void operate()
+	{
+		// files sealed before the scans start, no write can point to them afterwards.
+		std::vector<std::pair<uint32_t, uint64_t> > sealed;
+		log->sealed(sealed);
+		if (sealed.empty())
+		{
+			status = status_ok;
+			return;
+		}
+		// waits out the writes that appended to them before they were sealed, so the scans see their pointers.
+		log->lock_writes();
+		log->unlock_writes();
+
+		std::map<uint32_t, uint64_t> live;
+		status = scan(NULL, &live);
+		std::map<uint32_t, uint64_t> victims;		// to the records moved out of them.
+		for (size_t i = 0; status.ok() && i < sealed.size(); ++i)
+		{
+			uint64_t live_bytes = live[sealed[i].first];
+			if (!sealed[i].second || 1.0 - double(live_bytes) / sealed[i].second >= min_garbage)
+			{
+				victims[sealed[i].first] = 0;
+			}
+		}
+		if (!status.ok() || victims.empty())
+		{
+			return;
+		}
+
+		status = scan(&victims, NULL);
+		for (std::map<uint32_t, uint64_t>::const_iterator it = victims.begin(); status.ok() && it != victims.end(); ++it)
+		{
+			for (size_t i = 0; i < sealed.size(); ++i)
+			{
+				if (sealed[i].first == it->first)
+				{
+					reclaimed += sealed[i].second;
+				}
+			}
+			status = log->remove(it->first, it->second);
+			++files;
+		}
+	}
+
+private:
+	typedef std::vector<std::pair<std::string, ValueLog::Pointer> > Moves;
+
+	// counts the live bytes of each file into `live`, or moves the records of `victims` out of them.
+	leveldb::Status scan(std::map<uint32_t, uint64_t>* victims, std::map<uint32_t, uint64_t>* live)
+	{
+		leveldb::ReadOptions options;
+		options.fill_cache = false;
+		leveldb::Iterator* it = db->NewIterator(options);
+		leveldb::Status res;
+		Moves moves;
+		ValueLog::Pointer pointer;
+		for (it->SeekToFirst(); it->Valid() && res.ok(); it->Next())
+		{
+			if (!ValueCodec::pointer_of(it->value(), pointer))
+			{
+				continue;
+			}
+			if (live)
+			{
+				(*live)[pointer.file] += ValueLog::header_size + pointer.size;
+			}
+			else if (victims->count(pointer.file))
+			{
+				moves.push_back(std::make_pair(it->key().ToString(), pointer));
+				if (moves.size() >= batch_size)
+				{
+					res = relocate(moves, *victims);
+					moves.clear();
+				}
+			}
+		}
+		if (res.ok() && !moves.empty())
+		{
+			res = relocate(moves, *victims);
+		}
+		if (res.ok())
+		{
+			res = it->status();
+		}
+		delete it;
+		return res;
+	}
+
+	leveldb::Status relocate(const Moves& moves, std::map<uint32_t, uint64_t>& victims)
+	{
+		std::vector<ValueLog::Pointer> moved(moves.size());
+		std::string scratch;
+		leveldb::Slice payload;
+		leveldb::Status res;
+		for (size_t i = 0; res.ok() && i < moves.size(); ++i)
+		{
+			res = log->read(moves[i].second, scratch, &payload);
+			if (res.ok())
+			{
+				res = log->append(payload, &moved[i]);
+			}
+		}
+		if (res.ok())
+		{
+			res = log->sync();
+		}
+		if (!res.ok())
+		{
+			return res;
+		}
+
+		leveldb::WriteBatch batch;
+		std::string stored, encoded;
+		ValueLog::Pointer current;
+		log->lock_writes();
+		for (size_t i = 0; i < moves.size(); ++i)
+		{
+			leveldb::Status found = db->Get(leveldb::ReadOptions(), leveldb::Slice(moves[i].first), &stored);
+			if (found.ok() && ValueCodec::pointer_of(leveldb::Slice(stored), current) && current == moves[i].second)
+			{
+				ValueCodec::encode_pointer(moved[i], encoded);
+				batch.Put(leveldb::Slice(moves[i].first), leveldb::Slice(encoded));
+				++victims[moves[i].second.file];
+				++relocated;
+			}
+		}
+		// synced, the files are deleted once the swaps are durable: a crash must not bring back pointers into them.
+		leveldb::WriteOptions options;
+		options.sync = true;
+		res = db->Write(options, &batch);
+		log->unlock_writes();
+		return res;
+	}
 };
 
 class ApproximateSizeJob: public Job, public Execute<ApproximateSizeJob>
@@ -287,6 +1218,199 @@ public:
 	}
 };
 
+typedef std::vector<leveldb::DB*> DBList;
+
+class OpenShardsJob: public Job, public Execute<OpenShardsJob>
+{
+public:
+	const leveldb::Options options;
+	const std::string directory;
+	const size_t count;
+	DBList* shards;		// the handle's, set on the loop once every shard is open.
+	DBList opened;
+	bool* opening;		// the handle's, cleared when the job calls back.
+
+	OpenShardsJob(const leveldb::Options& options_, const std::string& directory_, size_t count_, DBList* shards_, Callback callback_):
+		Job(NULL, callback_), options(options_), directory(directory_), count(count_), shards(shards_), opening(NULL)
+	{}
+
+	static std::string shard_directory(const std::string& directory, size_t shard)
+	{
+		char name[16];
+		snprintf(name, sizeof(name), "/shard-%03u", static_cast<unsigned>(shard));
+		return directory + name;
+	}
+
+	virtual void operate()
+	{
+		leveldb::Env* env = options.env ? options.env : leveldb::Env::Default();
+		env->CreateDir(directory);		// may exist already.
+
+		for (size_t i = 0; i < count; ++i)
+		{
+			leveldb::DB* shard = NULL;
+			status = leveldb::DB::Open(options, shard_directory(directory, i), &shard);
+			if (CS_BUNLIKELY(!status.ok()))
+			{
+				for (DBList::iterator it = opened.begin(); it != opened.end(); ++it)
+				{
+					delete *it;
+				}
+				opened.clear();
+				return;
+			}
+			opened.push_back(shard);
+		}
+	}
+};
+
+class CloseShardsJob: public Job, public Execute<CloseShardsJob>
+{
+public:
+	DBList shards;
+	leveldb::Cache* cache;
+	leveldb::Env* env;
+
+	CloseShardsJob(const DBList& shards_, leveldb::Cache* cache_, Callback callback_):
+		Job(NULL, callback_), shards(shards_), cache(cache_), env(NULL)
+	{}
+
+	virtual void operate()
+	{
+		for (DBList::iterator it = shards.begin(); it != shards.end(); ++it)
+		{
+			delete *it;
+		}
+		delete cache;
+		delete env;
+	}
+};
+
+// Writes a batch split by shard. Each shard's part is applied atomically, but not the batch as a whole.
+class ShardedBatchJob: public Job, public Execute<ShardedBatchJob>
+{
+public:
+	const leveldb::WriteOptions options;
+	const DBList shards;
+	std::vector<leveldb::WriteBatch> batches;
+	std::vector<bool> touched;
+
+	ShardedBatchJob(const DBList& shards_, const leveldb::WriteOptions& options_, Callback callback_):
+		Job(NULL, callback_), options(options_), shards(shards_), batches(shards_.size()), touched(shards_.size(), false)
+	{}
+
+	virtual void operate()
+	{
+		status = status_ok;
+		for (size_t i = 0; i < shards.size() && status.ok(); ++i)
+		{
+			if (touched[i])
+			{
+				status = shards[i]->Write(options, &batches[i]);
+			}
+		}
+	}
+};
+
+class AggregateJob: public Job, public Execute<AggregateJob>
+{
+public:
+	const leveldb::ReadOptions options;
+	const std::string start, end;	// scans [start, end), an empty `end` means no upper bound.
+	const AggregateOp op;
+	const AggregateValueType value_type;
+	const leveldb::Comparator* const comparator;
+	const ValueCodec* codec;
+
+	uint64_t count, bytes;
+	uint64_t reduced, skipped;	// values reduced, and values skipped for not being of the expected width.
+	double result;
+
+	AggregateJob(leveldb::DB* db, const leveldb::ReadOptions& options_,
+			const leveldb::Slice& start_, const leveldb::Slice& end_,
+			AggregateOp op_, AggregateValueType value_type_, const leveldb::Comparator* comparator_, Callback callback_):
+		Job(db, callback_), options(options_),
+		start(start_.data(), start_.size()), end(end_.data(), end_.size()),
+		op(op_), value_type(value_type_), comparator(comparator_), codec(NULL), count(0), bytes(0), reduced(0), skipped(0), result(0)
+	{}
+
+	virtual void operate()
+	{
+		leveldb::Iterator* it = DecodingIterator::wrap(db->NewIterator(options), codec);
+		if (start.empty())
+		{
+			it->SeekToFirst();
+		}
+		else
+		{
+			it->Seek(leveldb::Slice(start));
+		}
+
+		// values are decoded when read: with a `valueCodec`, `bytes` and the reductions decode every value
+		// of the range (the sizes are those of the decoded values), `count` reads none.
+		if (op == AggregateCount)
+		{
+			for (; it->Valid() && in_range(it->key()); it->Next())
+			{
+				++count;
+			}
+			result = static_cast<double>(count);
+		}
+		else if (op == AggregateBytes)
+		{
+			for (; it->Valid() && in_range(it->key()); it->Next())
+			{
+				++count;
+				bytes += it->value().size();
+			}
+			result = static_cast<double>(bytes);
+		}
+		else if (value_type == AggregateF64)
+		{
+			reduce<double, double>(it);
+		}
+		else if (value_type == AggregateI64)
+		{
+			reduce<int64_t, int64_t>(it);
+		}
+		else
+		{
+			reduce<uint32_t, uint64_t>(it);
+		}
+
+		status = it->status();
+		delete it;
+	}
+
+private:
+	CS_FORCE_INLINE bool in_range(const leveldb::Slice& key) const
+	{
+		return end.empty() || comparator->Compare(key, leveldb::Slice(end)) < 0;
+	}
+
+	template<typename T, typename Acc>
+	void reduce(leveldb::Iterator* it)
+	{
+		aggregate::Reducer<T, Acc> reducer(op);
+		for (; it->Valid() && in_range(it->key()); it->Next())
+		{
+			leveldb::Slice value = it->value();
+			++count;
+			bytes += value.size();
+			if (CS_BLIKELY(value.size() == sizeof(T)))
+			{
+				reducer.add(value.data());
+				++reduced;
+			}
+			else
+			{
+				++skipped;
+			}
+		}
+		result = reducer.finish();
+	}
+};
+
 class RepairJob: public Job, public Execute<RepairJob>
 {
 public:
@@ -305,6 +1429,11 @@ public:
 	{
 		status = leveldb::RepairDB(location, options);
 	}
+
+	virtual ~RepairJob()
+	{
+		delete options.block_cache;
+	}
 };
 
 class DestroyJob: public Job, public Execute<DestroyJob>
@@ -324,6 +1453,82 @@ public:
 	virtual void operate()
 	{
 		status = leveldb::DestroyDB(location, options);
+		if (status.ok())
+		{
+			status = remove_own_files();
+		}
+	}
+
+	// DestroyDB leaves the files leveldb does not know of, the value log, the dictionaries and HOTKEYS,
+	// and the directory with them.
+	leveldb::Status remove_own_files() const
+	{
+		std::vector<std::string> children;
+		if (!options.env->GetChildren(location, &children).ok())
+		{
+			// the directory went with the database.
+			return status_ok;
+		}
+		leveldb::Status res;
+		for (std::vector<std::string>::const_iterator it = children.begin(); it != children.end(); ++it)
+		{
+			if (ValueLog::is_file(*it) || ValueCodec::is_file(*it) || HotKeysFile::is_file(*it))
+			{
+				leveldb::Status removed = options.env->DeleteFile(location + "/" + *it);
+				res = res.ok() ? removed : res;
+			}
+		}
+		// fails when other files are left, as in DestroyDB.
+		options.env->DeleteDir(location);
+		return res;
+	}
+
+	virtual ~DestroyJob()
+	{
+		delete options.block_cache;
+	}
+};
+
+// Samples values of the database on a worker thread, and trains a value dictionary on them.
+class TrainDictionaryJob: public Job, public Execute<TrainDictionaryJob>
+{
+public:
+	ValueCodec* const codec;
+	leveldb::Env* const env;
+	const std::string directory;
+	const size_t max_samples, dict_size;
+
+	size_t samples;
+	uint32_t id;
+
+	TrainDictionaryJob(leveldb::DB* db, ValueCodec* codec_, leveldb::Env* env_, const std::string& directory_,
+			size_t max_samples_, size_t dict_size_, Callback callback_):
+		Job(db, callback_), codec(codec_), env(env_), directory(directory_),
+		max_samples(max_samples_), dict_size(dict_size_), samples(0), id(0)
+	{}
+
+	virtual void operate()
+	{
+		leveldb::ReadOptions options;
+		options.fill_cache = false;
+		leveldb::Iterator* it = DecodingIterator::wrap(db->NewIterator(options), codec);
+
+		std::string content;
+		std::vector<size_t> sizes;
+		for (it->SeekToFirst(); it->Valid() && sizes.size() < max_samples; it->Next())
+		{
+			leveldb::Slice value = it->value();
+			content.append(value.data(), value.size());
+			sizes.push_back(value.size());
+		}
+		status = it->status();
+		delete it;
+		samples = sizes.size();
+
+		if (status.ok())
+		{
+			status = codec->train(env, directory, content, sizes, dict_size, &id);
+		}
 	}
 };
 
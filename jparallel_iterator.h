@@ -0,0 +1,577 @@
+#pragma once
+
+#include "./assist.h"
+#include <deque>
+#include <string>
+#include <vector>
+#include <v8.h>
+#include <node.h>
+#include <node_buffer.h>
+#include <uv.h>
+#include <db.h>
+#include <iterator.h>
+#include "./jobs.h"
+#include "./jiterator.h"
+#include "./jstatus.h"
+
+namespace leveldb {
+
+class ScanChunk
+{
+public:
+	std::vector<std::string> keys, values;
+};
+
+// One of the sub-ranges [lower, upper) a parallel scan is split into. An empty `upper` means no upper bound.
+// `iter` is only touched by the ScanChunkJob in flight, and everything else only on the event loop,
+// never both at the same time since `busy` is set before queueing.
+class ScanRange
+{
+public:
+	std::string lower, upper;
+	leveldb::Iterator* iter;
+	bool exhausted, busy;
+	std::deque<ScanChunk*> ready;
+
+	ScanRange(const std::string& lower_, const std::string& upper_):
+		lower(lower_), upper(upper_), iter(NULL), exhausted(false), busy(false)
+	{}
+
+	~ScanRange()
+	{
+		delete iter;
+		for (std::deque<ScanChunk*>::iterator it = ready.begin(); it != ready.end(); ++it)
+		{
+			delete *it;
+		}
+	}
+
+	CS_FORCE_INLINE bool in_range(const leveldb::Slice& key) const
+	{
+		return upper.empty() || key.compare(leveldb::Slice(upper)) < 0;
+	}
+};
+
+typedef std::vector<ScanRange*> ScanRangeList;
+
+// Splits [start, end) into `parts` sub-ranges of about the same on-disk size.
+// Keys are mapped to numbers by the 8 bytes that follow the common prefix of `start` and `end`,
+// each boundary is bisected on that number against `GetApproximateSizes`.
+// Falls back to even splitting of that key space if nothing has been flushed to tables yet.
+class SplitRangeJob: public Job, public Execute<SplitRangeJob>
+{
+public:
+	const leveldb::ReadOptions options;
+	const std::string start, end;
+	const size_t parts;
+	void* const owner;
+	const ValueCodec* codec;	// values are decoded by the scans, on the worker threads.
+	size_t readahead;
+	ScanRangeList ranges;
+
+	SplitRangeJob(leveldb::DB* db, const leveldb::ReadOptions& options_, const std::string& start_, const std::string& end_,
+			size_t parts_, void* owner_):
+		Job(db, Callback()), options(options_), start(start_), end(end_), parts(parts_), owner(owner_), codec(NULL), readahead(0)
+	{}
+
+	virtual void operate()
+	{
+		std::vector<std::string> bounds;
+		split(bounds);
+
+		std::string lower = start;
+		for (size_t i = 0; i <= bounds.size(); ++i)
+		{
+			ScanRange* range = new ScanRange(lower, i < bounds.size() ? bounds[i] : end);
+			range->iter = DecodingIterator::wrap(envs::ReadaheadIterator::wrap(db->NewIterator(options), readahead), codec);
+			if (range->lower.empty())
+			{
+				range->iter->SeekToFirst();
+			}
+			else
+			{
+				range->iter->Seek(leveldb::Slice(range->lower));
+			}
+			ranges.push_back(range);
+			if (i < bounds.size())
+			{
+				lower = bounds[i];
+			}
+		}
+	}
+
+private:
+	static uint64_t number_at(const std::string& key, size_t offset)
+	{
+		uint64_t number = 0;
+		for (size_t i = 0; i < 8; ++i)
+		{
+			number <<= 8;
+			if (offset + i < key.size())
+			{
+				number |= static_cast<unsigned char>(key[offset + i]);
+			}
+		}
+		return number;
+	}
+
+	static std::string key_at(const std::string& prefix, uint64_t number)
+	{
+		std::string key(prefix);
+		for (int shift = 56; shift >= 0; shift -= 8)
+		{
+			key.push_back(static_cast<char>((number >> shift) & 0xff));
+		}
+		return key;
+	}
+
+	uint64_t size_between(const std::string& from, const std::string& to)
+	{
+		leveldb::Range range((leveldb::Slice(from)), leveldb::Slice(to));
+		uint64_t size = 0;
+		db->GetApproximateSizes(&range, 1, &size);
+		return size;
+	}
+
+	void split(std::vector<std::string>& bounds)
+	{
+		size_t prefix_len = 0;
+		if (!end.empty())
+		{
+			while (prefix_len < start.size() && prefix_len < end.size() && start[prefix_len] == end[prefix_len])
+			{
+				++prefix_len;
+			}
+		}
+		const std::string prefix = start.substr(0, prefix_len);
+		const uint64_t lo = number_at(start, prefix_len);
+		const uint64_t hi = end.empty() ? ~static_cast<uint64_t>(0) : number_at(end, prefix_len);
+		if (hi <= lo || hi - lo <= parts)
+		{
+			return;
+		}
+
+		const std::string upper = end.empty() ? key_at(prefix, hi) : end;
+		const uint64_t total = size_between(start, upper);
+		uint64_t previous = lo;
+		for (size_t i = 1; i < parts; ++i)
+		{
+			uint64_t bound;
+			if (total == 0)
+			{
+				bound = lo + (hi - lo) / parts * i;
+			}
+			else
+			{
+				const uint64_t target = total / parts * i;
+				uint64_t left = previous, right = hi;
+				while (right - left > 1)
+				{
+					uint64_t mid = left + (right - left) / 2;
+					if (size_between(start, key_at(prefix, mid)) < target)
+					{
+						left = mid;
+					}
+					else
+					{
+						right = mid;
+					}
+				}
+				bound = right;
+			}
+			if (bound > previous && bound < hi)
+			{
+				bounds.push_back(key_at(prefix, bound));
+				previous = bound;
+			}
+		}
+	}
+};
+
+class ScanChunkJob: public Job, public Execute<ScanChunkJob>
+{
+public:
+	ScanRange* const range;
+	const size_t chunk_size;
+	const bool keys, values;
+	const Projection value_range;
+	void* const owner;
+	ScanChunk* chunk;
+
+	ScanChunkJob(leveldb::DB* db, ScanRange* range_, size_t chunk_size_, bool keys_, bool values_, const Projection& value_range_,
+			void* owner_):
+		Job(db, Callback()), range(range_), chunk_size(chunk_size_), keys(keys_), values(values_), value_range(value_range_),
+		owner(owner_), chunk(new ScanChunk)
+	{}
+
+	virtual void operate()
+	{
+		leveldb::Iterator* iter = range->iter;
+		size_t n = 0;
+		for (; n < chunk_size && iter->Valid() && range->in_range(iter->key()); ++n, iter->Next())
+		{
+			if (keys)
+			{
+				chunk->keys.push_back(iter->key().ToString());
+			}
+			if (values)
+			{
+				chunk->values.push_back(std::string());
+				value_range.assign(iter->value(), chunk->values.back());
+			}
+		}
+		status = iter->status();
+		range->exhausted = n < chunk_size || !status.ok();
+	}
+
+	virtual ~ScanChunkJob()
+	{
+		delete chunk;
+	}
+};
+
+// Scans [start, end) with `parallelism` iterators over one snapshot, each on a worker thread,
+// and hands out the entries in chunks. With `ordered` the chunks come in key order,
+// otherwise whichever chunk is ready first.
+// Holds the database from creation to `end` (or collection), a `close` meanwhile waits for it.
+class JparallelIterator: public node::ObjectWrap
+{
+private:
+	static const size_t max_ready_chunks = 2;
+
+	leveldb::DB* db;
+	const leveldb::Snapshot* snapshot;
+	leveldb::ReadOptions read_options;
+	IterOptions options;
+
+	ScanRangeList ranges;
+	bool planned, ended;
+	size_t cursor;
+	size_t inflight;
+	Callback pending;
+	leveldb::Status failure;		// of a job, answered to every `nextChunk` from then on.
+
+	static v8::Persistent<v8::Function> jsctor;
+
+public:
+	JparallelIterator():
+		db(NULL), snapshot(NULL), planned(false), ended(false), cursor(0), inflight(0)
+	{}
+
+	static void init(v8::Handle<v8::Object> exports)
+	{
+		v8::Local<v8::FunctionTemplate> tpl = v8::FunctionTemplate::New(js_new);
+		tpl->SetClassName(v8::String::NewSymbol("ParallelIterator"));
+		tpl->InstanceTemplate()->SetInternalFieldCount(1);
+
+		v8::Local<v8::ObjectTemplate> prototype = tpl->PrototypeTemplate();
+		attach_func(prototype, "nextChunk", js_next_chunk);
+		attach_func(prototype, "end", js_end);
+
+		jsctor = v8::Persistent<v8::Function>::New(tpl->GetFunction());
+	}
+
+	static v8::Local<v8::Value> create(leveldb::DB* db, const leveldb::ReadOptions& read_options, const IterOptions& iter_options,
+			const ValueCodec* codec = NULL)
+	{
+		v8::HandleScope scope;
+		v8::Local<v8::Object> js_iter = jsctor->NewInstance();
+		JparallelIterator* self = node::ObjectWrap::Unwrap<JparallelIterator>(js_iter);
+		self->db = db;
+		self->snapshot = db->GetSnapshot();
+		Dispatcher::instance().hold(db);
+		self->read_options = read_options;
+		self->read_options.snapshot = self->snapshot;
+		self->options = iter_options;
+
+		SplitRangeJob* job = new SplitRangeJob(db, self->read_options, iter_options.start, iter_options.end,
+				iter_options.parallelism, self);
+		job->codec = codec;
+		job->readahead = iter_options.readahead;
+		self->started();
+		Dispatcher::instance().queue(&job->uv_work, job->execute, on_split, iter_options.priority, job->db);
+
+		return scope.Close(js_iter);
+	}
+
+	static v8::Handle<v8::Value> js_new(const v8::Arguments& args)
+	{
+		v8::HandleScope scope;
+		JparallelIterator* instance = new JparallelIterator;
+		instance->Wrap(args.This());
+		return scope.Close(args.This());
+	}
+
+	static v8::Handle<v8::Value> js_next_chunk(const v8::Arguments& args)
+	{
+		v8::HandleScope scope;
+
+		if (CS_BUNLIKELY(args.Length() < 1 || !args[0]->IsFunction()))
+		{
+			raise_typeerr("the first argument (callback) must be a Function.");
+			return scope.Close(v8::Undefined());
+		}
+
+		JparallelIterator* self = node::ObjectWrap::Unwrap<JparallelIterator>(args.This());
+		if (CS_BUNLIKELY(!self->pending.IsEmpty()))
+		{
+			raise_err("`nextChunk` is called again before the previous one called back.");
+			return scope.Close(v8::Undefined());
+		}
+		if (CS_BUNLIKELY(self->ended))
+		{
+			raise_err("the iterator has ended.");
+			return scope.Close(v8::Undefined());
+		}
+
+		self->pending = v8::Persistent<v8::Function>::New(v8::Local<v8::Function>::Cast(args[0]));
+		self->deliver();
+		self->pump();
+
+		return args.This();
+	}
+
+	static v8::Handle<v8::Value> js_end(const v8::Arguments& args)
+	{
+		v8::HandleScope scope;
+
+		JparallelIterator* self = node::ObjectWrap::Unwrap<JparallelIterator>(args.This());
+		self->ended = true;
+		if (!self->pending.IsEmpty())
+		{
+			self->pending.Dispose();
+			self->pending.Clear();
+		}
+		self->release();
+
+		if (args.Length() > 0 && args[0]->IsFunction())
+		{
+			v8::Local<v8::Function>::Cast(args[0])->Call(v8::Context::GetCurrent()->Global(), 0, NULL);
+		}
+
+		return scope.Close(v8::Undefined());
+	}
+
+	~JparallelIterator()
+	{
+		release();
+	}
+
+private:
+	// keep the js object alive while jobs refer to it.
+	void started()
+	{
+		if (inflight++ == 0)
+		{
+			Ref();
+		}
+	}
+
+	void finished()
+	{
+		if (--inflight == 0)
+		{
+			if (ended)
+			{
+				release();
+			}
+			Unref();
+		}
+	}
+
+	// frees the ranges and the snapshot, once no job uses them, and lets a `close` waiting on the database go.
+	void release()
+	{
+		if (inflight)
+		{
+			return;
+		}
+		for (ScanRangeList::iterator it = ranges.begin(); it != ranges.end(); ++it)
+		{
+			delete *it;
+		}
+		ranges.clear();
+		if (snapshot)
+		{
+			db->ReleaseSnapshot(snapshot);
+			snapshot = NULL;
+			Dispatcher::instance().release(db);
+		}
+	}
+
+	void pump()
+	{
+		if (!planned || ended || !failure.ok())
+		{
+			return;
+		}
+		for (ScanRangeList::iterator it = ranges.begin(); it != ranges.end(); ++it)
+		{
+			ScanRange* range = *it;
+			if (!range->busy && !range->exhausted && range->ready.size() < max_ready_chunks)
+			{
+				range->busy = true;
+				ScanChunkJob* job = new ScanChunkJob(db, range, options.chunk_size, options.keys, options.values, options.value_range, this);
+				started();
+				Dispatcher::instance().queue(&job->uv_work, job->execute, on_chunk, options.priority, job->db);
+			}
+		}
+	}
+
+	// the range to take the next chunk from, NULL if none is ready yet. `done` tells whether all are drained.
+	ScanRange* next_ready(bool& done)
+	{
+		done = false;
+		if (options.ordered)
+		{
+			while (cursor < ranges.size() && ranges[cursor]->exhausted && !ranges[cursor]->busy && ranges[cursor]->ready.empty())
+			{
+				++cursor;
+			}
+			if (cursor == ranges.size())
+			{
+				done = true;
+				return NULL;
+			}
+			return ranges[cursor]->ready.empty() ? NULL : ranges[cursor];
+		}
+
+		bool drained = true;
+		for (size_t i = 0; i < ranges.size(); ++i)
+		{
+			ScanRange* range = ranges[(cursor + i) % ranges.size()];
+			if (!range->ready.empty())
+			{
+				cursor = (cursor + i + 1) % ranges.size();
+				return range;
+			}
+			drained = drained && range->exhausted && !range->busy;
+		}
+		done = drained;
+		return NULL;
+	}
+
+	void deliver()
+	{
+		if (pending.IsEmpty())
+		{
+			return;
+		}
+		if (CS_BUNLIKELY(!failure.ok()))
+		{
+			v8::HandleScope scope;
+			Callback callback = pending;
+			pending.Clear();
+			const int argc = 1;
+			v8::Local<v8::Value> argv[argc] = { Jstatus::convert(failure) };
+			callback->Call(v8::Context::GetCurrent()->Global(), argc, argv);
+			callback.Dispose();
+			return;
+		}
+		if (!planned)
+		{
+			return;
+		}
+
+		bool done;
+		ScanRange* range = next_ready(done);
+		if (!range && !done)
+		{
+			return;
+		}
+
+		v8::HandleScope scope;
+		Callback callback = pending;
+		pending.Clear();
+
+		if (done)
+		{
+			callback->Call(v8::Context::GetCurrent()->Global(), 0, NULL);
+			callback.Dispose();
+			return;
+		}
+
+		ScanChunk* chunk = range->ready.front();
+		range->ready.pop_front();
+
+		const int argc = 3;
+		v8::Local<v8::Value> argv[argc] = {
+			v8::Local<v8::Value>::New(v8::Undefined()),
+			to_array(chunk->keys, options.key_as_buffer),
+			to_array(chunk->values, options.value_as_buffer)
+		};
+		delete chunk;
+		callback->Call(v8::Context::GetCurrent()->Global(), argc, argv);
+		callback.Dispose();
+	}
+
+	// kept for the `nextChunk` after when none is waiting.
+	void fail(const leveldb::Status& status)
+	{
+		if (failure.ok())
+		{
+			failure = status;
+		}
+		deliver();
+	}
+
+	static v8::Local<v8::Value> to_array(const std::vector<std::string>& items, bool as_buffer)
+	{
+		v8::HandleScope scope;
+		v8::Local<v8::Array> array = v8::Array::New(items.size());
+		for (size_t i = 0; i < items.size(); ++i)
+		{
+			if (as_buffer)
+			{
+				array->Set(i, node::Buffer::New(items[i].data(), items[i].size())->handle_);
+			}
+			else
+			{
+				array->Set(i, v8::String::New(items[i].data(), items[i].size()));
+			}
+		}
+		return scope.Close(array);
+	}
+
+	static void on_split(uv_work_t* uv_work, int uv_status)
+	{
+		SplitRangeJob* job = reinterpret_cast<SplitRangeJob*>(uv_work->data);
+		JparallelIterator* self = static_cast<JparallelIterator*>(job->owner);
+		self->ranges.swap(job->ranges);
+		self->planned = true;
+		if (CS_BUNLIKELY(!job->status.ok()))
+		{
+			self->fail(job->status);
+		}
+		delete job;
+
+		self->pump();
+		self->deliver();
+		self->finished();
+	}
+
+	static void on_chunk(uv_work_t* uv_work, int uv_status)
+	{
+		ScanChunkJob* job = reinterpret_cast<ScanChunkJob*>(uv_work->data);
+		JparallelIterator* self = static_cast<JparallelIterator*>(job->owner);
+		job->range->busy = false;
+		if (CS_BLIKELY(job->status.ok()))
+		{
+			if (!job->chunk->keys.empty() || !job->chunk->values.empty())
+			{
+				job->range->ready.push_back(job->chunk);
+				job->chunk = NULL;
+			}
+			self->pump();
+			self->deliver();
+		}
+		else
+		{
+			self->fail(job->status);
+		}
+		delete job;
+		self->finished();
+	}
+};
+
+}
@@ -0,0 +1,89 @@
+#pragma once
+
+#include "./assist.h"
+#include <v8.h>
+#include <node.h>
+#include "./shared_cache.h"
+
+namespace leveldb {
+
+// js handle of `SharedResources`: `new SharedResources({cacheSize: n})`, then `db.open({shared: handle}, cb)`.
+class Jresources: public node::ObjectWrap
+{
+private:
+	SharedResources* resources;
+
+	static v8::Persistent<v8::FunctionTemplate> jstpl;
+
+public:
+	explicit Jresources(SharedResources* resources_):
+		resources(resources_)
+	{}
+
+	virtual ~Jresources()
+	{
+		resources->unref();
+	}
+
+	static void init(v8::Handle<v8::Object> exports)
+	{
+		v8::Local<v8::FunctionTemplate> tpl = v8::FunctionTemplate::New(js_new);
+		tpl->SetClassName(v8::String::NewSymbol("SharedResources"));
+		tpl->InstanceTemplate()->SetInternalFieldCount(1);
+
+		v8::Local<v8::ObjectTemplate> prototype = tpl->PrototypeTemplate();
+		attach_func(prototype, "stats", js_stats);
+
+		jstpl = v8::Persistent<v8::FunctionTemplate>::New(tpl);
+		exports->Set(v8::String::NewSymbol("SharedResources"), tpl->GetFunction());
+	}
+
+	// NULL unless `value` is a js `SharedResources`.
+	static SharedResources* unwrap(const v8::Handle<v8::Value>& value)
+	{
+		if (!jstpl->HasInstance(value))
+		{
+			return NULL;
+		}
+		return node::ObjectWrap::Unwrap<Jresources>(value->ToObject())->resources;
+	}
+
+	static v8::Handle<v8::Value> js_new(const v8::Arguments& args)
+	{
+		v8::HandleScope scope;
+
+		int64_t cache_size = 8 << 20;
+		if (args.Length() > 0 && args[0]->IsObject())
+		{
+			v8::Local<v8::String> key = v8::String::New("cacheSize");
+			v8::Local<v8::Object> opts_from = args[0]->ToObject();
+			if (opts_from->Has(key))
+			{
+				cache_size = opts_from->Get(key)->ToInteger()->Value();
+			}
+		}
+		if (CS_BUNLIKELY(cache_size <= 0))
+		{
+			raise_typeerr("`cacheSize` must be positive.");
+			return scope.Close(v8::Undefined());
+		}
+
+		Jresources* instance = new Jresources(new SharedResources(cache_size));
+		instance->Wrap(args.This());
+		return scope.Close(args.This());
+	}
+
+	static v8::Handle<v8::Value> js_stats(const v8::Arguments& args)
+	{
+		v8::HandleScope scope;
+		const SharedResources* resources = node::ObjectWrap::Unwrap<Jresources>(args.This())->resources;
+
+		v8::Local<v8::Object> res = v8::Object::New();
+		res->Set(v8::String::NewSymbol("capacity"), v8::Number::New(resources->capacity));
+		res->Set(v8::String::NewSymbol("usage"), v8::Number::New(resources->usage));
+		res->Set(v8::String::NewSymbol("databases"), v8::Number::New(resources->databases));
+		return scope.Close(res);
+	}
+};
+
+}
@@ -4,7 +4,9 @@
 #include <v8.h>
 #include <node.h>
 #include <status.h>
+#include <string>
 #include "assist.h"
+#include "./jobs.h"
 
 namespace leveldb
 {
@@ -12,15 +14,22 @@ namespace leveldb
 class Jstatus: public node::ObjectWrap
 {
 private:
+	// statuses that carry no detail are shared, frozen instances of these.
+	enum Code {CodeOk, CodeNotFound, CodeIOError, CodeCorruption, CodeWouldBlock, CodeTimedOut, CodeCount};
+
 	leveldb::Status status;
 
 	static v8::Persistent<v8::Function> jsctor;
 
+	static v8::Persistent<v8::Object> interned[CodeCount];
+
 	static const v8::Persistent<v8::String> js_err_ok;
 	static const v8::Persistent<v8::String> js_err_prefix;
 	static const v8::Persistent<v8::String> js_err_io_error;
 	static const v8::Persistent<v8::String> js_err_not_found;
 	static const v8::Persistent<v8::String> js_err_corruption;
+	static const v8::Persistent<v8::String> js_err_would_block;
+	static const v8::Persistent<v8::String> js_err_timed_out;
 	static const v8::Persistent<v8::String> js_err_unknown;
 
 public:
@@ -33,6 +42,39 @@ public:
 	{}
 
 	static v8::Local<v8::Value> convert(const leveldb::Status& status_)
+	{
+		if (status_.ok())
+		{
+			return v8::Local<v8::Value>::New(interned[CodeOk]);
+		}
+		// leveldb never puts a detail into a miss.
+		if (CS_BLIKELY(status_.IsNotFound()))
+		{
+			return v8::Local<v8::Value>::New(interned[CodeNotFound]);
+		}
+		if (is_would_block(status_))
+		{
+			return v8::Local<v8::Value>::New(interned[CodeWouldBlock]);
+		}
+		if (is_timed_out(status_))
+		{
+			return v8::Local<v8::Value>::New(interned[CodeTimedOut]);
+		}
+		if (detail(status_).empty())
+		{
+			if (status_.IsIOError())
+			{
+				return v8::Local<v8::Value>::New(interned[CodeIOError]);
+			}
+			if (status_.IsCorruption())
+			{
+				return v8::Local<v8::Value>::New(interned[CodeCorruption]);
+			}
+		}
+		return instantiate(status_);
+	}
+
+	static v8::Local<v8::Object> instantiate(const leveldb::Status& status_)
 	{
 		v8::HandleScope scope;
 
@@ -43,6 +85,24 @@ public:
 		return scope.Close(status);
 	}
 
+	// the message of `status` without its "<Code>: " prefix.
+	static std::string detail(const leveldb::Status& status)
+	{
+		if (status.ok())
+		{
+			return std::string();
+		}
+		std::string text = status.ToString();
+		std::string::size_type colon = text.find(": ");
+		return colon == std::string::npos ? std::string() : text.substr(colon + 2);
+	}
+
+	// an I/O error made by a job rather than by leveldb, whose message starts with `reason`.
+	static bool made_for(const leveldb::Status& status, const char* reason)
+	{
+		return status.IsIOError() && leveldb::Slice(detail(status)).starts_with(leveldb::Slice(reason));
+	}
+
 	void set_status(const leveldb::Status& status_)
 	{
 		status = status_;
@@ -76,6 +136,36 @@ public:
 		return node::ObjectWrap::Unwrap<Jstatus>(args.This())->status.IsCorruption() ? v8::True() : v8::False();
 	}
 
+	// refused by admission control, the operation was not queued at all.
+	static v8::Handle<v8::Value> js_is_would_block(const v8::Arguments& args)
+	{
+		return is_would_block(node::ObjectWrap::Unwrap<Jstatus>(args.This())->status) ? v8::True() : v8::False();
+	}
+
+	static bool is_would_block(const leveldb::Status& status)
+	{
+		return made_for(status, Job::would_block_reason);
+	}
+
+	// still queued past its `timeoutMs` or `deadline`, the operation was skipped.
+	static v8::Handle<v8::Value> js_is_timed_out(const v8::Arguments& args)
+	{
+		return is_timed_out(node::ObjectWrap::Unwrap<Jstatus>(args.This())->status) ? v8::True() : v8::False();
+	}
+
+	static bool is_timed_out(const leveldb::Status& status)
+	{
+		return made_for(status, Job::timed_out_reason);
+	}
+
+	// built on access only, instances shared by every miss never build it.
+	static v8::Handle<v8::Value> js_message(v8::Local<v8::String> property, const v8::AccessorInfo& info)
+	{
+		v8::HandleScope scope;
+		std::string message = detail(node::ObjectWrap::Unwrap<Jstatus>(info.Holder())->status);
+		return scope.Close(v8::String::New(message.data(), message.size()));
+	}
+
 	static v8::Handle<v8::Value> js_to_string(const v8::Arguments& args)
 	{
 		v8::HandleScope scope;
@@ -88,6 +178,14 @@ public:
 		{
 			return scope.Close(js_err_ok);
 		}
+		else if (is_would_block(self->status))
+		{
+			return scope.Close(v8::String::Concat(js_err_prefix, js_err_would_block));
+		}
+		else if (is_timed_out(self->status))
+		{
+			return scope.Close(v8::String::Concat(js_err_prefix, js_err_timed_out));
+		}
 		else if (self->status.IsIOError())
 		{
 			return scope.Close(v8::String::Concat(js_err_prefix, js_err_io_error));
@@ -110,10 +208,34 @@ public:
 		attach_func(prototype, "isIOError", js_is_io_error);
 		attach_func(prototype, "isNotFound", js_is_not_found);
 		attach_func(prototype, "isCorruption", js_is_corruption);
+		attach_func(prototype, "isWouldBlock", js_is_would_block);
+		attach_func(prototype, "isTimedOut", js_is_timed_out);
 		attach_func(prototype, "toString", js_to_string);
 
+		tpl->InstanceTemplate()->SetAccessor(v8::String::NewSymbol("message"), js_message);
+
 		jsctor = v8::Persistent<v8::Function>::New(tpl->GetFunction());
 		exports->Set(v8::String::NewSymbol("Status"), jsctor);
+
+		intern(CodeOk, leveldb::Status::OK());
+		intern(CodeNotFound, Job::status_not_found);
+		intern(CodeIOError, leveldb::Status::IOError(leveldb::Slice()));
+		intern(CodeCorruption, leveldb::Status::Corruption(leveldb::Slice()));
+		intern(CodeWouldBlock, Job::status_would_block);
+		intern(CodeTimedOut, Job::status_timed_out);
+	}
+
+private:
+	// frozen, since every callback that gets one shares it.
+	static void intern(Code code, const leveldb::Status& status_)
+	{
+		v8::HandleScope scope;
+		v8::Local<v8::Object> status = instantiate(status_);
+		v8::Local<v8::Object> object_ctor = v8::Context::GetCurrent()->Global()->Get(v8::String::NewSymbol("Object"))->ToObject();
+		v8::Local<v8::Function> freeze = v8::Local<v8::Function>::Cast(object_ctor->Get(v8::String::NewSymbol("freeze")));
+		v8::Handle<v8::Value> argv[1] = { status };
+		freeze->Call(object_ctor, 1, argv);
+		interned[code] = v8::Persistent<v8::Object>::New(status);
 	}
 };
 
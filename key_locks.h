@@ -0,0 +1,184 @@
+#pragma once
+
+#include "./assist.h"
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <sched.h>
+#include <stdint.h>
+#include <uv.h>
+#include <slice.h>
+
+namespace leveldb {
+
+// Striped per-key locks, held by worker threads around read-modify-write jobs.
+// A key is guarded by the stripe its hash falls in, so unrelated keys rarely contend.
+// Plain `put`, `del` and `batch` take them too once the first locked job ran, so that no write lands
+// between the read and the write of a check or an update. Until then they skip them, and cost nothing.
+class KeyLocks
+{
+private:
+	static const size_t stripe_count = 256;
+
+	uv_mutex_t stripes[stripe_count];
+
+	volatile uint32_t engaged;		// set by the first locked job, never cleared.
+	volatile uint32_t unlocked_writes;		// plain writes running without the locks, before `engaged`.
+
+	KeyLocks(const KeyLocks&);
+	KeyLocks& operator=(const KeyLocks&);
+
+public:
+	// Locks the stripes of many keys at once, in ascending order so that jobs never deadlock.
+	class Guard
+	{
+	private:
+		KeyLocks* const locks;
+		std::vector<size_t> held;
+
+		Guard(const Guard&);
+		Guard& operator=(const Guard&);
+
+	public:
+		Guard(KeyLocks& locks_, const std::vector<std::string>& keys):
+			locks(&locks_)
+		{
+			locks->engage();
+			acquire(keys);
+		}
+
+		~Guard()
+		{
+			for (std::vector<size_t>::const_reverse_iterator it = held.rbegin(); it != held.rend(); ++it)
+			{
+				uv_mutex_unlock(&locks->stripes[*it]);
+			}
+		}
+
+	private:
+		friend class KeyLocks;
+
+		// locks nothing until `acquire`.
+		explicit Guard(KeyLocks* locks_):
+			locks(locks_)
+		{}
+
+		void acquire(const std::vector<std::string>& keys)
+		{
+			held.reserve(keys.size());
+			for (std::vector<std::string>::const_iterator it = keys.begin(); it != keys.end(); ++it)
+			{
+				held.push_back(stripe_of(Slice(*it)));
+			}
+			std::sort(held.begin(), held.end());
+			held.erase(std::unique(held.begin(), held.end()), held.end());
+			for (std::vector<size_t>::const_iterator it = held.begin(); it != held.end(); ++it)
+			{
+				uv_mutex_lock(&locks->stripes[*it]);
+			}
+		}
+	};
+
+	// Held by a plain write: the stripes of its keys once the database has had a locked job, nothing before.
+	// `locks` may be NULL, for a database without locked jobs at all.
+	class WriteGuard
+	{
+	private:
+		KeyLocks* const locks;
+		Guard guard;
+		bool counted;
+
+		WriteGuard(const WriteGuard&);
+		WriteGuard& operator=(const WriteGuard&);
+
+	public:
+		// then `lock` the keys if `locking()`.
+		explicit WriteGuard(KeyLocks* locks_):
+			locks(locks_), guard(locks_), counted(false)
+		{
+			counted = locks && locks->enter_unlocked();
+		}
+
+		WriteGuard(KeyLocks* locks_, const Slice& key):
+			locks(locks_), guard(locks_), counted(false)
+		{
+			counted = locks && locks->enter_unlocked();
+			if (locking())
+			{
+				lock(std::vector<std::string>(1, key.ToString()));
+			}
+		}
+
+		~WriteGuard()
+		{
+			if (counted)
+			{
+				__sync_fetch_and_sub(&locks->unlocked_writes, 1);
+			}
+		}
+
+		CS_FORCE_INLINE bool locking() const
+		{
+			return locks && !counted;
+		}
+
+		void lock(const std::vector<std::string>& keys)
+		{
+			guard.acquire(keys);
+		}
+	};
+
+	KeyLocks():
+		engaged(0), unlocked_writes(0)
+	{
+		for (size_t i = 0; i < stripe_count; ++i)
+		{
+			uv_mutex_init(&stripes[i]);
+		}
+	}
+
+	~KeyLocks()
+	{
+		for (size_t i = 0; i < stripe_count; ++i)
+		{
+			uv_mutex_destroy(&stripes[i]);
+		}
+	}
+
+	// a write may go on without the locks as long as no locked job ran, true if it does.
+	bool enter_unlocked()
+	{
+		if (engaged)
+		{
+			return false;
+		}
+		__sync_fetch_and_add(&unlocked_writes, 1);
+		if (engaged)
+		{
+			__sync_fetch_and_sub(&unlocked_writes, 1);
+			return false;
+		}
+		return true;
+	}
+
+	// from the first locked job on, writes lock their keys. That job waits out the ones that started without.
+	void engage()
+	{
+		if (CS_BLIKELY(engaged))
+		{
+			return;
+		}
+		__sync_bool_compare_and_swap(&engaged, 0, 1);
+		while (unlocked_writes)
+		{
+			sched_yield();
+		}
+	}
+
+	CS_FORCE_INLINE static size_t stripe_of(const Slice& key)
+	{
+		return hash_bytes(key.data(), key.size()) & (stripe_count - 1);
+	}
+};
+
+}
@@ -0,0 +1,333 @@
+#pragma once
+
+#include "./assist.h"
+#include <string>
+#include <cstring>
+#include <limits>
+#include <stdint.h>
+#include <v8.h>
+#include <node.h>
+#include <node_buffer.h>
+#include <slice.h>
+
+namespace leveldb {
+
+// Order-preserving encoding of tuples (js arrays) into keys, so that keys compare bytewise
+// the way the tuples compare element by element. Each element is a type tag then its bytes:
+//   null        0x00
+//   Buffer      0x01, bytes with 0x00 escaped as 0x00 0xff, then 0x00
+//   string      0x02, utf-8 escaped the same way, then 0x00
+//   number      0x21, the IEEE-754 bits big-endian, sign bit flipped (all bits if negative)
+//   false/true  0x26/0x27
+// Every number is encoded as a double, whether v8 holds it as an integer or not, so that they all order by value.
+// -0 is encoded as 0, and every NaN as one that orders after Infinity.
+namespace keycodec {
+
+enum Tag
+{
+	TagNull = 0x00,
+	TagBytes = 0x01,
+	TagString = 0x02,
+	TagDouble = 0x21,
+	TagFalse = 0x26,
+	TagTrue = 0x27
+};
+
+CS_FORCE_INLINE static void append_escaped(std::string& out, const char* data, size_t size)
+{
+	const char* end = data + size;
+	for (const char* zero; (zero = static_cast<const char*>(std::memchr(data, 0, end - data))) != NULL; data = zero + 1)
+	{
+		out.append(data, zero - data + 1);
+		out.push_back('\xff');
+	}
+	out.append(data, end - data);
+	out.push_back('\0');
+}
+
+CS_FORCE_INLINE static void append_be(std::string& out, uint64_t value, size_t bytes)
+{
+	for (size_t i = bytes; i > 0; --i)
+	{
+		out.push_back(static_cast<char>(value >> ((i - 1) * 8)));
+	}
+}
+
+static void append_double(std::string& out, double value)
+{
+	if (value == 0)
+	{
+		value = 0;
+	}
+	else if (value != value)
+	{
+		value = std::numeric_limits<double>::quiet_NaN();
+	}
+	uint64_t bits;
+	std::memcpy(&bits, &value, sizeof(bits));
+	bits = (bits >> 63) ? ~bits : (bits | (static_cast<uint64_t>(1) << 63));
+	out.push_back(static_cast<char>(TagDouble));
+	append_be(out, bits, 8);
+}
+
+// appends one element, false if its type can not be encoded.
+static bool append_element(std::string& out, const v8::Handle<v8::Value>& value)
+{
+	if (value->IsNull() || value->IsUndefined())
+	{
+		out.push_back(static_cast<char>(TagNull));
+	}
+	else if (value->IsString())
+	{
+		v8::String::Utf8Value data(value);
+		out.push_back(static_cast<char>(TagString));
+		append_escaped(out, *data, data.length());
+	}
+	else if (node::Buffer::HasInstance(value))
+	{
+		v8::Local<v8::Object> buffer = value->ToObject();
+		out.push_back(static_cast<char>(TagBytes));
+		append_escaped(out, node::Buffer::Data(buffer), node::Buffer::Length(buffer));
+	}
+	else if (value->IsNumber())
+	{
+		append_double(out, value->NumberValue());
+	}
+	else if (value->IsBoolean())
+	{
+		out.push_back(static_cast<char>(value->IsTrue() ? TagTrue : TagFalse));
+	}
+	else
+	{
+		return false;
+	}
+	return true;
+}
+
+static bool encode(const v8::Handle<v8::Array>& tuple, std::string& out)
+{
+	for (uint32_t i = 0; i < tuple->Length(); ++i)
+	{
+		if (!append_element(out, tuple->Get(i)))
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+CS_FORCE_INLINE static uint64_t read_be(const char* data, size_t bytes)
+{
+	uint64_t value = 0;
+	for (size_t i = 0; i < bytes; ++i)
+	{
+		value = (value << 8) | static_cast<unsigned char>(data[i]);
+	}
+	return value;
+}
+
+// reads an escaped run starting at `p`, leaves `p` after its terminator.
+static bool read_escaped(const char*& p, const char* end, std::string& out)
+{
+	while (p < end)
+	{
+		const char* zero = static_cast<const char*>(std::memchr(p, 0, end - p));
+		if (!zero)
+		{
+			return false;
+		}
+		out.append(p, zero - p);
+		if (zero + 1 < end && zero[1] == '\xff')
+		{
+			out.push_back('\0');
+			p = zero + 2;
+		}
+		else
+		{
+			p = zero + 1;
+			return true;
+		}
+	}
+	return false;
+}
+
+// false if `data` is not a well formed encoded tuple.
+static bool decode(const char* data, size_t size, v8::Local<v8::Array>& tuple)
+{
+	const char *p = data, *end = data + size;
+	for (uint32_t i = 0; p < end; ++i)
+	{
+		unsigned char tag = static_cast<unsigned char>(*p++);
+		v8::Local<v8::Value> element;
+		if (tag == TagNull)
+		{
+			element = v8::Local<v8::Value>::New(v8::Null());
+		}
+		else if (tag == TagBytes || tag == TagString)
+		{
+			std::string bytes;
+			if (!read_escaped(p, end, bytes))
+			{
+				return false;
+			}
+			if (tag == TagBytes)
+			{
+				element = v8::Local<v8::Value>::New(node::Buffer::New(bytes.data(), bytes.size())->handle_);
+			}
+			else
+			{
+				element = v8::String::New(bytes.data(), bytes.size());
+			}
+		}
+		else if (tag == TagDouble)
+		{
+			if (end - p < 8)
+			{
+				return false;
+			}
+			uint64_t bits = read_be(p, 8);
+			p += 8;
+			bits = (bits >> 63) ? (bits & ~(static_cast<uint64_t>(1) << 63)) : ~bits;
+			double value;
+			std::memcpy(&value, &bits, sizeof(value));
+			element = v8::Number::New(value);
+		}
+		else if (tag == TagFalse || tag == TagTrue)
+		{
+			element = v8::Local<v8::Value>::New(tag == TagTrue ? v8::True() : v8::False());
+		}
+		else
+		{
+			return false;
+		}
+		tuple->Set(i, element);
+	}
+	return true;
+}
+
+}
+
+// Bytes of a js key or value: an array is encoded as a tuple, a Buffer is taken as it is,
+// anything else as an ascii string. Throws a TypeError (and is not `ok()`) for an array that can not be encoded.
+// Must not outlive `value`.
+class JsBytes
+{
+private:
+	v8::String::AsciiValue* ascii;
+	std::string encoded;
+	const char* data_;
+	size_t size_;
+	bool ok_;
+
+	JsBytes(const JsBytes&);
+	JsBytes& operator=(const JsBytes&);
+
+public:
+	explicit JsBytes(const v8::Handle<v8::Value>& value):
+		ascii(NULL), data_(NULL), size_(0), ok_(true)
+	{
+		if (node::Buffer::HasInstance(value))
+		{
+			v8::Local<v8::Object> buffer = value->ToObject();
+			data_ = node::Buffer::Data(buffer);
+			size_ = node::Buffer::Length(buffer);
+		}
+		else if (value->IsArray())
+		{
+			ok_ = keycodec::encode(v8::Handle<v8::Array>::Cast(value), encoded);
+			if (CS_BUNLIKELY(!ok_))
+			{
+				raise_typeerr("tuple keys may hold only strings, numbers, booleans, null and Buffers.");
+			}
+			data_ = encoded.data();
+			size_ = encoded.size();
+		}
+		else
+		{
+			ascii = new v8::String::AsciiValue(value->ToString());
+			data_ = **ascii;
+			size_ = ascii->length();
+		}
+	}
+
+	~JsBytes()
+	{
+		delete ascii;
+	}
+
+	CS_FORCE_INLINE bool ok() const
+	{
+		return ok_;
+	}
+
+	CS_FORCE_INLINE const char* data() const
+	{
+		return data_;
+	}
+
+	CS_FORCE_INLINE size_t size() const
+	{
+		return size_;
+	}
+
+	CS_FORCE_INLINE leveldb::Slice slice() const
+	{
+		return leveldb::Slice(data_, size_);
+	}
+
+	CS_FORCE_INLINE std::string str() const
+	{
+		return std::string(data_, size_);
+	}
+};
+
+// `encodeKey(tuple)` and `decodeKey(buffer)` of the module.
+class Jkeycodec
+{
+public:
+	static void init(v8::Handle<v8::Object> exports)
+	{
+		exports->Set(v8::String::NewSymbol("encodeKey"), v8::FunctionTemplate::New(js_encode_key)->GetFunction());
+		exports->Set(v8::String::NewSymbol("decodeKey"), v8::FunctionTemplate::New(js_decode_key)->GetFunction());
+	}
+
+	static v8::Handle<v8::Value> js_encode_key(const v8::Arguments& args)
+	{
+		v8::HandleScope scope;
+
+		if (CS_BUNLIKELY(args.Length() < 1 || !args[0]->IsArray()))
+		{
+			raise_typeerr("the first argument (tuple) must be an Array.");
+			return scope.Close(v8::Undefined());
+		}
+
+		JsBytes key(args[0]);
+		if (CS_BUNLIKELY(!key.ok()))
+		{
+			return scope.Close(v8::Undefined());
+		}
+		return scope.Close(node::Buffer::New(key.data(), key.size())->handle_);
+	}
+
+	static v8::Handle<v8::Value> js_decode_key(const v8::Arguments& args)
+	{
+		v8::HandleScope scope;
+
+		if (CS_BUNLIKELY(args.Length() < 1))
+		{
+			raise_typeerr("the first argument (key) is required.");
+			return scope.Close(v8::Undefined());
+		}
+
+		JsBytes key(args[0]);
+		v8::Local<v8::Array> tuple = v8::Array::New();
+		if (CS_BUNLIKELY(!keycodec::decode(key.data(), key.size(), tuple)))
+		{
+			raise_err("the key is not an encoded tuple.");
+			return scope.Close(v8::Undefined());
+		}
+		return scope.Close(tuple);
+	}
+};
+
+}
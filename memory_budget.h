@@ -0,0 +1,84 @@
+#pragma once
+
+#include "./assist.h"
+#include <stdint.h>
+#include <v8.h>
+
+namespace leveldb {
+
+// The native memory of one database, told to V8 so that its GC heuristics weigh what js objects pin,
+// and the `memoryBudget` it is opened with. The budget is split between the write buffers, the block cache
+// and the buffers of queued jobs. The cache gives back what the total runs over the budget, oldest blocks first,
+// and grows back to its share once there is room again. Lives on the event loop only.
+class MemoryBudget
+{
+public:
+	static const uint64_t min_cache = 1 << 20;
+	static const uint64_t tick_ms = 100;		// `tick` looks again at most this often.
+
+	uint64_t limit;		// 0 means no budget.
+	uint64_t write_buffers, cache, in_flight;		// the shares of `limit`.
+	uint64_t cache_limit;		// what the cache may hold now, below its share while over the budget.
+	uint64_t shrinks;
+
+	// told to V8: the cache, the write buffers and the hot cache. Job buffers and iterators report their own.
+	int64_t reported;
+
+	uint64_t last_tick;
+
+	MemoryBudget():
+		limit(0), write_buffers(0), cache(0), in_flight(0), cache_limit(0), shrinks(0), reported(0), last_tick(0)
+	{}
+
+	~MemoryBudget()
+	{
+		report(0);
+	}
+
+	// a quarter each for the write buffers and the queued jobs, half for the cache.
+	void split(uint64_t limit_)
+	{
+		limit = limit_;
+		write_buffers = limit / 4;
+		in_flight = limit / 4;
+		cache = limit - write_buffers - in_flight;
+		cache_limit = cache;
+	}
+
+	static void adjust(int64_t change)
+	{
+		if (change)
+		{
+			v8::V8::AdjustAmountOfExternalAllocatedMemory(change);
+		}
+	}
+
+	void report(uint64_t native)
+	{
+		adjust(static_cast<int64_t>(native) - reported);
+		reported = native;
+	}
+
+	// the cache limit for `total` bytes in use, `cache_bytes` of them cached.
+	void adapt(uint64_t total, uint64_t cache_bytes)
+	{
+		if (total > limit)
+		{
+			uint64_t over = total - limit;
+			uint64_t target = cache_bytes > over + min_cache ? cache_bytes - over : min_cache;
+			if (target < cache_limit)
+			{
+				cache_limit = target;
+				++shrinks;
+			}
+		}
+		else if (cache_limit < cache)
+		{
+			// half of the room at a time, so a total near the budget does not swing back and forth.
+			uint64_t grown = cache_limit + (limit - total) / 2;
+			cache_limit = grown < cache ? grown : cache;
+		}
+	}
+};
+
+}
@@ -0,0 +1,183 @@
+#pragma once
+
+#include "./assist.h"
+#include <vector>
+#include <db.h>
+#include <iterator.h>
+#include <slice.h>
+#include <status.h>
+#include <comparator.h>
+
+namespace leveldb {
+
+// N-way merge of iterators over disjoint key sets (e.g. hash shards), so no key is ever seen twice.
+// The children are few, so the smallest (or largest, when moving backward) is found by a linear scan.
+class MergingIterator: public leveldb::Iterator
+{
+private:
+	typedef std::vector<leveldb::Iterator*> Children;
+	typedef std::vector<std::pair<leveldb::DB*, const leveldb::Snapshot*> > Snapshots;
+
+	enum Direction {Forward, Backward};
+
+	Children children;
+	Snapshots snapshots;
+	const leveldb::Comparator* const comparator;
+	leveldb::Iterator* current;
+	Direction direction;
+
+	void find_smallest()
+	{
+		current = NULL;
+		for (Children::iterator it = children.begin(); it != children.end(); ++it)
+		{
+			if ((*it)->Valid() && (!current || comparator->Compare((*it)->key(), current->key()) < 0))
+			{
+				current = *it;
+			}
+		}
+	}
+
+	void find_largest()
+	{
+		current = NULL;
+		for (Children::iterator it = children.begin(); it != children.end(); ++it)
+		{
+			if ((*it)->Valid() && (!current || comparator->Compare((*it)->key(), current->key()) > 0))
+			{
+				current = *it;
+			}
+		}
+	}
+
+public:
+	// takes the ownership of `children_`.
+	// `comparator_` must be the one the children are ordered by.
+	MergingIterator(const std::vector<leveldb::Iterator*>& children_, const leveldb::Comparator* comparator_):
+		children(children_), comparator(comparator_), current(NULL), direction(Forward)
+	{}
+
+	virtual ~MergingIterator()
+	{
+		for (Children::iterator it = children.begin(); it != children.end(); ++it)
+		{
+			delete *it;
+		}
+		for (Snapshots::iterator it = snapshots.begin(); it != snapshots.end(); ++it)
+		{
+			it->first->ReleaseSnapshot(it->second);
+		}
+	}
+
+	// `snapshot` of `db`, which children read, is released once they are deleted.
+	void hold(leveldb::DB* db, const leveldb::Snapshot* snapshot)
+	{
+		snapshots.push_back(std::make_pair(db, snapshot));
+	}
+
+	virtual bool Valid() const
+	{
+		return current != NULL;
+	}
+
+	virtual void SeekToFirst()
+	{
+		for (Children::iterator it = children.begin(); it != children.end(); ++it)
+		{
+			(*it)->SeekToFirst();
+		}
+		direction = Forward;
+		find_smallest();
+	}
+
+	virtual void SeekToLast()
+	{
+		for (Children::iterator it = children.begin(); it != children.end(); ++it)
+		{
+			(*it)->SeekToLast();
+		}
+		direction = Backward;
+		find_largest();
+	}
+
+	virtual void Seek(const leveldb::Slice& target)
+	{
+		for (Children::iterator it = children.begin(); it != children.end(); ++it)
+		{
+			(*it)->Seek(target);
+		}
+		direction = Forward;
+		find_smallest();
+	}
+
+	virtual void Next()
+	{
+		if (direction != Forward)
+		{
+			// every other child is behind the current key, move it to the first key after it.
+			std::string key = current->key().ToString();
+			for (Children::iterator it = children.begin(); it != children.end(); ++it)
+			{
+				if (*it != current)
+				{
+					(*it)->Seek(leveldb::Slice(key));
+				}
+			}
+			direction = Forward;
+		}
+		current->Next();
+		find_smallest();
+	}
+
+	virtual void Prev()
+	{
+		if (direction != Backward)
+		{
+			// every other child is after the current key, move it to the last key before it.
+			std::string key = current->key().ToString();
+			for (Children::iterator it = children.begin(); it != children.end(); ++it)
+			{
+				if (*it != current)
+				{
+					(*it)->Seek(leveldb::Slice(key));
+					if ((*it)->Valid())
+					{
+						(*it)->Prev();
+					}
+					else
+					{
+						(*it)->SeekToLast();
+					}
+				}
+			}
+			direction = Backward;
+		}
+		current->Prev();
+		find_largest();
+	}
+
+	virtual leveldb::Slice key() const
+	{
+		return current->key();
+	}
+
+	virtual leveldb::Slice value() const
+	{
+		return current->value();
+	}
+
+	virtual leveldb::Status status() const
+	{
+		for (Children::const_iterator it = children.begin(); it != children.end(); ++it)
+		{
+			leveldb::Status status = (*it)->status();
+			if (!status.ok())
+			{
+				return status;
+			}
+		}
+		return leveldb::Status::OK();
+	}
+};
+
+}
@@ -0,0 +1,233 @@
+#pragma once
+
+#include "./assist.h"
+#include <algorithm>
+#include <vector>
+#include <stdint.h>
+#include <uv.h>
+#include <slice.h>
+
+namespace leveldb {
+
+// Remembers keys recently found missing, so repeated existence checks of absent keys skip the LSM.
+// Only 64-bit key hashes are kept, in 4-way buckets with two candidate buckets per key (cuckoo style,
+// but a full pair evicts instead of relocating). Two keys answer as the same entry only on a full
+// 64-bit hash collision, which is what makes per-key invalidation by writes precise.
+class MissCache
+{
+public:
+	class Stats
+	{
+	public:
+		uint64_t hits, misses, inserts, evictions, invalidations;
+		uint64_t entries, capacity;
+
+		Stats():
+			hits(0), misses(0), inserts(0), evictions(0), invalidations(0),
+			entries(0), capacity(0)
+		{}
+	};
+
+private:
+	static const size_t bucket_ways = 4;
+	static const uint64_t empty_tag = 0;
+
+	class Bucket
+	{
+	public:
+		uint64_t tags[bucket_ways];
+	};
+
+	class Shard
+	{
+	public:
+		uv_mutex_t mutex;
+		std::vector<Bucket> buckets;
+		size_t bucket_mask;
+		size_t victim;
+		uint64_t epoch;
+		Stats stats;
+
+		Shard(): bucket_mask(0), victim(0), epoch(0)
+		{
+			uv_mutex_init(&mutex);
+		}
+
+		~Shard()
+		{
+			uv_mutex_destroy(&mutex);
+		}
+
+		CS_FORCE_INLINE Bucket& first(uint64_t tag)
+		{
+			return buckets[tag & bucket_mask];
+		}
+
+		CS_FORCE_INLINE Bucket& second(uint64_t tag)
+		{
+			return buckets[((tag >> 32) ^ (tag * 0x9e3779b97f4a7c15ULL)) & bucket_mask];
+		}
+
+		static CS_FORCE_INLINE uint64_t* find(Bucket& bucket, uint64_t tag)
+		{
+			for (size_t i = 0; i < bucket_ways; ++i)
+			{
+				if (bucket.tags[i] == tag)
+				{
+					return bucket.tags + i;
+				}
+			}
+			return NULL;
+		}
+	};
+
+	Shard* shards;
+	size_t shard_mask;
+
+	static CS_FORCE_INLINE uint64_t tag_of(const Slice& key)
+	{
+		uint64_t tag = hash_bytes(key.data(), key.size());
+		return CS_BLIKELY(tag != empty_tag) ? tag : 1;
+	}
+
+	CS_FORCE_INLINE Shard& shard_of(uint64_t tag) const
+	{
+		return shards[(tag >> 48) & shard_mask];
+	}
+
+public:
+	// `capacity` is in bytes, 8 bytes per remembered key.
+	MissCache(size_t capacity, size_t shard_count)
+	{
+		size_t count = 1;
+		while (count < shard_count)
+		{
+			count <<= 1;
+		}
+		size_t buckets = 1;
+		while (buckets * count * 2 * sizeof(Bucket) <= capacity)
+		{
+			buckets <<= 1;
+		}
+		shards = new Shard[count];
+		shard_mask = count - 1;
+		for (size_t i = 0; i < count; ++i)
+		{
+			Bucket bucket;
+			std::fill(bucket.tags, bucket.tags + bucket_ways, static_cast<uint64_t>(empty_tag));
+			shards[i].buckets.assign(buckets, bucket);
+			shards[i].bucket_mask = buckets - 1;
+		}
+	}
+
+	~MissCache()
+	{
+		delete[] shards;
+	}
+
+	uint64_t epoch(const Slice& key) const
+	{
+		Shard& shard = shard_of(tag_of(key));
+		uv_mutex_lock(&shard.mutex);
+		uint64_t epoch = shard.epoch;
+		uv_mutex_unlock(&shard.mutex);
+		return epoch;
+	}
+
+	bool lookup(const Slice& key)
+	{
+		uint64_t tag = tag_of(key);
+		Shard& shard = shard_of(tag);
+		uv_mutex_lock(&shard.mutex);
+		bool hit = Shard::find(shard.first(tag), tag) || Shard::find(shard.second(tag), tag);
+		if (hit)
+		{
+			++shard.stats.hits;
+		}
+		else
+		{
+			++shard.stats.misses;
+		}
+		uv_mutex_unlock(&shard.mutex);
+		return hit;
+	}
+
+	// `epoch` must be taken before the lookup in the LSM that found `key` missing.
+	bool insert(const Slice& key, uint64_t epoch)
+	{
+		uint64_t tag = tag_of(key);
+		Shard& shard = shard_of(tag);
+		bool inserted = false;
+		uv_mutex_lock(&shard.mutex);
+		if (CS_BLIKELY(shard.epoch == epoch))
+		{
+			Bucket& first = shard.first(tag);
+			Bucket& second = shard.second(tag);
+			if (!Shard::find(first, tag) && !Shard::find(second, tag))
+			{
+				uint64_t* slot = Shard::find(first, empty_tag);
+				if (!slot)
+				{
+					slot = Shard::find(second, empty_tag);
+				}
+				if (!slot)
+				{
+					// both full: evict round-robin, alternating between the two buckets.
+					shard.victim = (shard.victim + 1) % (bucket_ways * 2);
+					Bucket& bucket = shard.victim < bucket_ways ? first : second;
+					slot = bucket.tags + shard.victim % bucket_ways;
+					++shard.stats.evictions;
+				}
+				*slot = tag;
+				++shard.stats.inserts;
+				inserted = true;
+			}
+		}
+		uv_mutex_unlock(&shard.mutex);
+		return inserted;
+	}
+
+	void invalidate(const Slice& key)
+	{
+		uint64_t tag = tag_of(key);
+		Shard& shard = shard_of(tag);
+		uv_mutex_lock(&shard.mutex);
+		++shard.epoch;
+		uint64_t* slot = Shard::find(shard.first(tag), tag);
+		if (!slot)
+		{
+			slot = Shard::find(shard.second(tag), tag);
+		}
+		if (slot)
+		{
+			*slot = empty_tag;
+			++shard.stats.invalidations;
+		}
+		uv_mutex_unlock(&shard.mutex);
+	}
+
+	void stats(Stats& total) const
+	{
+		for (size_t i = 0; i <= shard_mask; ++i)
+		{
+			Shard& shard = shards[i];
+			uv_mutex_lock(&shard.mutex);
+			total.hits += shard.stats.hits;
+			total.misses += shard.stats.misses;
+			total.inserts += shard.stats.inserts;
+			total.evictions += shard.stats.evictions;
+			total.invalidations += shard.stats.invalidations;
+			for (std::vector<Bucket>::const_iterator it = shard.buckets.begin(); it != shard.buckets.end(); ++it)
+			{
+				for (size_t j = 0; j < bucket_ways; ++j)
+				{
+					total.entries += it->tags[j] != empty_tag;
+				}
+			}
+			total.capacity += shard.buckets.size() * bucket_ways;
+			uv_mutex_unlock(&shard.mutex);
+		}
+	}
+};
+
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include "./assist.h"
+#include <string>
+#include <slice.h>
+
+namespace leveldb {
+
+// A byte range of a value: `get(key, {offset, length})` and the `valueOffset`/`valueLength` of iterators.
+// Only the range is copied out of the table blocks, so a header read of a large value stays cheap.
+class Projection
+{
+public:
+	static const size_t whole = ~static_cast<size_t>(0);
+
+	size_t offset, length;
+
+	Projection(): offset(0), length(whole) {}
+
+	CS_FORCE_INLINE bool all() const
+	{
+		return offset == 0 && length == whole;
+	}
+
+	// the range clamped to `value`, empty if it starts past the end.
+	CS_FORCE_INLINE Slice apply(const Slice& value) const
+	{
+		if (offset >= value.size())
+		{
+			return Slice();
+		}
+		size_t rest = value.size() - offset;
+		return Slice(value.data() + offset, length < rest ? length : rest);
+	}
+
+	CS_FORCE_INLINE void assign(const Slice& value, std::string& out) const
+	{
+		Slice range = apply(value);
+		out.assign(range.data(), range.size());
+	}
+
+	// trims a value read whole, copying only the range.
+	CS_FORCE_INLINE void trim(std::string& value) const
+	{
+		if (!all())
+		{
+			std::string range;
+			assign(Slice(value), range);
+			value.swap(range);
+		}
+	}
+};
+
+}
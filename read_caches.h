@@ -0,0 +1,102 @@
+#pragma once
+
+#include "./hotcache.h"
+#include "./misscache.h"
+#include "./value_codec.h"
+#include <slice.h>
+#include <status.h>
+#include <options.h>
+#include <db.h>
+#include <string>
+
+namespace leveldb {
+
+// Caches consulted before (and filled after) the LSM, shared by a database and its jobs.
+class ReadCaches
+{
+public:
+	HotCache* hot;
+	MissCache* miss;
+
+	ReadCaches(): hot(NULL), miss(NULL) {}
+
+	// called both when a write is queued and once it is applied.
+	void invalidate(const Slice& key) const
+	{
+		if (hot)
+		{
+			hot->invalidate(key);
+		}
+		if (miss)
+		{
+			miss->invalidate(key);
+		}
+	}
+
+	// reads `key` from `db`, remembering the value (or its absence) when the options allow filling caches.
+	// values are cached decoded.
+	leveldb::Status fetch(leveldb::DB* db, const leveldb::ReadOptions& options, const Slice& key, std::string* value,
+			const ValueCodec* codec = NULL) const
+	{
+		if (!(hot || miss) || !options.fill_cache)
+		{
+			leveldb::Status status = db->Get(options, key, value);
+			return status.ok() && codec ? codec->decode_in_place(*value) : status;
+		}
+
+		uint64_t hot_epoch = hot ? hot->epoch(key) : 0;
+		uint64_t miss_epoch = miss ? miss->epoch(key) : 0;
+		leveldb::Status status = db->Get(options, key, value);
+		if (status.ok() && codec)
+		{
+			status = codec->decode_in_place(*value);
+		}
+		if (status.ok())
+		{
+			if (hot)
+			{
+				hot->insert(key, Slice(*value), hot_epoch);
+			}
+		}
+		else if (status.IsNotFound() && miss)
+		{
+			miss->insert(key, miss_epoch);
+		}
+		return status;
+	}
+
+	// whether the caches may answer a read with `options`: not one that skips them or verifies checksums.
+	static bool answers(const leveldb::ReadOptions& options)
+	{
+		return options.fill_cache && !options.verify_checksums;
+	}
+
+	// like `fetch`, but answers from the caches when they can.
+	leveldb::Status read(leveldb::DB* db, const leveldb::ReadOptions& options, const Slice& key, std::string* value,
+			const ValueCodec* codec = NULL) const
+	{
+		if (answers(options))
+		{
+			if (miss && miss->lookup(key))
+			{
+				return leveldb::Status::NotFound(Slice());
+			}
+			if (hot && hot->lookup(key, *value))
+			{
+				return leveldb::Status::OK();
+			}
+		}
+		return fetch(db, options, key, value, codec);
+	}
+
+	// frees the caches, once none of the copies handed to jobs is used any more.
+	void clear()
+	{
+		delete hot;
+		hot = NULL;
+		delete miss;
+		miss = NULL;
+	}
+};
+
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include "./assist.h"
+#include <vector>
+#include <uv.h>
+
+namespace leveldb {
+
+// Jobs that were completed on the event loop itself (e.g. cache hits) are handed here,
+// so that their callbacks still run asynchronously, on the next loop iteration, without a threadpool hop.
+class ReadyQueue
+{
+private:
+	class Ready
+	{
+	public:
+		uv_work_t* uv_work;
+		uv_after_work_cb after;
+
+		Ready(uv_work_t* uv_work_, uv_after_work_cb after_):
+			uv_work(uv_work_), after(after_)
+		{}
+	};
+
+	typedef std::vector<Ready> ReadyList;
+
+	uv_idle_t idle;
+	bool started;
+	ReadyList ready, draining;
+
+	ReadyQueue(): started(false)
+	{
+		uv_idle_init(uv_default_loop(), &idle);
+		idle.data = this;
+	}
+
+#if UV_VERSION_MAJOR == 0
+	static void on_idle(uv_idle_t* handle, int status)
+#else
+	static void on_idle(uv_idle_t* handle)
+#endif
+	{
+		ReadyQueue* self = static_cast<ReadyQueue*>(handle->data);
+		// callbacks may push again, those run on the next iteration.
+		self->draining.swap(self->ready);
+		for (ReadyList::iterator it = self->draining.begin(); it != self->draining.end(); ++it)
+		{
+			it->after(it->uv_work, 0);
+		}
+		self->draining.clear();
+		if (self->ready.empty())
+		{
+			uv_idle_stop(&self->idle);
+			self->started = false;
+		}
+	}
+
+public:
+	static ReadyQueue& instance()
+	{
+		static ReadyQueue queue;
+		return queue;
+	}
+
+	void push(uv_work_t* uv_work, uv_after_work_cb after)
+	{
+		ready.push_back(Ready(uv_work, after));
+		if (!started)
+		{
+			uv_idle_start(&idle, on_idle);
+			started = true;
+		}
+	}
+};
+
+}
@@ -0,0 +1,500 @@
+#include "./assist.h"
+#include <string>
+#include <v8.h>
+#include <node.h>
+#include <uv.h>
+#include <db.h>
+#include <cache.h>
+#include "./db.h"
+#include "./db_impl.h"
+#include "./sharded_db.h"
+#include "./merging_iterator.h"
+#include "./jobs.h"
+#include "./jstatus.h"
+#include "./jiterator.h"
+
+namespace leveldb {
+
+void ShardedHyperLevelDB::init(v8::Handle<v8::Object> exports)
+{
+	v8::Local<v8::FunctionTemplate> tpl = v8::FunctionTemplate::New(js_new);
+	tpl->SetClassName(v8::String::NewSymbol("ShardedHyperLevelDB"));
+	tpl->InstanceTemplate()->SetInternalFieldCount(4);
+
+	v8::Local<v8::ObjectTemplate> prototype = tpl->PrototypeTemplate();
+	attach_func(prototype, "open", js_open);
+	attach_func(prototype, "close", js_close);
+	attach_func(prototype, "put", js_put);
+	attach_func(prototype, "get", js_get);
+	attach_func(prototype, "del", js_del);
+	attach_func(prototype, "batch", js_batch);
+	attach_func(prototype, "iterator", js_iterator);
+	attach_func(prototype, "shardStats", js_shard_stats);
+
+	v8::Persistent<v8::Function> ctor = v8::Persistent<v8::Function>::New(tpl->GetFunction());
+	exports->Set(v8::String::NewSymbol("ShardedHyperLevelDB"), ctor);
+}
+
+ShardedHyperLevelDB::ShardedHyperLevelDB(const std::string& directory_, size_t shard_count_)
+	: HyperLevelDB(directory_), shard_count(shard_count_), stats(shard_count_)
+{}
+
+v8::Handle<v8::Value> ShardedHyperLevelDB::js_new(const v8::Arguments& args)
+{
+	v8::HandleScope scope;
+
+	if (CS_BUNLIKELY(args.Length() < 2 || !args[0]->IsString() || !args[1]->IsNumber() || args[1]->IntegerValue() < 1))
+	{
+		raise_typeerr("2 arguments (directory, shards) are required, `shards` must be a positive number.");
+		return scope.Close(v8::Undefined());
+	}
+	std::string dir = std::string(*v8::String::Utf8Value(args[0]->ToString()));
+
+	ShardedHyperLevelDB* sharded = new ShardedHyperLevelDB(dir, args[1]->IntegerValue());
+	sharded->Wrap(args.This());
+
+	return args.This();
+}
+
+v8::Handle<v8::Value> ShardedHyperLevelDB::js_open(const v8::Arguments& args)
+{
+	v8::HandleScope scope;
+
+	ShardedHyperLevelDB* self = node::ObjectWrap::Unwrap<ShardedHyperLevelDB>(args.This());
+	if (CS_BUNLIKELY(self->opening))
+	{
+		raise_err("the database is being opened.");
+		return scope.Close(v8::Undefined());
+	}
+
+	self->init_default_open_options(self->open_options);
+	if (self->shards.empty())
+	{
+		delete self->env;
+		self->env = NULL;
+	}
+
+	if (CS_BUNLIKELY(args.Length() < 1))
+	{
+		raise_typeerr("at least 1 arguments (callback) is required");
+		return scope.Close(v8::Undefined());
+	}
+
+	v8::Persistent<v8::Function> callback;
+	if (args.Length() == 2 && args[0]->IsObject())
+	{
+		v8::Local<v8::Object> opts_from = args[0]->ToObject();
+		// `cacheSize` makes one block cache, shared by all the shards.
+		if (CS_BUNLIKELY(!self->fill_open_options(opts_from, self->open_options, self->memory) ||
+				!self->fill_env_options(opts_from, self->open_options)))
+		{
+			delete self->open_options.block_cache;
+			self->open_options.block_cache = NULL;
+			return scope.Close(v8::Undefined());
+		}
+		self->cache = self->open_options.block_cache;
+		v8::Local<v8::String> key = v8::String::New("notFoundAsUndefined");
+		if (opts_from->Has(key))
+		{
+			self->not_found_as_undefined = opts_from->Get(key)->IsTrue();
+		}
+		callback = v8::Persistent<v8::Function>::New(v8::Local<v8::Function>::Cast(args[1]));
+	}
+	else
+	{
+		callback = v8::Persistent<v8::Function>::New(v8::Local<v8::Function>::Cast(args[args.Length() - 1]));
+	}
+
+	if (!self->env)
+	{
+		self->install_env(self->open_options, 0, 0);
+	}
+
+	OpenShardsJob* job = new OpenShardsJob(self->open_options, self->directory, self->shard_count, &self->shards, callback);
+	job->opening = &self->opening;
+	self->opening = true;
+	Dispatcher::instance().queue(&job->uv_work, job->execute, on_open_shards, Dispatcher::Normal, NULL);
+
+	return args.This();
+}
+
+void ShardedHyperLevelDB::on_open_shards(uv_work_t* uv_work, int uv_status)
+{
+	OpenShardsJob* job = reinterpret_cast<OpenShardsJob*>(uv_work->data);
+	*job->opening = false;
+	if (CS_BLIKELY(job->status.ok()))
+	{
+		// no work is taken before, so none sees a part of the shards.
+		job->shards->swap(job->opened);
+		job->callback->Call(v8::Context::GetCurrent()->Global(), 0, NULL);
+	}
+	else
+	{
+		const uint32_t argc = 1;
+		std::string err(std::string("failed to open sharded database at ") + job->directory + job->status.ToString());
+		v8::Local<v8::Value> argv[argc] = { v8::Local<v8::Value>::New(v8::Exception::Error(v8::String::New(err.c_str(), err.size()))) };
+		job->callback->Call(v8::Context::GetCurrent()->Global(), argc, argv);
+	}
+	delete job;
+}
+
+v8::Handle<v8::Value> ShardedHyperLevelDB::js_close(const v8::Arguments& args)
+{
+	v8::HandleScope scope;
+
+	if (CS_BUNLIKELY(args.Length() < 1 || !args[0]->IsFunction()))
+	{
+		raise_typeerr("the first argument (callback) must be a Function");
+		return scope.Close(v8::Undefined());
+	}
+	v8::Persistent<v8::Function> callback = v8::Persistent<v8::Function>::New(v8::Local<v8::Function>::Cast(args[0]));
+
+	ShardedHyperLevelDB* self = node::ObjectWrap::Unwrap<ShardedHyperLevelDB>(args.This());
+	if (CS_BUNLIKELY(self->opening))
+	{
+		raise_err("the database is being opened, close it once `open` calls back.");
+		return scope.Close(v8::Undefined());
+	}
+
+	CloseShardsJob* job = new CloseShardsJob(self->shards, self->cache, callback);
+	job->env = self->env;
+	self->shards.clear();
+	self->cache = NULL;
+	self->env = NULL;
+	Dispatcher::instance().queue_barrier(&job->uv_work, job->execute, on_close_shards, self);
+
+	return scope.Close(v8::Undefined());
+}
+
+void ShardedHyperLevelDB::on_close_shards(uv_work_t* uv_work, int uv_status)
+{
+	CloseShardsJob* job = reinterpret_cast<CloseShardsJob*>(uv_work->data);
+	job->callback->Call(v8::Context::GetCurrent()->Global(), 0, NULL);
+	delete job;
+}
+
+v8::Handle<v8::Value> ShardedHyperLevelDB::js_put(const v8::Arguments& args)
+{
+	v8::HandleScope scope;
+
+	ShardedHyperLevelDB* self = node::ObjectWrap::Unwrap<ShardedHyperLevelDB>(args.This());
+	if (CS_BUNLIKELY(!self->check_shards()))
+	{
+		return scope.Close(v8::Undefined());
+	}
+
+	v8::Persistent<v8::Function> callback;
+	leveldb::WriteOptions options;
+	Dispatcher::Priority priority = Dispatcher::Normal;
+
+	switch (args.Length())
+	{
+	case 0:		// intentionally go ahead.
+	case 1:
+		raise_typeerr("at least 2 arguments (key, value) are required.");
+		return scope.Close(v8::Undefined());
+	case 2:
+		break;
+	case 3:
+		callback = v8::Persistent<v8::Function>::New(v8::Local<v8::Function>::Cast(args[2]));
+		break;
+	default:
+		self->fill_write_options(args[2]->ToObject(), options);
+		priority = self->fill_priority(args[2]->ToObject(), priority);
+		callback = v8::Persistent<v8::Function>::New(v8::Local<v8::Function>::Cast(args[3]));
+		break;
+	}
+
+	JsBytes key_data(args[0]), value_data(args[1]);
+	if (CS_BUNLIKELY(!key_data.ok() || !value_data.ok()))
+	{
+		return scope.Close(v8::Undefined());
+	}
+	size_t shard = self->shard_of(key_data);
+	++self->stats[shard].puts;
+	self->stats[shard].bytes_written += key_data.size() + value_data.size();
+
+	PutJob* job = new PutJob(self->shards[shard], options, key_data.str(), value_data.str(), ReadCaches(), callback);
+	Dispatcher::instance().queue(&job->uv_work, job->execute, on_put, priority, self);
+
+	return args.This();
+}
+
+v8::Handle<v8::Value> ShardedHyperLevelDB::js_get(const v8::Arguments& args)
+{
+	v8::HandleScope scope;
+
+	ShardedHyperLevelDB* self = node::ObjectWrap::Unwrap<ShardedHyperLevelDB>(args.This());
+	if (CS_BUNLIKELY(!self->check_shards()))
+	{
+		return scope.Close(v8::Undefined());
+	}
+
+	v8::Persistent<v8::Function> callback;
+	leveldb::ReadOptions options;
+	bool as_buffer = true;
+	Dispatcher::Priority priority = Dispatcher::Normal;
+
+	switch (args.Length())
+	{
+	case 0:
+		raise_typeerr("at least 1 argument (key) are required.");
+		return scope.Close(v8::Undefined());
+	case 1:
+		break;
+	case 2:
+		callback = v8::Persistent<v8::Function>::New(v8::Local<v8::Function>::Cast(args[1]));
+		break;
+	default:
+		as_buffer = self->fill_read_options(args[1]->ToObject(), options);
+		priority = self->fill_priority(args[1]->ToObject(), priority);
+		callback = v8::Persistent<v8::Function>::New(v8::Local<v8::Function>::Cast(args[2]));
+		break;
+	}
+
+	JsBytes key_data(args[0]);
+	if (CS_BUNLIKELY(!key_data.ok()))
+	{
+		return scope.Close(v8::Undefined());
+	}
+	size_t shard = self->shard_of(key_data);
+	++self->stats[shard].gets;
+
+	GetJob* job = new GetJob(self->shards[shard], options, as_buffer, key_data.str(), ReadCaches(), callback);
+	job->not_found_as_undefined = self->not_found_as_undefined;
+	Dispatcher::instance().queue(&job->uv_work, job->execute, on_get, priority, self);
+
+	return args.This();
+}
+
+v8::Handle<v8::Value> ShardedHyperLevelDB::js_del(const v8::Arguments& args)
+{
+	v8::HandleScope scope;
+
+	ShardedHyperLevelDB* self = node::ObjectWrap::Unwrap<ShardedHyperLevelDB>(args.This());
+	if (CS_BUNLIKELY(!self->check_shards()))
+	{
+		return scope.Close(v8::Undefined());
+	}
+
+	v8::Persistent<v8::Function> callback;
+	leveldb::WriteOptions options;
+	Dispatcher::Priority priority = Dispatcher::Normal;
+
+	switch (args.Length())
+	{
+	case 0:
+		raise_typeerr("at least 1 argument (key) are required.");
+		return scope.Close(v8::Undefined());
+	case 1:
+		break;
+	case 2:
+		callback = v8::Persistent<v8::Function>::New(v8::Local<v8::Function>::Cast(args[1]));
+		break;
+	default:
+		self->fill_write_options(args[1]->ToObject(), options);
+		priority = self->fill_priority(args[1]->ToObject(), priority);
+		callback = v8::Persistent<v8::Function>::New(v8::Local<v8::Function>::Cast(args[2]));
+		break;
+	}
+
+	JsBytes key_data(args[0]);
+	if (CS_BUNLIKELY(!key_data.ok()))
+	{
+		return scope.Close(v8::Undefined());
+	}
+	size_t shard = self->shard_of(key_data);
+	++self->stats[shard].dels;
+	self->stats[shard].bytes_written += key_data.size();
+
+	DelJob* job = new DelJob(self->shards[shard], options, key_data.str(), ReadCaches(), callback);
+	Dispatcher::instance().queue(&job->uv_work, job->execute, on_del, priority, self);
+
+	return args.This();
+}
+
+v8::Handle<v8::Value> ShardedHyperLevelDB::js_batch(const v8::Arguments& args)
+{
+	v8::HandleScope scope;
+
+	ShardedHyperLevelDB* self = node::ObjectWrap::Unwrap<ShardedHyperLevelDB>(args.This());
+	if (CS_BUNLIKELY(!self->check_shards()))
+	{
+		return scope.Close(v8::Undefined());
+	}
+
+	v8::Persistent<v8::Function> callback;
+	leveldb::WriteOptions options;
+	Dispatcher::Priority priority = Dispatcher::Normal;
+
+	switch (args.Length())
+	{
+	case 0:
+		raise_typeerr("at least 1 argument (operations) are required.");
+		return scope.Close(v8::Undefined());
+	case 1:
+		break;
+	case 2:
+		callback = v8::Persistent<v8::Function>::New(v8::Local<v8::Function>::Cast(args[1]));
+		break;
+	default:
+		self->fill_write_options(args[1]->ToObject(), options);
+		priority = self->fill_priority(args[1]->ToObject(), priority);
+		callback = v8::Persistent<v8::Function>::New(v8::Local<v8::Function>::Cast(args[2]));
+		break;
+	}
+	if (CS_BUNLIKELY(!args[0]->IsArray()))
+	{
+		raise_typeerr("the first argument `operations` must be an Array");
+		return scope.Close(v8::Undefined());
+	}
+
+	ShardedBatchJob* job = new ShardedBatchJob(self->shards, options, callback);
+
+	v8::Local<v8::Array> operations = v8::Local<v8::Array>::Cast(args[0]);
+	v8::Local<v8::Object> op;
+	v8::Local<v8::Value> op_type;
+	for (uint32_t i = 0; i < operations->Length(); ++i)
+	{
+		op = operations->Get(v8::Uint32::New(i))->ToObject();
+		if (CS_BUNLIKELY(!op->Has(batch_operation_type) || !op->Has(batch_operation_key)))
+		{
+			delete job;
+			raise_typeerr("at least `type` and `key` are required for batch operation.");
+			return scope.Close(v8::Undefined());
+		}
+
+		op_type = op->Get(batch_operation_type);
+		JsBytes key_data(op->Get(batch_operation_key));
+		if (CS_BUNLIKELY(!key_data.ok()))
+		{
+			delete job;
+			return scope.Close(v8::Undefined());
+		}
+		size_t shard = self->shard_of(key_data);
+		if (op_type->Equals(batch_operation_put))
+		{
+			if (CS_BUNLIKELY(!op->Has(batch_operation_value)))
+			{
+				delete job;
+				raise_typeerr("`value` is required for `put` operation.");
+				return scope.Close(v8::Undefined());
+			}
+			JsBytes value_data(op->Get(batch_operation_value));
+			if (CS_BUNLIKELY(!value_data.ok()))
+			{
+				delete job;
+				return scope.Close(v8::Undefined());
+			}
+			job->batches[shard].Put(key_data.slice(), value_data.slice());
+			self->stats[shard].bytes_written += key_data.size() + value_data.size();
+		}
+		else if (op_type->Equals(batch_operation_del))
+		{
+			job->batches[shard].Delete(key_data.slice());
+			self->stats[shard].bytes_written += key_data.size();
+		}
+		else
+		{
+			delete job;
+			raise_typeerr("batch operation supports only `put` and `del`.");
+			return scope.Close(v8::Undefined());
+		}
+		job->touched[shard] = true;
+		++self->stats[shard].batch_ops;
+	}
+
+	Dispatcher::instance().queue(&job->uv_work, job->execute, on_batch_shards, priority, self);
+
+	return args.This();
+}
+
+void ShardedHyperLevelDB::on_batch_shards(uv_work_t* uv_work, int uv_status)
+{
+	ShardedBatchJob* job = reinterpret_cast<ShardedBatchJob*>(uv_work->data);
+	if (CS_BLIKELY(job->callback->IsFunction()))
+	{
+		if (CS_BLIKELY(job->status.ok()))
+		{
+			job->callback->Call(v8::Context::GetCurrent()->Global(), 0, NULL);
+		}
+		else
+		{
+			const uint32_t argc = 1;
+			v8::Local<v8::Value> argv[argc] = { Jstatus::convert(job->status) };
+			job->callback->Call(v8::Context::GetCurrent()->Global(), argc, argv);
+		}
+	}
+	delete job;
+}
+
+v8::Handle<v8::Value> ShardedHyperLevelDB::js_iterator(const v8::Arguments& args)
+{
+	v8::HandleScope scope;
+	ShardedHyperLevelDB* self = node::ObjectWrap::Unwrap<ShardedHyperLevelDB>(args.This());
+	if (CS_BUNLIKELY(!self->check_shards()))
+	{
+		return scope.Close(v8::Undefined());
+	}
+	leveldb::ReadOptions read_options;
+	IterOptions iter_options;
+	if (args.Length() > 0)
+	{
+		if (CS_BUNLIKELY(!self->fill_iter_settings(args[0]->ToObject(), read_options, iter_options)))
+		{
+			return scope.Close(v8::Undefined());
+		}
+	}
+	else
+	{
+		read_options.fill_cache = false;	// defaults not to fill cache.
+	}
+	if (CS_BUNLIKELY(iter_options.parallelism > 1))
+	{
+		raise_typeerr("parallel iterators are not supported by sharded databases.");
+		return scope.Close(v8::Undefined());
+	}
+
+	// every shard is read as of the same moment: the snapshots are all taken before any child iterator is made.
+	std::vector<const leveldb::Snapshot*> snapshots;
+	for (DBList::iterator it = self->shards.begin(); it != self->shards.end(); ++it)
+	{
+		snapshots.push_back((*it)->GetSnapshot());
+	}
+	std::vector<leveldb::Iterator*> children;
+	for (size_t i = 0; i < self->shards.size(); ++i)
+	{
+		read_options.snapshot = snapshots[i];
+		children.push_back(self->shards[i]->NewIterator(read_options));
+	}
+	MergingIterator* merged = new MergingIterator(children, self->open_options.comparator);
+	for (size_t i = 0; i < self->shards.size(); ++i)
+	{
+		merged->hold(self->shards[i], snapshots[i]);
+	}
+	return scope.Close(Jiterator::create(envs::ReadaheadIterator::wrap(merged, iter_options.readahead), iter_options,
+			self->open_options.comparator));
+}
+
+v8::Handle<v8::Value> ShardedHyperLevelDB::js_shard_stats(const v8::Arguments& args)
+{
+	v8::HandleScope scope;
+
+	ShardedHyperLevelDB* self = node::ObjectWrap::Unwrap<ShardedHyperLevelDB>(args.This());
+
+	v8::Local<v8::Array> res = v8::Array::New(self->shard_count);
+	for (size_t i = 0; i < self->shard_count; ++i)
+	{
+		const ShardStats& stats = self->stats[i];
+		v8::Local<v8::Object> shard = v8::Object::New();
+		shard->Set(v8::String::NewSymbol("puts"), v8::Number::New(stats.puts));
+		shard->Set(v8::String::NewSymbol("gets"), v8::Number::New(stats.gets));
+		shard->Set(v8::String::NewSymbol("dels"), v8::Number::New(stats.dels));
+		shard->Set(v8::String::NewSymbol("batchOps"), v8::Number::New(stats.batch_ops));
+		shard->Set(v8::String::NewSymbol("bytesWritten"), v8::Number::New(stats.bytes_written));
+		res->Set(i, shard);
+	}
+	return scope.Close(res);
+}
+
+}
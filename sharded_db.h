@@ -0,0 +1,82 @@
+#pragma once
+
+#include "./assist.h"
+#include <string>
+#include <vector>
+#include <v8.h>
+#include <node.h>
+#include <db.h>
+#include <cache.h>
+#include <uv.h>
+#include "./db.h"
+#include "./jobs.h"
+
+namespace leveldb {
+
+// Spreads keys over `shard_count` databases in sub-directories by key hash, so writes are not
+// serialized by a single memtable and log. All shards share one block cache and the worker threads.
+class ShardedHyperLevelDB:
+	public HyperLevelDB
+{
+private:
+	class ShardStats
+	{
+	public:
+		uint64_t puts, gets, dels, batch_ops, bytes_written;
+
+		ShardStats(): puts(0), gets(0), dels(0), batch_ops(0), bytes_written(0) {}
+	};
+
+	const size_t shard_count;
+
+	DBList shards;
+
+	std::vector<ShardStats> stats;
+
+	CS_FORCE_INLINE size_t shard_of(const char* key, size_t size) const
+	{
+		return hash_bytes(key, size) % shard_count;
+	}
+
+	CS_FORCE_INLINE size_t shard_of(const JsBytes& key_data) const
+	{
+		return shard_of(key_data.data(), key_data.size());
+	}
+
+	// throws unless every shard is open.
+	CS_FORCE_INLINE bool check_shards() const
+	{
+		if (CS_BUNLIKELY(shards.empty()))
+		{
+			raise_err("the database is not open.");
+			return false;
+		}
+		return true;
+	}
+
+public:
+	static void init(v8::Handle<v8::Object> exports);
+
+	ShardedHyperLevelDB(const std::string& directory_, size_t shard_count_);
+
+public:
+	// ctor for js.
+	static v8::Handle<v8::Value> js_new(const v8::Arguments& args);
+
+	static v8::Handle<v8::Value> js_open(const v8::Arguments& args);
+	static v8::Handle<v8::Value> js_close(const v8::Arguments& args);
+
+	static v8::Handle<v8::Value> js_put(const v8::Arguments& args);
+	static v8::Handle<v8::Value> js_get(const v8::Arguments& args);
+	static v8::Handle<v8::Value> js_del(const v8::Arguments& args);
+	static v8::Handle<v8::Value> js_batch(const v8::Arguments& args);
+	static v8::Handle<v8::Value> js_iterator(const v8::Arguments& args);
+	static v8::Handle<v8::Value> js_shard_stats(const v8::Arguments& args);
+
+private:
+	static void on_open_shards(uv_work_t* uv_work, int uv_status);
+	static void on_close_shards(uv_work_t* uv_work, int uv_status);
+	static void on_batch_shards(uv_work_t* uv_work, int uv_status);
+};
+
+}
@@ -0,0 +1,307 @@
+#pragma once
+
+#include "./assist.h"
+#include <string>
+#include <stdint.h>
+#include <uv.h>
+#include <cache.h>
+#include <env.h>
+#include <slice.h>
+
+namespace leveldb {
+
+// A block cache and an Env that many databases of the process can be opened with.
+// Refcounted: the js handle and every database opened with it hold a reference.
+class SharedResources
+{
+private:
+	volatile uint32_t refs;
+
+	SharedResources(const SharedResources&);
+	SharedResources& operator=(const SharedResources&);
+
+	~SharedResources()
+	{
+		delete cache;
+	}
+
+public:
+	leveldb::Cache* const cache;
+	const size_t capacity;
+
+	// not owned. `Env::Default()` runs the compactions of every database on one background thread.
+	leveldb::Env* env;
+
+	volatile uint64_t usage;		// charge of the blocks cached for all databases together.
+	volatile uint32_t databases;
+
+	explicit SharedResources(size_t capacity_):
+		refs(1), cache(leveldb::NewLRUCache(capacity_)), capacity(capacity_),
+		env(leveldb::Env::Default()), usage(0), databases(0)
+	{}
+
+	void ref()
+	{
+		__sync_fetch_and_add(&refs, 1);
+	}
+
+	void unref()
+	{
+		if (__sync_sub_and_fetch(&refs, 1) == 0)
+		{
+			delete this;
+		}
+	}
+};
+
+// What one database has in the cache, outlives the database when its blocks stay cached after close.
+class CacheUsage
+{
+public:
+	// a block cached for the database. While `tracked`, the blocks are linked oldest first
+	// so that `AccountingCache::trim` can erase them, each one until its deleter unlinks it.
+	class Link
+	{
+	public:
+		std::string key;		// only kept while tracked.
+		Link* prev;
+		Link* next;
+		bool linked;
+
+		Link(): prev(NULL), next(NULL), linked(false) {}
+	};
+
+private:
+	volatile uint32_t refs;
+
+	uv_mutex_t lock;		// of the links, only taken when `tracked`.
+	Link* head;
+	Link* tail;
+
+	~CacheUsage()
+	{
+		uv_mutex_destroy(&lock);
+	}
+
+public:
+	volatile uint64_t bytes;
+	volatile uint64_t inserts;
+
+	const bool tracked;
+	volatile uint64_t limit;		// bytes `trim` brings the usage back under, 0 for no limit.
+
+	explicit CacheUsage(bool tracked_ = false):
+		refs(1), head(NULL), tail(NULL), bytes(0), inserts(0), tracked(tracked_), limit(0)
+	{
+		uv_mutex_init(&lock);
+	}
+
+	void ref()
+	{
+		__sync_fetch_and_add(&refs, 1);
+	}
+
+	void unref()
+	{
+		if (__sync_sub_and_fetch(&refs, 1) == 0)
+		{
+			delete this;
+		}
+	}
+
+	void link(Link* link_)
+	{
+		uv_mutex_lock(&lock);
+		link_->prev = tail;
+		link_->next = NULL;
+		(tail ? tail->next : head) = link_;
+		tail = link_;
+		link_->linked = true;
+		uv_mutex_unlock(&lock);
+	}
+
+	void unlink(Link* link_)
+	{
+		uv_mutex_lock(&lock);
+		if (link_->linked)
+		{
+			detach(link_);
+		}
+		uv_mutex_unlock(&lock);
+	}
+
+	// takes the key of the oldest block out, false if none is left.
+	bool oldest(std::string& key)
+	{
+		uv_mutex_lock(&lock);
+		Link* found = head;
+		if (found)
+		{
+			detach(found);
+			key = found->key;
+		}
+		uv_mutex_unlock(&lock);
+		return found != NULL;
+	}
+
+private:
+	void detach(Link* link_)
+	{
+		(link_->prev ? link_->prev->next : head) = link_->next;
+		(link_->next ? link_->next->prev : tail) = link_->prev;
+		link_->prev = link_->next = NULL;
+		link_->linked = false;
+	}
+};
+
+// The view one database has of a shared cache: forwards everything to it,
+// and attributes the charge of the blocks this database inserted to it until they are evicted.
+// Blocks of all databases compete in the same LRU, so hot databases get what idle ones do not use.
+class AccountingCache: public leveldb::Cache
+{
+private:
+	class Entry: public CacheUsage::Link
+	{
+	public:
+		void* value;
+		void (*deleter)(const Slice& key, void* value);
+		size_t charge;
+		CacheUsage* usage;
+		SharedResources* shared;
+	};
+
+	static const size_t max_trim = 256;
+
+	SharedResources* const shared;
+	CacheUsage* const usage;
+
+	static void delete_entry(const Slice& key, void* value)
+	{
+		Entry* entry = reinterpret_cast<Entry*>(value);
+		if (entry->usage->tracked)
+		{
+			entry->usage->unlink(entry);
+		}
+		__sync_fetch_and_sub(&entry->usage->bytes, entry->charge);
+		__sync_fetch_and_sub(&entry->shared->usage, entry->charge);
+		entry->deleter(key, entry->value);
+		entry->usage->unref();
+		delete entry;
+	}
+
+public:
+	// takes a reference to `shared_`. `tracked` to be able to `trim` to a limit.
+	explicit AccountingCache(SharedResources* shared_, bool tracked = false):
+		shared(shared_), usage(new CacheUsage(tracked))
+	{
+		shared->ref();
+		__sync_fetch_and_add(&shared->databases, 1);
+	}
+
+	virtual ~AccountingCache()
+	{
+		__sync_fetch_and_sub(&shared->databases, 1);
+		usage->unref();
+		shared->unref();
+	}
+
+	CS_FORCE_INLINE const SharedResources* resources() const
+	{
+		return shared;
+	}
+
+	CS_FORCE_INLINE uint64_t bytes() const
+	{
+		return usage->bytes;
+	}
+
+	CS_FORCE_INLINE uint64_t inserts() const
+	{
+		return usage->inserts;
+	}
+
+	CS_FORCE_INLINE uint64_t limit() const
+	{
+		return usage->limit;
+	}
+
+	// does nothing unless `tracked`, trims right away if lowered.
+	void set_limit(uint64_t limit_)
+	{
+		if (usage->tracked)
+		{
+			usage->limit = limit_;
+			trim();
+		}
+	}
+
+	// erases the oldest blocks of this database until it is back under its limit, at most `max_trim` per call
+	// so that no insert pays for a large cut: the next ones go on. Blocks in use are freed once released.
+	void trim()
+	{
+		std::string key;
+		for (size_t erased = 0; erased < max_trim && usage->limit && usage->bytes > usage->limit && usage->oldest(key); ++erased)
+		{
+			shared->cache->Erase(key);
+		}
+	}
+
+	virtual Handle* Insert(const Slice& key, void* value, size_t charge, void (*deleter)(const Slice& key, void* value))
+	{
+		Entry* entry = new Entry;
+		entry->value = value;
+		entry->deleter = deleter;
+		entry->usage = usage;
+		entry->shared = shared;
+		if (usage->tracked)
+		{
+			// the copy of the key is cached along with the block.
+			entry->key.assign(key.data(), key.size());
+			charge += key.size();
+		}
+		entry->charge = charge;
+		usage->ref();
+		__sync_fetch_and_add(&usage->bytes, charge);
+		__sync_fetch_and_add(&usage->inserts, 1);
+		__sync_fetch_and_add(&shared->usage, charge);
+		Handle* handle = shared->cache->Insert(key, entry, charge, delete_entry);
+		if (usage->tracked)
+		{
+			// linked once cached, a `trim` meanwhile would erase what the key held before. The handle keeps it alive.
+			usage->link(entry);
+		}
+		if (usage->limit && usage->bytes > usage->limit)
+		{
+			trim();
+		}
+		return handle;
+	}
+
+	virtual Handle* Lookup(const Slice& key)
+	{
+		return shared->cache->Lookup(key);
+	}
+
+	virtual void Release(Handle* handle)
+	{
+		shared->cache->Release(handle);
+	}
+
+	virtual void* Value(Handle* handle)
+	{
+		return reinterpret_cast<Entry*>(shared->cache->Value(handle))->value;
+	}
+
+	virtual void Erase(const Slice& key)
+	{
+		shared->cache->Erase(key);
+	}
+
+	// ids come from the shared cache, so the keys of different databases never collide.
+	virtual uint64_t NewId()
+	{
+		return shared->cache->NewId();
+	}
+};
+
+}
@@ -1,5 +1,6 @@
 
-var HyperLevelDB = require("./build/Release/hyperleveldb").HyperLevelDB;
+var binding = require("./build/Release/hyperleveldb");
+var HyperLevelDB = binding.HyperLevelDB;
 
 var db = new HyperLevelDB("/tmp/hyperleveldb");
 
@@ -14,7 +15,8 @@ var testOpen = function() {
         }
         testPut();
     };
-    db.open({cacheSize: 10 << 20, compression: false}, onOpen);
+    db.open({cacheSize: 10 << 20, compression: false, hotCacheSize: 1 << 20, missCacheSize: 64 << 10, recordHotKeys: true,
+        memoryBudget: 64 << 20}, onOpen);
 }
 
 var testPut = function() {
@@ -49,7 +51,8 @@ var testGet = function(key) {
                 ". err.ok():" + err.ok() + 
                 ", err.isIOError():" + err.isIOError() + 
                 ", err.isNotFound():" + err.isNotFound() + 
-                ", err.isCorruption():" + err.isCorruption()
+                ", err.isCorruption():" + err.isCorruption() +
+                ", err.message:[" + err.message + "]"
             );
             testDel();
         } else {
@@ -63,21 +66,218 @@ var testGet = function(key) {
 var testDel = function() {   
     var onDel = function(err) {
         console.log("db.del() " + (err === undefined ? "succed" : "failed"));
-        testClose();
+        testSync();
     };
     db.del(key_exists, onDel);
 }
 
+var testSync = function() {
+    var key = new Buffer([0x00, 0xff, 0x80]);
+    db.putSync(key, a_value);
+    console.log("db.getSync() [" + db.getSync(key, {asBuffer: false}) + "]");
+    db.batchSync([{type: "del", key: key}]);
+    console.log("db.getSync() after batchSync(): " + db.getSync(key));
+    db.delSync(key_nonexists);
+    var tuple = ["tenant", "type", -42, 1.5, true, null];
+    db.putSync(tuple, a_value);
+    console.log("decodeKey(encodeKey()) " + JSON.stringify(binding.decodeKey(binding.encodeKey(tuple))) +
+        ", db.getSync(tuple) [" + db.getSync(tuple, {asBuffer: false}) + "]");
+    testUpdate();
+}
+
+var testUpdate = function() {
+    var key = "counter";
+    db.updateBatch([{key: key, op: "add", operand: 2}, {key: key, op: "add", operand: 3}], function(err, values) {
+        console.log("db.updateBatch() " + (err ? "failed" : "succed") + " " + JSON.stringify(values));
+        db.update(key, "max", 1, function(err, value) {
+            console.log("db.update() " + (err ? "failed" : "succed") + " " + value);
+            testConditionalBatch();
+        });
+    });
+}
+
+var testConditionalBatch = function() {
+    var ops = [
+        {type: "check", key: "version", version: 0},
+        {type: "put", key: "doc", value: "v1"},
+        {type: "update", key: "version", op: "add", operand: 1}
+    ];
+    db.batch(ops, function(err, committed) {
+        console.log("conditional db.batch() committed: " + committed);
+        db.batch(ops, function(err, committed, failedIndex) {
+            console.log("conditional db.batch() again committed: " + committed + ", failed at " + failedIndex);
+            testProjection();
+        });
+    });
+}
+
+var testProjection = function() {
+    db.putSync("blob", "header:payload-payload-payload");
+    db.get("blob", {offset: 0, length: 6, asBuffer: false}, function(err, header) {
+        console.log("db.get({offset, length}) [" + header + "]");
+        var it = db.iterator({start: "blob", end: "blob\xff", valueOffset: 7, valueLength: 7, valueAsBuffer: false});
+        it.next(function(err, key, value) {
+            console.log("iterator({valueOffset, valueLength}) [" + key + "] [" + value + "]");
+            it.end(testWarmup);
+        });
+    });
+}
+
+var testWarmup = function() {
+    db.warmup({hotKeys: true, chunkBytes: 1 << 10}, function(err, stats) {
+        console.log("db.warmup() " + (err ? "failed: " + err : "succed " + JSON.stringify(stats)));
+        testDeadline();
+    });
+}
+
+var testDeadline = function() {
+    db.get("blob", {deadline: Date.now() - 1}, function(err, value) {
+        console.log("db.get({deadline}) timed out: " + (err ? err.isTimedOut() : false));
+        console.log("db.pendingStats(): " + JSON.stringify(db.pendingStats()));
+        testPriority();
+    });
+}
+
+var testPriority = function() {
+    db.get(key_exists, {priority: "interactive", asBuffer: false}, function(err, value) {
+        console.log("db.get({priority: \"interactive\"}) [" + value + "]");
+        console.log("scheduler(): " + JSON.stringify(binding.scheduler()));
+        testSharedOpen();
+    });
+}
+
+var testSharedOpen = function() {
+    var other = new HyperLevelDB("/tmp/hyperleveldb");
+    other.open({}, function(err) {
+        console.log("second handle open() " + (err ? "failed: " + err : "succed"));
+        other.get(key_exists, {asBuffer: false}, function(err, value) {
+            console.log("second handle get() [" + value + "]");
+            other.close(function() {
+                testAggregate();
+            });
+        });
+    });
+}
+
+var testAggregate = function() {
+    db.putSync("metric-1", "10");
+    db.putSync("metric-2", "32");
+    db.aggregate("metric-", "metric.", {op: "bytes"}, function(err, res) {
+        console.log("db.aggregate({op: \"bytes\"}) " + (err ? "failed: " + err : "succed " + JSON.stringify(res)));
+        testParallelIterator();
+    });
+}
+
+var testParallelIterator = function() {
+    var it = db.iterator({parallelism: 4, chunkSize: 2, keyAsBuffer: false, valueAsBuffer: false});
+    var count = 0;
+    var onChunk = function(err, keys, values) {
+        if (err || !keys) {
+            console.log("parallel iterator " + (err ? "failed: " + err : "succed, " + count + " entries"));
+            it.end(testClose);
+            return;
+        }
+        count += keys.length;
+        it.nextChunk(onChunk);
+    };
+    it.nextChunk(onChunk);
+}
+
 var testClose = function() {
+    console.log("db.hotCacheStats(): " + JSON.stringify(db.hotCacheStats()));
+    console.log("db.missCacheStats(): " + JSON.stringify(db.missCacheStats()));
+    console.log("db.cacheUsage(): " + JSON.stringify(db.cacheUsage()));
+    console.log("db.codecStats(): " + JSON.stringify(db.codecStats()));
+    console.log("db.compactionRateLimit(): " + JSON.stringify(db.compactionRateLimit()));
+    console.log("db.ioStats(): " + JSON.stringify(db.ioStats()));
+    console.log("db.memoryUsage(): " + JSON.stringify(db.memoryUsage()));
     var onClose = function(err) {
         console.log("db.close() " + (err ? "failed" : "succed"));
         if (err) {
             console.log(err);
         }
+        testValueLog();
     };
     db.close(onClose);
 }
 
+// the value log is chosen when a database is created, so it gets a directory of its own.
+var testValueLog = function() {
+    var vlog = new HyperLevelDB("/tmp/hyperleveldb-vlog");
+    var options = {valueLog: true, valueLogMinSize: 64, valueLogFileSize: 4 << 10};
+    var large = new Array(1025).join("v");
+    vlog.open(options, function(err) {
+        console.log("valueLog open() " + (err ? "failed: " + err : "succed"));
+        for (var i = 0; i < 16; ++i) {
+            vlog.putSync("large", large + i);
+        }
+        vlog.get("large", {asBuffer: false}, function(err, value) {
+            console.log("valueLog get() " + (value === large + 15 ? "succed" : "failed"));
+            vlog.collectValueLog({minGarbageRatio: 0.5}, function(err, res) {
+                console.log("db.collectValueLog() " + (err ? "failed: " + err : "succed " + JSON.stringify(res)));
+                console.log("db.valueLogStats(): " + JSON.stringify(vlog.valueLogStats()));
+                vlog.close(function() {
+                    vlog.open(options, function(err) {
+                        console.log("valueLog reopen get() " + (vlog.getSync("large", {asBuffer: false}) === large + 15 ? "succed" : "failed"));
+                        vlog.close(testComparator);
+                    });
+                });
+            });
+        });
+    });
+}
+
+var testComparator = function() {
+    var reversed = new HyperLevelDB("/tmp/hyperleveldb-reverse");
+    reversed.open({comparator: "reverseBytewise"}, function(err) {
+        console.log("comparator open() " + (err ? "failed: " + err : "succed"));
+        reversed.putSync("a", "1");
+        reversed.putSync("b", "2");
+        var it = reversed.iterator({keyAsBuffer: false, valueAsBuffer: false});
+        it.next(function(err, key) {
+            console.log("reverseBytewise first key [" + key + "]");
+            it.end(function() {
+                reversed.close(testPendingLimit);
+            });
+        });
+    });
+}
+
+var testPendingLimit = function() {
+    var limited = new HyperLevelDB("/tmp/hyperleveldb-limited");
+    limited.open({maxPendingJobs: 1}, function(err) {
+        var pending = 8, blocked = 0;
+        var onPut = function(err) {
+            if (err && err.isWouldBlock()) {
+                ++blocked;
+            }
+            if (--pending == 0) {
+                console.log("maxPendingJobs: " + blocked + " of 8 puts would block");
+                limited.close(testSharded);
+            }
+        };
+        for (var i = 0; i < 8; ++i) {
+            limited.put("key-" + i, a_value, onPut);
+        }
+    });
+}
+
+var testSharded = function() {
+    var sharded = new binding.ShardedHyperLevelDB("/tmp/hyperleveldb-sharded", 4);
+    sharded.open({cacheSize: 4 << 20}, function(err) {
+        console.log("sharded open() " + (err ? "failed: " + err : "succed"));
+        sharded.put(key_exists, a_value, function(err) {
+            sharded.get(key_exists, function(err, value) {
+                console.log("sharded get() [" + value + "]");
+                console.log("sharded.shardStats(): " + JSON.stringify(sharded.shardStats()));
+                sharded.close(function(err) {
+                    console.log("sharded close() " + (err ? "failed" : "succed"));
+                });
+            });
+        });
+    });
+}
+
 if (require.main == module) {
     testOpen();
 }
@@ -0,0 +1,111 @@
+#pragma once
+
+#include "./assist.h"
+#include "./aggregate.h"
+#include <algorithm>
+#include <cstring>
+#include <string>
+#include <stdint.h>
+#include <status.h>
+
+namespace leveldb {
+
+// Read-modify-write operators of `db.update`. Numbers are stored as 8-byte little-endian values,
+// the same layout `aggregate` reads. A missing key counts as 0 (or as empty bytes).
+enum UpdateOp {UpdateAdd, UpdateAddFloat, UpdateMax, UpdateMin, UpdateAppend, UpdateOr};
+
+class Update
+{
+public:
+	UpdateOp op;
+	std::string key;
+	std::string operand;		// encoded like the stored value for the numeric operators.
+
+	Update(): op(UpdateAdd) {}
+
+	CS_FORCE_INLINE bool numeric() const
+	{
+		return op != UpdateAppend && op != UpdateOr;
+	}
+};
+
+namespace update {
+
+template<typename T>
+CS_FORCE_INLINE static void encode_le(T value, std::string& out)
+{
+	char data[sizeof(T)];
+	std::memcpy(data, &value, sizeof(T));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+	for (size_t i = 0; i < sizeof(T) / 2; ++i)
+	{
+		std::swap(data[i], data[sizeof(T) - 1 - i]);
+	}
+#endif
+	out.assign(data, sizeof(T));
+}
+
+// applies `u` to `current` (NULL if the key is missing) into `out`.
+static leveldb::Status apply(const Update& u, const std::string* current, std::string& out)
+{
+	if (!u.numeric())
+	{
+		out = current ? *current : std::string();
+		if (u.op == UpdateAppend)
+		{
+			out.append(u.operand);
+		}
+		else
+		{
+			if (out.size() < u.operand.size())
+			{
+				out.resize(u.operand.size(), '\0');
+			}
+			for (size_t i = 0; i < u.operand.size(); ++i)
+			{
+				out[i] |= u.operand[i];
+			}
+		}
+		return leveldb::Status::OK();
+	}
+
+	if (CS_BUNLIKELY(current && current->size() != 8))
+	{
+		return leveldb::Status::InvalidArgument(Slice(u.key), "the value is not an 8-byte number");
+	}
+	if (u.op == UpdateAddFloat)
+	{
+		double value = current ? aggregate::decode_le<double>(current->data()) : 0;
+		encode_le(value + aggregate::decode_le<double>(u.operand.data()), out);
+		return leveldb::Status::OK();
+	}
+
+	int64_t operand = aggregate::decode_le<int64_t>(u.operand.data());
+	if (!current)
+	{
+		// 0 + operand, or the only candidate of max/min.
+		encode_le(operand, out);
+		return leveldb::Status::OK();
+	}
+	int64_t value = aggregate::decode_le<int64_t>(current->data());
+	switch (u.op)
+	{
+	case UpdateAdd:
+		value = static_cast<int64_t>(static_cast<uint64_t>(value) + static_cast<uint64_t>(operand));		// wraps around.
+		break;
+	case UpdateMax:
+		value = operand > value ? operand : value;
+		break;
+	case UpdateMin:
+		value = operand < value ? operand : value;
+		break;
+	default:
+		break;
+	}
+	encode_le(value, out);
+	return leveldb::Status::OK();
+}
+
+}
+
+}
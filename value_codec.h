@@ -0,0 +1,520 @@
+#pragma once
+
+#include "./assist.h"
+#include "./value_log.h"
+#include <map>
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
+#include <stdint.h>
+#include <uv.h>
+#include <zstd.h>
+#include <zdict.h>
+#include <env.h>
+#include <iterator.h>
+#include <slice.h>
+#include <status.h>
+
+namespace leveldb {
+
+// Compresses values one by one with zstd, optionally with a dictionary trained on the values of the database
+// and kept beside it in VALUEDICT-<id> files. Called on worker threads only (and the loop thread for iterators).
+// Every stored value starts with an envelope byte, so a database must be created with the codec to be opened with it.
+// With a value log, the large values are moved there once encoded, and only a pointer to them is stored.
+class ValueCodec
+{
+public:
+	enum Envelope {EnvelopeRaw = 0, EnvelopeZstd = 1, EnvelopeBlob = 2};
+
+	// held around the writes of a database from before their values are encoded, so that `ValueLog::collect`
+	// neither swaps the pointer of a key being written nor reclaims a file a pending write points into.
+	class WriteScope
+	{
+	private:
+		ValueLog* const log;
+
+		WriteScope(const WriteScope&);
+		WriteScope& operator=(const WriteScope&);
+
+	public:
+		explicit WriteScope(const ValueCodec* codec):
+			log(codec ? codec->log() : NULL)
+		{
+			if (log)
+			{
+				log->begin_write();
+			}
+		}
+
+		~WriteScope()
+		{
+			if (log)
+			{
+				log->end_write();
+			}
+		}
+
+		// called before a `sync` write, the records it points to must be durable before it.
+		leveldb::Status sync(bool sync) const
+		{
+			return log && sync ? log->sync() : leveldb::Status::OK();
+		}
+	};
+
+	class Stats
+	{
+	public:
+		uint64_t encoded;			// values written.
+		uint64_t stored_raw;		// ... of them stored as they are, for being small or incompressible.
+		uint64_t raw_bytes, stored_bytes;
+		uint64_t encode_ns;
+		uint64_t decoded;
+		uint64_t decode_ns;
+		uint64_t logged;			// values moved to the value log.
+
+		Stats():
+			encoded(0), stored_raw(0), raw_bytes(0), stored_bytes(0), encode_ns(0), decoded(0), decode_ns(0), logged(0)
+		{}
+	};
+
+private:
+	class Dictionary
+	{
+	public:
+		const uint32_t id;
+		ZSTD_CDict* const cdict;
+		ZSTD_DDict* const ddict;
+
+		Dictionary(uint32_t id_, const std::string& content, int level):
+			id(id_),
+			cdict(ZSTD_createCDict(content.data(), content.size(), level)),
+			ddict(ZSTD_createDDict(content.data(), content.size()))
+		{}
+
+		~Dictionary()
+		{
+			ZSTD_freeCDict(cdict);
+			ZSTD_freeDDict(ddict);
+		}
+	};
+
+	typedef std::map<uint32_t, Dictionary*> DictionaryMap;
+
+	static const char* file_prefix()
+	{
+		return "VALUEDICT-";
+	}
+
+	const int level;
+	const size_t min_size;
+
+	// values of at least `log_min_size` bytes go to the value log, if `log_file_size` is set.
+	size_t log_min_size;
+	uint64_t log_file_size;
+	ValueLog* log_;
+
+	// dictionaries are never dropped while the codec lives, old values may still need them.
+	mutable uv_mutex_t lock;
+	DictionaryMap dictionaries;
+	const Dictionary* current;
+
+	mutable Stats stats_;
+
+	// one context per worker thread, they are long-lived.
+	static ZSTD_CCtx* cctx()
+	{
+		static __thread ZSTD_CCtx* ctx = NULL;
+		if (CS_BUNLIKELY(!ctx))
+		{
+			ctx = ZSTD_createCCtx();
+		}
+		return ctx;
+	}
+
+	static ZSTD_DCtx* dctx()
+	{
+		static __thread ZSTD_DCtx* ctx = NULL;
+		if (CS_BUNLIKELY(!ctx))
+		{
+			ctx = ZSTD_createDCtx();
+		}
+		return ctx;
+	}
+
+	const Dictionary* dictionary(uint32_t id) const
+	{
+		uv_mutex_lock(&lock);
+		DictionaryMap::const_iterator it = dictionaries.find(id);
+		const Dictionary* dict = it == dictionaries.end() ? NULL : it->second;
+		uv_mutex_unlock(&lock);
+		return dict;
+	}
+
+	const Dictionary* latest() const
+	{
+		uv_mutex_lock(&lock);
+		const Dictionary* dict = current;
+		uv_mutex_unlock(&lock);
+		return dict;
+	}
+
+	void add(uint32_t id, const std::string& content)
+	{
+		Dictionary* dict = new Dictionary(id, content, level);
+		uv_mutex_lock(&lock);
+		std::pair<DictionaryMap::iterator, bool> res = dictionaries.insert(std::make_pair(id, dict));
+		if (!res.second)
+		{
+			delete dict;
+			dict = res.first->second;
+		}
+		if (!current || id > current->id)
+		{
+			current = dict;
+		}
+		uv_mutex_unlock(&lock);
+	}
+
+	static std::string file_name(const std::string& directory, uint32_t id)
+	{
+		char name[32];
+		std::snprintf(name, sizeof(name), "/%s%u", file_prefix(), id);
+		return directory + name;
+	}
+
+public:
+	// a `min_size` of `never` keeps values uncompressed, for a codec used only for its value log.
+	static const size_t never = ~static_cast<size_t>(0);
+
+	// the largest value decoded, the largest Buffer node makes.
+	static const size_t max_value_size = 0x3fffffff;
+
+	ValueCodec(int level_, size_t min_size_):
+		level(level_), min_size(min_size_), log_min_size(0), log_file_size(0), log_(NULL), current(NULL)
+	{
+		uv_mutex_init(&lock);
+	}
+
+	~ValueCodec()
+	{
+		delete log_;
+		for (DictionaryMap::iterator it = dictionaries.begin(); it != dictionaries.end(); ++it)
+		{
+			delete it->second;
+		}
+		uv_mutex_destroy(&lock);
+	}
+
+	// whether `name`, in the directory of a database, is one of its dictionaries.
+	static bool is_file(const std::string& name)
+	{
+		return name.compare(0, std::strlen(file_prefix()), file_prefix()) == 0;
+	}
+
+	// loads the dictionaries kept in `directory`, the one with the greatest id compresses from now on.
+	leveldb::Status load(leveldb::Env* env, const std::string& directory)
+	{
+		std::vector<std::string> children;
+		leveldb::Status status = env->GetChildren(directory, &children);
+		if (!status.ok())
+		{
+			return status;
+		}
+		const std::string prefix(file_prefix());
+		for (std::vector<std::string>::const_iterator it = children.begin(); it != children.end(); ++it)
+		{
+			if (it->compare(0, prefix.size(), prefix) != 0)
+			{
+				continue;
+			}
+			uint32_t id = std::strtoul(it->c_str() + prefix.size(), NULL, 10);
+			std::string content;
+			status = leveldb::ReadFileToString(env, directory + "/" + *it, &content);
+			if (!status.ok())
+			{
+				return status;
+			}
+			add(id, content);
+		}
+		if (log_file_size)
+		{
+			log_ = new ValueLog(env, directory, log_file_size);
+			return log_->open();
+		}
+		return leveldb::Status::OK();
+	}
+
+	// moves values of at least `min_size_` bytes to a value log, opened by `load`.
+	void use_log(size_t min_size_, uint64_t file_size)
+	{
+		log_min_size = min_size_;
+		log_file_size = file_size;
+	}
+
+	ValueLog* log() const
+	{
+		return log_;
+	}
+
+	// whether values written through `a` are stored as `b` would store them: both compress or not, both use a value log or not.
+	static bool same_format(const ValueCodec* a, const ValueCodec* b)
+	{
+		if (!a || !b)
+		{
+			return a == b;
+		}
+		return (a->min_size == never) == (b->min_size == never) && (a->log_file_size > 0) == (b->log_file_size > 0);
+	}
+
+	// the value log pointer a stored value is, if it is one.
+	static bool pointer_of(const leveldb::Slice& stored, ValueLog::Pointer& pointer)
+	{
+		return !stored.empty() && stored[0] == EnvelopeBlob &&
+			pointer.decode(leveldb::Slice(stored.data() + 1, stored.size() - 1));
+	}
+
+	static void encode_pointer(const ValueLog::Pointer& pointer, std::string& out)
+	{
+		out.assign(1, static_cast<char>(EnvelopeBlob));
+		pointer.encode(out);
+	}
+
+	// trains a dictionary of at most `dict_size` bytes on `samples`, keeps it in `directory` and compresses with it.
+	leveldb::Status train(leveldb::Env* env, const std::string& directory,
+			const std::string& samples, const std::vector<size_t>& sample_sizes, size_t dict_size, uint32_t* id)
+	{
+		if (sample_sizes.empty())
+		{
+			return leveldb::Status::InvalidArgument("no values to train a dictionary on");
+		}
+		std::string content(dict_size, '\0');
+		size_t size = ZDICT_trainFromBuffer(&content[0], dict_size, samples.data(), &sample_sizes[0], sample_sizes.size());
+		if (ZDICT_isError(size))
+		{
+			return leveldb::Status::InvalidArgument("failed to train a value dictionary", ZDICT_getErrorName(size));
+		}
+		content.resize(size);
+		*id = ZDICT_getDictID(content.data(), content.size());
+
+		leveldb::Status status = leveldb::WriteStringToFile(env, leveldb::Slice(content), file_name(directory, *id));
+		if (status.ok())
+		{
+			add(*id, content);
+		}
+		return status;
+	}
+
+	uint32_t dictionary_id() const
+	{
+		const Dictionary* dict = latest();
+		return dict ? dict->id : 0;
+	}
+
+	void encode(const leveldb::Slice& value, std::string& out) const
+	{
+		uint64_t begin = uv_hrtime();
+		out.clear();
+		if (value.size() >= min_size)
+		{
+			const size_t bound = ZSTD_compressBound(value.size());
+			out.resize(1 + bound);
+			out[0] = static_cast<char>(EnvelopeZstd);
+			const Dictionary* dict = latest();
+			size_t size = dict ?
+				ZSTD_compress_usingCDict(cctx(), &out[1], bound, value.data(), value.size(), dict->cdict) :
+				ZSTD_compressCCtx(cctx(), &out[1], bound, value.data(), value.size(), level);
+			if (!ZSTD_isError(size) && size < value.size())
+			{
+				out.resize(1 + size);
+			}
+			else
+			{
+				out.clear();
+			}
+		}
+		if (out.empty())
+		{
+			out.reserve(1 + value.size());
+			out.push_back(static_cast<char>(EnvelopeRaw));
+			out.append(value.data(), value.size());
+			__sync_fetch_and_add(&stats_.stored_raw, 1);
+		}
+		if (log_ && value.size() >= log_min_size)
+		{
+			// if the log cannot be written, the value is stored inline.
+			ValueLog::Pointer pointer;
+			if (log_->append(leveldb::Slice(out), &pointer).ok())
+			{
+				encode_pointer(pointer, out);
+				__sync_fetch_and_add(&stats_.logged, 1);
+			}
+		}
+		__sync_fetch_and_add(&stats_.encoded, 1);
+		__sync_fetch_and_add(&stats_.raw_bytes, value.size());
+		__sync_fetch_and_add(&stats_.stored_bytes, out.size());
+		__sync_fetch_and_add(&stats_.encode_ns, uv_hrtime() - begin);
+	}
+
+	leveldb::Status decode(const leveldb::Slice& stored, std::string& out) const
+	{
+		if (CS_BUNLIKELY(stored.empty()))
+		{
+			return leveldb::Status::Corruption("value without an envelope");
+		}
+		if (stored[0] == EnvelopeRaw)
+		{
+			out.assign(stored.data() + 1, stored.size() - 1);
+			return leveldb::Status::OK();
+		}
+		if (stored[0] == EnvelopeBlob)
+		{
+			ValueLog::Pointer pointer;
+			if (CS_BUNLIKELY(!log_ || !pointer_of(stored, pointer)))
+			{
+				return leveldb::Status::Corruption("a value points to a value log that is not open");
+			}
+			std::string scratch;
+			leveldb::Slice payload;
+			leveldb::Status status = log_->read(pointer, scratch, &payload);
+			if (CS_BUNLIKELY(status.ok() && !payload.empty() && payload[0] == EnvelopeBlob))
+			{
+				return leveldb::Status::Corruption("a blob points to another blob");
+			}
+			return status.ok() ? decode(payload, out) : status;
+		}
+		if (CS_BUNLIKELY(stored[0] != EnvelopeZstd))
+		{
+			return leveldb::Status::Corruption("unknown value envelope");
+		}
+
+		uint64_t begin = uv_hrtime();
+		const char* frame = stored.data() + 1;
+		const size_t frame_size = stored.size() - 1;
+		unsigned long long size = ZSTD_getFrameContentSize(frame, frame_size);
+		if (CS_BUNLIKELY(size == ZSTD_CONTENTSIZE_ERROR || size == ZSTD_CONTENTSIZE_UNKNOWN))
+		{
+			return leveldb::Status::Corruption("malformed compressed value");
+		}
+		// the size comes from the frame header, a damaged one must not make the buffer huge.
+		if (CS_BUNLIKELY(size > max_value_size))
+		{
+			return leveldb::Status::Corruption("compressed value larger than a Buffer");
+		}
+		size_t res;
+		out.resize(size);
+		uint32_t dict_id = ZSTD_getDictID_fromFrame(frame, frame_size);
+		if (dict_id)
+		{
+			const Dictionary* dict = dictionary(dict_id);
+			if (CS_BUNLIKELY(!dict))
+			{
+				return leveldb::Status::Corruption("value compressed with a missing dictionary");
+			}
+			res = ZSTD_decompress_usingDDict(dctx(), size ? &out[0] : NULL, size, frame, frame_size, dict->ddict);
+		}
+		else
+		{
+			res = ZSTD_decompressDCtx(dctx(), size ? &out[0] : NULL, size, frame, frame_size);
+		}
+		if (CS_BUNLIKELY(ZSTD_isError(res)))
+		{
+			return leveldb::Status::Corruption("failed to decompress a value", ZSTD_getErrorName(res));
+		}
+		__sync_fetch_and_add(&stats_.decoded, 1);
+		__sync_fetch_and_add(&stats_.decode_ns, uv_hrtime() - begin);
+		return leveldb::Status::OK();
+	}
+
+	leveldb::Status decode_in_place(std::string& value) const
+	{
+		std::string decoded;
+		leveldb::Status status = decode(leveldb::Slice(value), decoded);
+		value.swap(decoded);
+		return status;
+	}
+
+	Stats stats() const
+	{
+		return stats_;
+	}
+};
+
+// Decodes the values of the iterator it wraps, when they are asked for.
+class DecodingIterator: public leveldb::Iterator
+{
+private:
+	leveldb::Iterator* const base;
+	const ValueCodec* const codec;
+	mutable std::string decoded;
+	mutable leveldb::Status decode_status;
+
+public:
+	// takes the ownership of `base_`.
+	DecodingIterator(leveldb::Iterator* base_, const ValueCodec* codec_):
+		base(base_), codec(codec_)
+	{}
+
+	virtual ~DecodingIterator()
+	{
+		delete base;
+	}
+
+	virtual bool Valid() const
+	{
+		return base->Valid();
+	}
+
+	virtual void SeekToFirst()
+	{
+		base->SeekToFirst();
+	}
+
+	virtual void SeekToLast()
+	{
+		base->SeekToLast();
+	}
+
+	virtual void Seek(const leveldb::Slice& target)
+	{
+		base->Seek(target);
+	}
+
+	virtual void Next()
+	{
+		base->Next();
+	}
+
+	virtual void Prev()
+	{
+		base->Prev();
+	}
+
+	virtual leveldb::Slice key() const
+	{
+		return base->key();
+	}
+
+	virtual leveldb::Slice value() const
+	{
+		leveldb::Status status = codec->decode(base->value(), decoded);
+		if (CS_BUNLIKELY(!status.ok()) && decode_status.ok())
+		{
+			decode_status = status;
+		}
+		return leveldb::Slice(decoded);
+	}
+
+	virtual leveldb::Status status() const
+	{
+		return decode_status.ok() ? base->status() : decode_status;
+	}
+
+	// wraps `it` unless there is no codec.
+	static leveldb::Iterator* wrap(leveldb::Iterator* it, const ValueCodec* codec)
+	{
+		return codec ? new DecodingIterator(it, codec) : it;
+	}
+};
+
+}
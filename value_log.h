@@ -0,0 +1,353 @@
+#pragma once
+
+#include "./assist.h"
+#include "./aggregate.h"
+#include "./update.h"
+#include <map>
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
+#include <stdint.h>
+#include <uv.h>
+#include <env.h>
+#include <slice.h>
+#include <status.h>
+
+namespace leveldb {
+
+// Append-only BLOB-<number> files holding the large values of a database, which keeps a pointer in their place,
+// so that compactions move pointers rather than values. A record is a 4-byte little-endian size,
+// a 4-byte check of the payload, then the payload. Only the newest file is appended to, a new one is started
+// past `file_size` and at every open. `collect` reclaims the files most of whose records are no longer pointed to.
+class ValueLog
+{
+public:
+	class Pointer
+	{
+	public:
+		static const size_t encoded_size = 16;
+
+		uint32_t file;
+		uint64_t offset;	// of the payload, past the record header.
+		uint32_t size;
+
+		Pointer(): file(0), offset(0), size(0) {}
+
+		// appends to `out`.
+		void encode(std::string& out) const
+		{
+			std::string field;
+			update::encode_le(file, field);
+			out.append(field);
+			update::encode_le(offset, field);
+			out.append(field);
+			update::encode_le(size, field);
+			out.append(field);
+		}
+
+		bool decode(const Slice& in)
+		{
+			if (CS_BUNLIKELY(in.size() != encoded_size))
+			{
+				return false;
+			}
+			file = aggregate::decode_le<uint32_t>(in.data());
+			offset = aggregate::decode_le<uint64_t>(in.data() + 4);
+			size = aggregate::decode_le<uint32_t>(in.data() + 12);
+			return true;
+		}
+
+		bool operator==(const Pointer& other) const
+		{
+			return file == other.file && offset == other.offset && size == other.size;
+		}
+	};
+
+	class Stats
+	{
+	public:
+		uint64_t files, bytes;				// files kept, and their bytes.
+		uint64_t appended, appended_bytes;
+		uint64_t collected_files, reclaimed_bytes, relocated;
+
+		Stats():
+			files(0), bytes(0), appended(0), appended_bytes(0), collected_files(0), reclaimed_bytes(0), relocated(0)
+		{}
+	};
+
+	static const size_t header_size = 8;
+
+private:
+	class File
+	{
+	public:
+		leveldb::RandomAccessFile* reader;
+		uint64_t size;
+		bool removed;
+
+		File(): reader(NULL), size(0), removed(false) {}
+	};
+
+	typedef std::map<uint32_t, File> FileMap;
+
+	static const char* file_prefix()
+	{
+		return "BLOB-";
+	}
+
+	leveldb::Env* const env;
+	const std::string directory;
+	const uint64_t file_size;
+
+	// readers are kept until the log is closed, even those of removed files:
+	// a read that found its pointer before `collect` moved it still gets the value from the unlinked file.
+	mutable uv_mutex_t lock;
+	FileMap files;
+	leveldb::WritableFile* writer;
+	uint32_t current;
+	Stats stats_;
+
+	// shared by the writes of the database, taken alone by `collect` while it swaps pointers.
+	uv_rwlock_t gate;
+
+	ValueLog(const ValueLog&);
+	ValueLog& operator=(const ValueLog&);
+
+	std::string file_name(uint32_t number) const
+	{
+		char name[32];
+		std::snprintf(name, sizeof(name), "/%s%06u", file_prefix(), number);
+		return directory + name;
+	}
+
+	// called with `lock` held.
+	leveldb::Status roll()
+	{
+		if (writer)
+		{
+			writer->Sync();
+			writer->Close();
+			delete writer;
+			writer = NULL;
+		}
+		const uint32_t number = current + 1;
+		leveldb::WritableFile* file = NULL;
+		leveldb::Status status = env->NewWritableFile(file_name(number), &file);
+		if (!status.ok())
+		{
+			return status;
+		}
+		// blob files are read with pread by the Env of the database, a mapping would stop at the size they had when opened.
+		leveldb::RandomAccessFile* reader = NULL;
+		status = env->NewRandomAccessFile(file_name(number), &reader);
+		if (!status.ok())
+		{
+			delete file;
+			return status;
+		}
+		writer = file;
+		current = number;
+		files[number].reader = reader;
+		++stats_.files;
+		return status;
+	}
+
+public:
+	ValueLog(leveldb::Env* env_, const std::string& directory_, uint64_t file_size_):
+		env(env_), directory(directory_), file_size(file_size_), writer(NULL), current(0)
+	{
+		uv_mutex_init(&lock);
+		uv_rwlock_init(&gate);
+	}
+
+	~ValueLog()
+	{
+		if (writer)
+		{
+			writer->Sync();
+			writer->Close();
+			delete writer;
+		}
+		for (FileMap::iterator it = files.begin(); it != files.end(); ++it)
+		{
+			delete it->second.reader;
+		}
+		uv_rwlock_destroy(&gate);
+		uv_mutex_destroy(&lock);
+	}
+
+	static bool is_file(const std::string& name)
+	{
+		std::string::size_type slash = name.rfind('/');
+		return name.compare(slash == std::string::npos ? 0 : slash + 1, std::strlen(file_prefix()), file_prefix()) == 0;
+	}
+
+	// opens the files kept in `directory`, appending starts in a new one.
+	leveldb::Status open()
+	{
+		std::vector<std::string> children;
+		leveldb::Status status = env->GetChildren(directory, &children);
+		for (std::vector<std::string>::const_iterator it = children.begin(); status.ok() && it != children.end(); ++it)
+		{
+			if (!is_file(*it))
+			{
+				continue;
+			}
+			uint32_t number = std::strtoul(it->c_str() + std::strlen(file_prefix()), NULL, 10);
+			File& file = files[number];
+			status = env->GetFileSize(directory + "/" + *it, &file.size);
+			if (status.ok())
+			{
+				status = env->NewRandomAccessFile(directory + "/" + *it, &file.reader);
+			}
+			current = number > current ? number : current;
+			++stats_.files;
+			stats_.bytes += file.size;
+		}
+		return status;
+	}
+
+	leveldb::Status append(const Slice& payload, Pointer* pointer)
+	{
+		std::string header;
+		update::encode_le(static_cast<uint32_t>(payload.size()), header);
+		std::string check;
+		update::encode_le(static_cast<uint32_t>(hash_bytes(payload.data(), payload.size())), check);
+		header.append(check);
+
+		uv_mutex_lock(&lock);
+		leveldb::Status status;
+		if (!writer || files[current].size >= file_size)
+		{
+			status = roll();
+		}
+		if (status.ok())
+		{
+			status = writer->Append(Slice(header));
+		}
+		if (status.ok())
+		{
+			status = writer->Append(payload);
+		}
+		if (status.ok())
+		{
+			status = writer->Flush();
+		}
+		if (status.ok())
+		{
+			File& file = files[current];
+			pointer->file = current;
+			pointer->offset = file.size + header_size;
+			pointer->size = payload.size();
+			file.size += header_size + payload.size();
+			++stats_.appended;
+			stats_.appended_bytes += header_size + payload.size();
+			stats_.bytes += header_size + payload.size();
+		}
+		uv_mutex_unlock(&lock);
+		return status;
+	}
+
+	// makes the records appended so far durable, before a `sync` write points to them.
+	leveldb::Status sync()
+	{
+		uv_mutex_lock(&lock);
+		leveldb::Status status = writer ? writer->Sync() : leveldb::Status::OK();
+		uv_mutex_unlock(&lock);
+		return status;
+	}
+
+	// `payload` points into `scratch`.
+	leveldb::Status read(const Pointer& pointer, std::string& scratch, Slice* payload) const
+	{
+		uv_mutex_lock(&lock);
+		FileMap::const_iterator it = files.find(pointer.file);
+		leveldb::RandomAccessFile* reader = it == files.end() ? NULL : it->second.reader;
+		uv_mutex_unlock(&lock);
+		if (CS_BUNLIKELY(!reader || pointer.offset < header_size))
+		{
+			return leveldb::Status::Corruption(file_name(pointer.file), "a value points to a missing blob");
+		}
+
+		scratch.resize(header_size + pointer.size);
+		Slice record;
+		leveldb::Status status = reader->Read(pointer.offset - header_size, scratch.size(), &record, &scratch[0]);
+		if (!status.ok())
+		{
+			return status;
+		}
+		if (CS_BUNLIKELY(record.size() != scratch.size() ||
+				aggregate::decode_le<uint32_t>(record.data()) != pointer.size ||
+				aggregate::decode_le<uint32_t>(record.data() + 4) !=
+					static_cast<uint32_t>(hash_bytes(record.data() + header_size, pointer.size))))
+		{
+			return leveldb::Status::Corruption(file_name(pointer.file), "a blob fails its check");
+		}
+		*payload = Slice(record.data() + header_size, pointer.size);
+		return status;
+	}
+
+	// the files `collect` may reclaim, with their sizes: all but the one appended to.
+	void sealed(std::vector<std::pair<uint32_t, uint64_t> >& out) const
+	{
+		uv_mutex_lock(&lock);
+		for (FileMap::const_iterator it = files.begin(); it != files.end(); ++it)
+		{
+			if (!it->second.removed && !(writer && it->first == current))
+			{
+				out.push_back(std::make_pair(it->first, it->second.size));
+			}
+		}
+		uv_mutex_unlock(&lock);
+	}
+
+	// deletes a file no value points to any more.
+	leveldb::Status remove(uint32_t number, uint64_t relocated)
+	{
+		uv_mutex_lock(&lock);
+		File& file = files[number];
+		uint64_t size = file.removed ? 0 : file.size;
+		if (!file.removed)
+		{
+			file.removed = true;
+			--stats_.files;
+			stats_.bytes -= size;
+			++stats_.collected_files;
+			stats_.reclaimed_bytes += size;
+			stats_.relocated += relocated;
+		}
+		uv_mutex_unlock(&lock);
+		return env->DeleteFile(file_name(number));
+	}
+
+	void begin_write()
+	{
+		uv_rwlock_rdlock(&gate);
+	}
+
+	void end_write()
+	{
+		uv_rwlock_rdunlock(&gate);
+	}
+
+	void lock_writes()
+	{
+		uv_rwlock_wrlock(&gate);
+	}
+
+	void unlock_writes()
+	{
+		uv_rwlock_wrunlock(&gate);
+	}
+
+	Stats stats() const
+	{
+		uv_mutex_lock(&lock);
+		Stats res = stats_;
+		uv_mutex_unlock(&lock);
+		return res;
+	}
+};
+
+}